@@ -1,4 +1,5 @@
 #include <linux/mm.h>
+#include <linux/module.h>
 #include <asm/pgalloc.h>
 #include <asm/pgtable.h>
 #include <asm/tlb.h>
@@ -324,6 +325,7 @@ int ptep_test_and_clear_young(struct vm_area_struct *vma,
 
 	return ret;
 }
+EXPORT_SYMBOL_GPL(ptep_test_and_clear_young);
 
 int ptep_clear_flush_young(struct vm_area_struct *vma,
 			   unsigned long address, pte_t *ptep)
@@ -133,6 +133,8 @@ static u64 blkiocg_##__VAR##_read(struct cgroup *cgroup,		\
 }
 
 SHOW_FUNCTION(weight);
+SHOW_FUNCTION(iops_limit);
+SHOW_FUNCTION(bps_limit);
 #undef SHOW_FUNCTION
 
 static int
@@ -165,6 +167,57 @@ int blkiocg_set_weight(struct cgroup *cgroup, u64 val)
 	return blkiocg_weight_write(cgroup, NULL, val);
 }
 
+static void blkiocg_update_limits(struct blkio_cgroup *blkcg)
+{
+	struct blkio_group *blkg;
+	struct hlist_node *n;
+	struct blkio_policy_type *blkiop;
+
+	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
+		list_for_each_entry(blkiop, &blkio_list, list)
+			if (blkiop->ops.blkio_update_group_limit_fn)
+				blkiop->ops.blkio_update_group_limit_fn(blkg,
+					blkcg->iops_limit, blkcg->bps_limit);
+	}
+}
+
+/*
+ * Zero limit means no cap. The caps are per device, i.e. a group may
+ * dispatch up to iops_limit requests and bps_limit bytes per second
+ * to each disk it uses.
+ */
+int blkiocg_set_limit(struct cgroup *cgroup, unsigned int iops, u64 bps)
+{
+	struct blkio_cgroup *blkcg;
+
+	blkcg = cgroup_to_blkio_cgroup(cgroup);
+	spin_lock(&blkio_list_lock);
+	spin_lock_irq(&blkcg->lock);
+	blkcg->iops_limit = iops;
+	blkcg->bps_limit = bps;
+	blkiocg_update_limits(blkcg);
+	spin_unlock_irq(&blkcg->lock);
+	spin_unlock(&blkio_list_lock);
+	return 0;
+}
+
+static int
+blkiocg_iops_limit_write(struct cgroup *cgroup, struct cftype *cftype, u64 val)
+{
+	if (val > UINT_MAX)
+		return -EINVAL;
+
+	return blkiocg_set_limit(cgroup, (unsigned int)val,
+			cgroup_to_blkio_cgroup(cgroup)->bps_limit);
+}
+
+static int
+blkiocg_bps_limit_write(struct cgroup *cgroup, struct cftype *cftype, u64 val)
+{
+	return blkiocg_set_limit(cgroup,
+			cgroup_to_blkio_cgroup(cgroup)->iops_limit, val);
+}
+
 #define SHOW_FUNCTION_PER_GROUP(__VAR)					\
 static int blkiocg_##__VAR##_read(struct cgroup *cgroup,		\
 			struct cftype *cftype, struct seq_file *m)	\
@@ -210,6 +263,16 @@ struct cftype blkio_files[] = {
 		.read_u64 = blkiocg_weight_read,
 		.write_u64 = blkiocg_weight_write,
 	},
+	{
+		.name = "iops_limit",
+		.read_u64 = blkiocg_iops_limit_read,
+		.write_u64 = blkiocg_iops_limit_write,
+	},
+	{
+		.name = "bps_limit",
+		.read_u64 = blkiocg_bps_limit_read,
+		.write_u64 = blkiocg_bps_limit_write,
+	},
 	{
 		.name = "time",
 		.read_seq_string = blkiocg_time_read,
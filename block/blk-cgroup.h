@@ -20,6 +20,9 @@
 struct blkio_cgroup {
 	struct cgroup_subsys_state css;
 	unsigned int weight;
+	/* dispatch caps, 0 means unlimited */
+	unsigned int iops_limit;
+	u64 bps_limit;
 	spinlock_t lock;
 	struct hlist_head blkg_list;
 };
@@ -49,10 +52,13 @@ extern void blkiocg_css_put(struct blkio_cgroup *blkcg);
 typedef void (blkio_unlink_group_fn) (void *key, struct blkio_group *blkg);
 typedef void (blkio_update_group_weight_fn) (struct blkio_group *blkg,
 						unsigned int weight);
+typedef void (blkio_update_group_limit_fn) (struct blkio_group *blkg,
+						unsigned int iops, u64 bps);
 
 struct blkio_policy_ops {
 	blkio_unlink_group_fn *blkio_unlink_group_fn;
 	blkio_update_group_weight_fn *blkio_update_group_weight_fn;
+	blkio_update_group_limit_fn *blkio_update_group_limit_fn;
 };
 
 struct blkio_policy_type {
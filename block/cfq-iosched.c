@@ -15,6 +15,11 @@
 #include <linux/blktrace_api.h>
 #include "blk-cgroup.h"
 
+#ifdef CONFIG_BC_IO_SCHED
+#include <linux/ve_proto.h>
+#include <bc/io_acct.h>
+#endif
+
 /*
  * tunables
  */
@@ -46,6 +51,9 @@ static const int cfq_hist_divisor = 4;
 #define CFQ_HW_QUEUE_MIN	(5)
 #define CFQ_SERVICE_SHIFT       12
 
+/* granularity of the group iops/bps caps */
+#define CFQ_LIMIT_SLICE		(HZ / 10)
+
 #define CFQQ_SEEK_THR		8 * 1024
 #define CFQQ_SEEKY(cfqq)	((cfqq)->seek_mean > CFQQ_SEEK_THR)
 
@@ -189,10 +197,28 @@ struct cfq_group {
 	unsigned long saved_workload_slice;
 	enum wl_type_t saved_workload;
 	enum wl_prio_t saved_serving_prio;
+
+	/*
+	 * async queue for each priority case
+	 */
+	struct cfq_queue *async_cfqq[2][IOPRIO_BE_NR];
+	struct cfq_queue *async_idle_cfqq;
+
 	struct blkio_group blkg;
 #ifdef CONFIG_CFQ_GROUP_IOSCHED
 	struct hlist_node cfqd_node;
 	atomic_t ref;
+
+	/* dispatch caps, 0 means unlimited, see cfq_cfqg_limit_wait() */
+	unsigned int iops_limit;
+	u64 bps_limit;
+	/* caps set by the cgroup, applied under queue_lock */
+	unsigned int new_iops_limit;
+	u64 new_bps_limit;
+	int limit_changed;
+	unsigned long lim_start;
+	unsigned int lim_ios;
+	u64 lim_bytes;
 #endif
 };
 
@@ -249,12 +275,6 @@ struct cfq_data {
 	struct cfq_queue *active_queue;
 	struct cfq_io_context *active_cic;
 
-	/*
-	 * async queue for each priority case
-	 */
-	struct cfq_queue *async_cfqq[2][IOPRIO_BE_NR];
-	struct cfq_queue *async_idle_cfqq;
-
 	sector_t last_position;
 
 	/*
@@ -281,10 +301,15 @@ struct cfq_data {
 
 	/* List of cfq groups being managed on this device*/
 	struct hlist_head cfqg_list;
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	/* kicks dispatch when a capped group may go on */
+	struct timer_list limit_timer;
+#endif
 	struct rcu_head rcu;
 };
 
 static struct cfq_group *cfq_get_next_cfqg(struct cfq_data *cfqd);
+static void cfq_put_async_queues(struct cfq_group *cfqg);
 
 static struct cfq_rb_root *service_tree_for(struct cfq_group *cfqg,
 					    enum wl_prio_t prio,
@@ -940,6 +965,107 @@ cfq_update_blkio_group_weight(struct blkio_group *blkg, unsigned int weight)
 	cfqg_of_blkg(blkg)->weight = weight;
 }
 
+/*
+ * Called under blkcg->lock, which nests inside queue_lock, so the caps
+ * are only handed over here and applied by cfq_cfqg_limit_wait().
+ */
+void cfq_update_blkio_group_limit(struct blkio_group *blkg,
+				  unsigned int iops, u64 bps)
+{
+	struct cfq_group *cfqg = cfqg_of_blkg(blkg);
+
+	cfqg->new_iops_limit = iops;
+	cfqg->new_bps_limit = bps;
+	smp_wmb();
+	cfqg->limit_changed = 1;
+}
+
+/*
+ * A capped group may dispatch iops_limit requests and bps_limit bytes
+ * per second. The budget grows in CFQ_LIMIT_SLICE steps within a one
+ * second window. Returns 0 if the group may dispatch now or the number
+ * of jiffies to wait otherwise.
+ */
+static unsigned long cfq_cfqg_limit_wait(struct cfq_group *cfqg)
+{
+	unsigned long elapsed;
+
+	if (unlikely(cfqg->limit_changed)) {
+		cfqg->limit_changed = 0;
+		smp_rmb();
+		cfqg->iops_limit = cfqg->new_iops_limit;
+		cfqg->bps_limit = cfqg->new_bps_limit;
+	}
+
+	if (!cfqg->iops_limit && !cfqg->bps_limit)
+		return 0;
+
+	elapsed = jiffies - cfqg->lim_start;
+	if (elapsed >= HZ) {
+		cfqg->lim_start = jiffies;
+		cfqg->lim_ios = 0;
+		cfqg->lim_bytes = 0;
+		elapsed = 0;
+	}
+	elapsed = roundup(elapsed + 1, CFQ_LIMIT_SLICE);
+
+	if (cfqg->iops_limit &&
+	    cfqg->lim_ios >= div_u64((u64)cfqg->iops_limit * elapsed, HZ))
+		goto wait;
+	if (cfqg->bps_limit &&
+	    cfqg->lim_bytes >= div_u64(cfqg->bps_limit * elapsed, HZ))
+		goto wait;
+	return 0;
+
+wait:
+	return cfqg->lim_start + elapsed - jiffies;
+}
+
+static inline void cfq_cfqg_charge_limit(struct cfq_group *cfqg,
+					 struct request *rq)
+{
+	cfqg->lim_ios++;
+	cfqg->lim_bytes += blk_rq_bytes(rq);
+}
+
+/*
+ * Skip groups which ran out of their caps. If all the busy groups are
+ * capped, arm the timer to kick the dispatch when the first one may go.
+ */
+static struct cfq_group *
+cfq_first_unlimited_cfqg(struct cfq_data *cfqd, struct cfq_group *cfqg)
+{
+	unsigned long wait, min_wait = ULONG_MAX;
+	struct rb_node *n;
+
+	for (n = &cfqg->rb_node; n != NULL; n = rb_next(n)) {
+		cfqg = rb_entry_cfqg(n);
+		wait = cfq_cfqg_limit_wait(cfqg);
+		if (!wait)
+			return cfqg;
+		min_wait = min(min_wait, wait);
+	}
+
+	cfq_log(cfqd, "groups capped, wait=%lu", min_wait);
+	mod_timer(&cfqd->limit_timer, jiffies + min_wait);
+	return NULL;
+}
+
+static void cfq_limit_timer(unsigned long data)
+{
+	struct cfq_data *cfqd = (struct cfq_data *)data;
+	unsigned long flags;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+	cfq_schedule_dispatch(cfqd);
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
+}
+
+static inline bool cfq_cfqg_dead(struct cfq_data *cfqd, struct cfq_group *cfqg)
+{
+	return cfqg != &cfqd->root_group && hlist_unhashed(&cfqg->cfqd_node);
+}
+
 static struct cfq_group *
 cfq_find_alloc_cfqg(struct cfq_data *cfqd, struct cgroup *cgroup, int create)
 {
@@ -964,6 +1090,7 @@ cfq_find_alloc_cfqg(struct cfq_data *cfqd, struct cgroup *cgroup, int create)
 		goto done;
 
 	cfqg->weight = blkcg->weight;
+	cfqg->lim_start = jiffies;
 	for_each_cfqg_st(cfqg, i, j, st)
 		*st = CFQ_RB_ROOT;
 	RB_CLEAR_NODE(&cfqg->rb_node);
@@ -981,6 +1108,12 @@ cfq_find_alloc_cfqg(struct cfq_data *cfqd, struct cgroup *cgroup, int create)
 	blkiocg_add_blkio_group(blkcg, &cfqg->blkg, (void *)cfqd,
 					MKDEV(major, minor));
 
+	/* Later changes come through cfq_update_blkio_group_limit() */
+	spin_lock(&blkcg->lock);
+	cfqg->iops_limit = blkcg->iops_limit;
+	cfqg->bps_limit = blkcg->bps_limit;
+	spin_unlock(&blkcg->lock);
+
 	/* Add group on cfqd list */
 	hlist_add_head(&cfqg->cfqd_node, &cfqd->cfqg_list);
 
@@ -993,25 +1126,75 @@ done:
  * Search for the cfq group current task belongs to. If create = 1, then also
  * create the cfq group if it does not exist. request_queue lock must be held.
  */
+#ifdef CONFIG_BC_IO_SCHED
+/*
+ * Writeback is submitted by kernel threads on behalf of the beancounter
+ * which dirtied the pages (see ub_io_writeback_begin), so look for the
+ * group of the IO beancounter's container rather than of current.
+ * ve_list_lock keeps the container cgroup alive, the beancounter caches
+ * it, so the lookup does not walk the containers list.
+ */
+static struct cfq_group *cfq_get_ub_cfqg(struct cfq_data *cfqd, int create,
+					 bool *found)
+{
+	struct user_beancounter *ub;
+	struct cgroup *cgroup;
+	struct cfq_group *cfqg = NULL;
+
+	ub = get_io_ub();
+	if (ub == get_ub0())
+		return NULL;
+
+	read_lock(&ve_list_lock);
+	cgroup = __ub_cgroup(ub);
+	if (cgroup != NULL) {
+		cfqg = cfq_find_alloc_cfqg(cfqd, cgroup, create);
+		*found = true;
+	}
+	read_unlock(&ve_list_lock);
+	return cfqg;
+}
+#endif
+
 static struct cfq_group *cfq_get_cfqg(struct cfq_data *cfqd, int create)
 {
 	struct cgroup *cgroup;
 	struct cfq_group *cfqg = NULL;
+	bool found = false;
 
 	rcu_read_lock();
-	cgroup = task_cgroup(current, blkio_subsys_id);
-	cfqg = cfq_find_alloc_cfqg(cfqd, cgroup, create);
+#ifdef CONFIG_BC_IO_SCHED
+	cfqg = cfq_get_ub_cfqg(cfqd, create, &found);
+#endif
+	if (!found) {
+		cgroup = task_cgroup(current, blkio_subsys_id);
+		cfqg = cfq_find_alloc_cfqg(cfqd, cgroup, create);
+	}
 	if (!cfqg && create)
 		cfqg = &cfqd->root_group;
 	rcu_read_unlock();
 	return cfqg;
 }
 
+#ifdef CONFIG_BC_IO_SCHED
+static inline struct cfq_group *cfq_get_async_cfqg(struct cfq_data *cfqd)
+{
+	return cfq_get_cfqg(cfqd, 1);
+}
+#else
+static inline struct cfq_group *cfq_get_async_cfqg(struct cfq_data *cfqd)
+{
+	return &cfqd->root_group;
+}
+#endif
+
 static void cfq_link_cfqq_cfqg(struct cfq_queue *cfqq, struct cfq_group *cfqg)
 {
+#ifndef CONFIG_BC_IO_SCHED
 	/* Currently, all async queues are mapped to root group */
 	if (!cfq_cfqq_sync(cfqq))
 		cfqg = &cfqq->cfqd->root_group;
+#endif
 
 	cfqq->cfqg = cfqg;
 	/* cfqq reference on cfqg */
@@ -1037,6 +1220,7 @@ static void cfq_destroy_cfqg(struct cfq_data *cfqd, struct cfq_group *cfqg)
 	BUG_ON(hlist_unhashed(&cfqg->cfqd_node));
 
 	hlist_del_init(&cfqg->cfqd_node);
+	cfq_put_async_queues(cfqg);
 
 	/*
 	 * Put the reference taken at the time of creation so that when all
@@ -1090,6 +1274,25 @@ static struct cfq_group *cfq_get_cfqg(struct cfq_data *cfqd, int create)
 {
 	return &cfqd->root_group;
 }
+static inline struct cfq_group *cfq_get_async_cfqg(struct cfq_data *cfqd)
+{
+	return &cfqd->root_group;
+}
+static inline unsigned long cfq_cfqg_limit_wait(struct cfq_group *cfqg)
+{
+	return 0;
+}
+static inline void cfq_cfqg_charge_limit(struct cfq_group *cfqg,
+					 struct request *rq) {}
+static inline struct cfq_group *
+cfq_first_unlimited_cfqg(struct cfq_data *cfqd, struct cfq_group *cfqg)
+{
+	return cfqg;
+}
+static inline bool cfq_cfqg_dead(struct cfq_data *cfqd, struct cfq_group *cfqg)
+{
+	return false;
+}
 static inline void
 cfq_link_cfqq_cfqg(struct cfq_queue *cfqq, struct cfq_group *cfqg) {
 	cfqq->cfqg = cfqg;
@@ -1638,7 +1841,8 @@ static struct cfq_queue *cfq_get_next_queue_forced(struct cfq_data *cfqd)
 	if (!cfqd->rq_queued)
 		return NULL;
 
-	cfqg = cfq_get_next_cfqg(cfqd);
+	/* Draining must not be held back by the group caps */
+	cfqg = cfq_rb_first_group(&cfqd->grp_service_tree);
 	if (!cfqg)
 		return NULL;
 
@@ -2073,7 +2277,9 @@ static struct cfq_group *cfq_get_next_cfqg(struct cfq_data *cfqd)
 
 	if (RB_EMPTY_ROOT(&st->rb))
 		return NULL;
-	cfqg = cfq_rb_first_group(st);
+	cfqg = cfq_first_unlimited_cfqg(cfqd, cfq_rb_first_group(st));
+	if (!cfqg)
+		return NULL;
 	st->active = &cfqg->rb_node;
 	update_min_vdisktime(st);
 	return cfqg;
@@ -2084,6 +2290,9 @@ static void cfq_choose_cfqg(struct cfq_data *cfqd)
 	struct cfq_group *cfqg = cfq_get_next_cfqg(cfqd);
 
 	cfqd->serving_group = cfqg;
+	/* all busy groups are capped */
+	if (!cfqg)
+		return;
 
 	/* Restore the workload type data */
 	if (cfqg->saved_workload_slice) {
@@ -2111,6 +2320,12 @@ static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd)
 	if (!cfqd->rq_queued)
 		return NULL;
 
+	/*
+	 * The group ran out of its iops/bps caps, let others run
+	 */
+	if (cfq_cfqg_limit_wait(cfqq->cfqg))
+		goto expire;
+
 	/*
 	 * We were waiting for group to get backlogged. Expire the queue
 	 */
@@ -2306,6 +2521,7 @@ static bool cfq_dispatch_request(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	/*
 	 * insert request into driver dispatch list
 	 */
+	cfq_cfqg_charge_limit(cfqq->cfqg, rq);
 	cfq_dispatch_insert(cfqd->queue, rq);
 
 	if (!cfqd->active_cic) {
@@ -2734,6 +2950,11 @@ retry:
 	cic = cfq_cic_lookup(cfqd, ioc);
 	/* cic always exists here */
 	cfqq = cic_to_cfqq(cic, is_sync);
+#ifdef CONFIG_BC_IO_SCHED
+	/* async queue of another container's group */
+	if (cfqq && !is_sync && cfqq->cfqg != cfqg)
+		cfqq = NULL;
+#endif
 
 	/*
 	 * Always try a new alloc if we fell back to the OOM cfqq
@@ -2774,15 +2995,15 @@ retry:
 }
 
 static struct cfq_queue **
-cfq_async_queue_prio(struct cfq_data *cfqd, int ioprio_class, int ioprio)
+cfq_async_queue_prio(struct cfq_group *cfqg, int ioprio_class, int ioprio)
 {
 	switch (ioprio_class) {
 	case IOPRIO_CLASS_RT:
-		return &cfqd->async_cfqq[0][ioprio];
+		return &cfqg->async_cfqq[0][ioprio];
 	case IOPRIO_CLASS_BE:
-		return &cfqd->async_cfqq[1][ioprio];
+		return &cfqg->async_cfqq[1][ioprio];
 	case IOPRIO_CLASS_IDLE:
-		return &cfqd->async_idle_cfqq;
+		return &cfqg->async_idle_cfqq;
 	default:
 		BUG();
 	}
@@ -2798,17 +3019,26 @@ cfq_get_queue(struct cfq_data *cfqd, bool is_sync, struct io_context *ioc,
 	struct cfq_queue *cfqq = NULL;
 
 	if (!is_sync) {
-		async_cfqq = cfq_async_queue_prio(cfqd, ioprio_class, ioprio);
+		async_cfqq = cfq_async_queue_prio(cfq_get_async_cfqg(cfqd),
+						  ioprio_class, ioprio);
 		cfqq = *async_cfqq;
 	}
 
-	if (!cfqq)
+	if (!cfqq) {
 		cfqq = cfq_find_alloc_queue(cfqd, is_sync, ioc, gfp_mask);
+		/*
+		 * the queue lock may have been dropped, so use the group
+		 * the new queue is linked to
+		 */
+		if (!is_sync)
+			async_cfqq = cfq_async_queue_prio(cfqq->cfqg,
+							  ioprio_class, ioprio);
+	}
 
 	/*
 	 * pin the queue now that it's allocated, scheduler exit will prune it
 	 */
-	if (!is_sync && !(*async_cfqq)) {
+	if (!is_sync && !(*async_cfqq) && !cfq_cfqg_dead(cfqd, cfqq->cfqg)) {
 		atomic_inc(&cfqq->ref);
 		*async_cfqq = cfqq;
 	}
@@ -3479,6 +3709,17 @@ cfq_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
 
 new_queue:
 	cfqq = cic_to_cfqq(cic, is_sync);
+#ifdef CONFIG_BC_IO_SCHED
+	/*
+	 * Async IO of a flusher thread goes to the groups of different
+	 * containers, drop the cached queue if it is not the current one.
+	 */
+	if (cfqq && !is_sync && cfqq->cfqg != cfq_get_cfqg(cfqd, 1)) {
+		cic_set_cfqq(cic, NULL, is_sync);
+		cfq_put_queue(cfqq);
+		cfqq = NULL;
+	}
+#endif
 	if (!cfqq || cfqq == &cfqd->oom_cfqq) {
 		cfqq = cfq_get_queue(cfqd, is_sync, cic->ioc, gfp_mask);
 		cic_set_cfqq(cic, cfqq, is_sync);
@@ -3592,22 +3833,28 @@ out_cont:
 static void cfq_shutdown_timer_wq(struct cfq_data *cfqd)
 {
 	del_timer_sync(&cfqd->idle_slice_timer);
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	del_timer_sync(&cfqd->limit_timer);
+#endif
 	cancel_work_sync(&cfqd->unplug_work);
 }
 
-static void cfq_put_async_queues(struct cfq_data *cfqd)
+static void cfq_put_async_queues(struct cfq_group *cfqg)
 {
 	int i;
 
 	for (i = 0; i < IOPRIO_BE_NR; i++) {
-		if (cfqd->async_cfqq[0][i])
-			cfq_put_queue(cfqd->async_cfqq[0][i]);
-		if (cfqd->async_cfqq[1][i])
-			cfq_put_queue(cfqd->async_cfqq[1][i]);
+		if (cfqg->async_cfqq[0][i])
+			cfq_put_queue(cfqg->async_cfqq[0][i]);
+		if (cfqg->async_cfqq[1][i])
+			cfq_put_queue(cfqg->async_cfqq[1][i]);
+		cfqg->async_cfqq[0][i] = NULL;
+		cfqg->async_cfqq[1][i] = NULL;
 	}
 
-	if (cfqd->async_idle_cfqq)
-		cfq_put_queue(cfqd->async_idle_cfqq);
+	if (cfqg->async_idle_cfqq)
+		cfq_put_queue(cfqg->async_idle_cfqq);
+	cfqg->async_idle_cfqq = NULL;
 }
 
 static void cfq_cfqd_free(struct rcu_head *head)
@@ -3635,7 +3882,7 @@ static void cfq_exit_queue(struct elevator_queue *e)
 		__cfq_exit_single_io_context(cfqd, cic);
 	}
 
-	cfq_put_async_queues(cfqd);
+	cfq_put_async_queues(&cfqd->root_group);
 	cfq_release_cfq_groups(cfqd);
 	blkiocg_del_blkio_group(&cfqd->root_group.blkg);
 
@@ -3703,6 +3950,9 @@ static void *cfq_init_queue(struct request_queue *q)
 	init_timer(&cfqd->idle_slice_timer);
 	cfqd->idle_slice_timer.function = cfq_idle_slice_timer;
 	cfqd->idle_slice_timer.data = (unsigned long) cfqd;
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	setup_timer(&cfqd->limit_timer, cfq_limit_timer, (unsigned long)cfqd);
+#endif
 
 	INIT_WORK(&cfqd->unplug_work, cfq_kick_queue);
 
@@ -3877,6 +4127,7 @@ static struct blkio_policy_type blkio_policy_cfq = {
 	.ops = {
 		.blkio_unlink_group_fn =	cfq_unlink_blkio_group,
 		.blkio_update_group_weight_fn =	cfq_update_blkio_group_weight,
+		.blkio_update_group_limit_fn =	cfq_update_blkio_group_limit,
 	},
 };
 #else
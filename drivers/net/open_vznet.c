@@ -32,9 +32,8 @@ void veip_stop(struct ve_struct *ve)
 		struct ip_entry_struct *ptr;
 		ptr = list_entry(p, struct ip_entry_struct, ve_list);
 		ptr->active_env = NULL;
-		list_del(&ptr->ve_list);
-		list_del(&ptr->ip_hash);
-		kfree(ptr);
+		ip_entry_unhash(ptr);
+		ip_entry_free(ptr);
 	}
 	veip_put(ve->veip);
 	ve->veip = NULL;
@@ -90,6 +89,8 @@ int veip_entry_add(struct ve_struct *ve, struct ve_addr_struct *addr)
 	entry = NULL;
 out_unlock:
 	write_unlock_irq(&veip_hash_lock);
+	if (err == 0)
+		veip_hash_grow();
 out:
 	if (entry != NULL)
 		kfree(entry);
@@ -112,9 +113,8 @@ int veip_entry_del(envid_t veid, struct ve_addr_struct *addr)
 	err = 0;
 	found->active_env = NULL;
 
-	list_del(&found->ip_hash);
-	list_del(&found->ve_list);
-	kfree(found);
+	ip_entry_unhash(found);
+	ip_entry_free(found);
 out:
 	write_unlock_irq(&veip_hash_lock);
 	return err;
@@ -166,7 +166,7 @@ int venet_change_skb_owner(struct sk_buff *skb)
 
 	ve_old = skb->owner_env;
 
-	read_lock(&veip_hash_lock);
+	rcu_read_lock();
 	if (!ve_is_super(ve_old)) {
 		/* from VE to host */
 		ve = venet_find_ve(skb, 0);
@@ -182,16 +182,16 @@ int venet_change_skb_owner(struct sk_buff *skb)
 			goto out_drop;
 		skb->owner_env = ve;
 	}
-	read_unlock(&veip_hash_lock);
+	rcu_read_unlock();
 
 	return 0;
 
 out_drop:
-	read_unlock(&veip_hash_lock);
+	rcu_read_unlock();
 	return -ESRCH;
 
 out_source:
-	read_unlock(&veip_hash_lock);
+	rcu_read_unlock();
 	if (net_ratelimit() && skb->protocol == __constant_htons(ETH_P_IP)) {
 		printk(KERN_WARNING "Dropped packet, source wrong "
 		       "veid=%u src-IP=%u.%u.%u.%u "
@@ -206,16 +206,14 @@ out_source:
 #ifdef CONFIG_PROC_FS
 int veip_seq_show(struct seq_file *m, void *v)
 {
-	struct list_head *p;
 	struct ip_entry_struct *entry;
 	char s[40];
 
-	p = (struct list_head *)v;
-	if (p == ip_entry_hash_table) {
+	if (v == SEQ_START_TOKEN) {
 		seq_puts(m, "Version: 2.5\n");
 		return 0;
 	}
-	entry = list_entry(p, struct ip_entry_struct, ip_hash);
+	entry = (struct ip_entry_struct *)v;
 	veaddr_print(s, sizeof(s), &entry->addr);
 	seq_printf(m, "%39s %10u\n", s, 0);
 	return 0;
@@ -227,14 +225,14 @@ __exit void veip_cleanup(void)
 	int i;
 
 	write_lock_irq(&veip_hash_lock);
-	for (i = 0; i < VEIP_HASH_SZ; i++)
-		while (!list_empty(ip_entry_hash_table + i)) {
+	for (i = 0; i < veip_hash->size; i++)
+		while (!hlist_empty(veip_hash->heads + i)) {
 			struct ip_entry_struct *entry;
 
-			entry = list_first_entry(ip_entry_hash_table + i,
-					struct ip_entry_struct, ip_hash);
-			list_del(&entry->ip_hash);
-			kfree(entry);
+			entry = veip_hash_entry(veip_hash->heads[i].first,
+					veip_hash->node);
+			ip_entry_unhash(entry);
+			ip_entry_free(entry);
 		}
 	write_unlock_irq(&veip_hash_lock);
 }
@@ -28,6 +28,10 @@
 #include <linux/tcp.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/mutex.h>
 #include <net/addrconf.h>
 
 #include <asm/system.h>
@@ -49,18 +53,121 @@
 #include <linux/vzctl.h>
 #include <linux/vzctl_venet.h>
 
-struct list_head ip_entry_hash_table[VEIP_HASH_SZ];
+struct veip_hash *veip_hash;
 rwlock_t veip_hash_lock = RW_LOCK_UNLOCKED;
 LIST_HEAD(veip_lh);
 
-#define ip_entry_hash_function(ip)  (ntohl(ip) & (VEIP_HASH_SZ - 1))
+static unsigned int veip_hash_count;
+static u32 veip_hash_rnd __read_mostly;
+/* serializes resizers, held across the grace period */
+static DEFINE_MUTEX(veip_hash_mutex);
+
+static inline unsigned int veip_hashfn(struct ve_addr_struct *addr,
+		unsigned int size)
+{
+	return jhash2(addr->key, 4, addr->family ^ veip_hash_rnd) & (size - 1);
+}
+
+static struct veip_hash *veip_hash_alloc(unsigned int size)
+{
+	struct veip_hash *h;
+	size_t sz;
+	int i;
+
+	sz = sizeof(struct veip_hash) + size * sizeof(struct hlist_head);
+	if (sz <= PAGE_SIZE)
+		h = kmalloc(sz, GFP_KERNEL);
+	else
+		h = vmalloc(sz);
+	if (h == NULL)
+		return NULL;
+
+	h->size = size;
+	h->node = 0;
+	for (i = 0; i < size; i++)
+		INIT_HLIST_HEAD(h->heads + i);
+	return h;
+}
+
+static void veip_hash_free(struct veip_hash *h)
+{
+	if (is_vmalloc_addr(h))
+		vfree(h);
+	else
+		kfree(h);
+}
 
 void ip_entry_hash(struct ip_entry_struct *entry, struct veip_struct *veip)
 {
-	list_add(&entry->ip_hash,
-			ip_entry_hash_table +
-			ip_entry_hash_function(entry->addr.key[3]));
+	struct veip_hash *h = veip_hash;
+
+	hlist_add_head_rcu(&entry->ip_hash[h->node],
+			h->heads + veip_hashfn(&entry->addr, h->size));
 	list_add(&entry->ve_list, &veip->ip_lh);
+	veip_hash_count++;
+}
+
+void ip_entry_unhash(struct ip_entry_struct *entry)
+{
+	hlist_del_rcu(&entry->ip_hash[veip_hash->node]);
+	list_del(&entry->ve_list);
+	veip_hash_count--;
+}
+
+static void ip_entry_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct ip_entry_struct, rcu));
+}
+
+void ip_entry_free(struct ip_entry_struct *entry)
+{
+	call_rcu(&entry->rcu, ip_entry_free_rcu);
+}
+
+/*
+ * Entries are relinked to the new table via their spare hash link, so
+ * readers, which still walk the old table, see all its chains intact.
+ * The spare link of an entry becomes free for the next resize only after
+ * the grace period, that is why the mutex is held across it.
+ */
+void veip_hash_grow(void)
+{
+	struct veip_hash *old, *new;
+	unsigned int size, i;
+
+	mutex_lock(&veip_hash_mutex);
+	old = veip_hash;
+	size = old->size;
+	while (size < veip_hash_count && size < VEIP_HASH_MAX)
+		size <<= 1;
+	if (size == old->size)
+		goto out;
+
+	new = veip_hash_alloc(size);
+	if (new == NULL)
+		/* old table keeps working, just with longer chains */
+		goto out;
+	new->node = !old->node;
+
+	write_lock_irq(&veip_hash_lock);
+	for (i = 0; i < old->size; i++) {
+		struct hlist_node *n;
+
+		hlist_for_each(n, old->heads + i) {
+			struct ip_entry_struct *entry;
+
+			entry = veip_hash_entry(n, old->node);
+			hlist_add_head(&entry->ip_hash[new->node], new->heads +
+					veip_hashfn(&entry->addr, new->size));
+		}
+	}
+	rcu_assign_pointer(veip_hash, new);
+	write_unlock_irq(&veip_hash_lock);
+
+	synchronize_rcu();
+	veip_hash_free(old);
+out:
+	mutex_unlock(&veip_hash_mutex);
 }
 
 void veip_put(struct veip_struct *veip)
@@ -78,12 +185,18 @@ void veip_put(struct veip_struct *veip)
 
 struct ip_entry_struct *venet_entry_lookup(struct ve_addr_struct *addr)
 {
-	struct ip_entry_struct *entry;
+	struct veip_hash *h;
+	struct hlist_node *n;
+
+	h = rcu_dereference(veip_hash);
+	for (n = rcu_dereference(h->heads[veip_hashfn(addr, h->size)].first);
+	     n != NULL; n = rcu_dereference(n->next)) {
+		struct ip_entry_struct *entry;
 
-	list_for_each_entry (entry, ip_entry_hash_table +
-			ip_entry_hash_function(addr->key[3]), ip_hash)
+		entry = veip_hash_entry(n, h->node);
 		if (memcmp(&entry->addr, addr, sizeof(*addr)) == 0)
 			return entry;
+	}
 	return NULL;
 }
 
@@ -303,7 +416,7 @@ static void venet_destructor(struct net_device *dev)
  */
 static int venet_xmit(struct sk_buff *skb, struct net_device *dev)
 {
-	struct net_device_stats *stats;
+	struct net_device_stats *stats, *rcv_stats;
 	struct net_device *rcv = NULL;
 	int length;
 
@@ -348,24 +461,20 @@ static int venet_xmit(struct sk_buff *skb, struct net_device *dev)
 	skb->pkt_type = PACKET_HOST;
 	skb->dev = rcv;
 
+	/* there is no link header, mac header is the network one */
 	skb_reset_mac_header(skb);
-	memset(skb->data - dev->hard_header_len, 0, dev->hard_header_len);
 
 	nf_reset(skb);
 	length = skb->len;
 
-	netif_rx(skb);
-
+	rcv_stats = venet_stats(rcv, smp_processor_id());
+	rcv_stats->rx_bytes += length;
+	rcv_stats->rx_packets++;
 	stats->tx_bytes += length;
 	stats->tx_packets++;
-	if (rcv) {
-		struct net_device_stats *rcv_stats;
 
-		rcv_stats = venet_stats(rcv, smp_processor_id());
-		rcv_stats->rx_bytes += length;
-		rcv_stats->rx_packets++;
-		dev_put(rcv);
-	}
+	netif_rx(skb);
+	dev_put(rcv);
 
 	return 0;
 
@@ -570,46 +679,52 @@ unlock:
 	read_unlock(&veip_hash_lock);
 }
 
+static struct ip_entry_struct *veip_seq_bucket(unsigned int i)
+{
+	for (; i < veip_hash->size; i++)
+		if (!hlist_empty(veip_hash->heads + i))
+			return veip_hash_entry(veip_hash->heads[i].first,
+					veip_hash->node);
+	return NULL;
+}
+
+static struct ip_entry_struct *veip_seq_entry_next(struct ip_entry_struct *e)
+{
+	struct hlist_node *n;
+
+	n = e->ip_hash[veip_hash->node].next;
+	if (n != NULL)
+		return veip_hash_entry(n, veip_hash->node);
+	return veip_seq_bucket(veip_hashfn(&e->addr, veip_hash->size) + 1);
+}
+
 static void *veip_seq_start(struct seq_file *m, loff_t *pos)
 {
+	struct ip_entry_struct *entry;
 	loff_t l;
-	struct list_head *p;
-	int i;
 
 	l = *pos;
-	write_lock_irq(&veip_hash_lock);
+	read_lock(&veip_hash_lock);
 	if (l == 0)
-		return ip_entry_hash_table;
-	for (i = 0; i < VEIP_HASH_SZ; i++) {
-		list_for_each(p, ip_entry_hash_table + i) {
-			if (--l == 0)
-				return p;
-		}
-	}
+		return SEQ_START_TOKEN;
+	for (entry = veip_seq_bucket(0); entry != NULL;
+	     entry = veip_seq_entry_next(entry))
+		if (--l == 0)
+			return entry;
 	return NULL;
 }
 
 static void *veip_seq_next(struct seq_file *m, void *v, loff_t *pos)
 {
-	struct list_head *p;
-
-	p = (struct list_head *)v;
-	while (1) {
-		p = p->next;
-		if (p < ip_entry_hash_table ||
-		    p >= ip_entry_hash_table + VEIP_HASH_SZ) {
-			(*pos)++;
-			return p;
-		}
-		if (++p >= ip_entry_hash_table + VEIP_HASH_SZ)
-			return NULL;
-	}
-	return NULL;
+	(*pos)++;
+	if (v == SEQ_START_TOKEN)
+		return veip_seq_bucket(0);
+	return veip_seq_entry_next(v);
 }
 
 static void veip_seq_stop(struct seq_file *m, void *v)
 {
-	write_unlock_irq(&veip_hash_lock);
+	read_unlock(&veip_hash_lock);
 }
 
 static struct seq_operations veip_seq_op = {
@@ -822,17 +937,21 @@ __init int venet_init(void)
 #ifdef CONFIG_PROC_FS
 	struct proc_dir_entry *de;
 #endif
-	int i, err;
+	int err;
 
 	if (get_ve0()->_venet_dev != NULL)
 		return -EEXIST;
 
-	for (i = 0; i < VEIP_HASH_SZ; i++)
-		INIT_LIST_HEAD(ip_entry_hash_table + i);
+	get_random_bytes(&veip_hash_rnd, sizeof(veip_hash_rnd));
+	veip_hash = veip_hash_alloc(VEIP_HASH_SZ);
+	if (veip_hash == NULL)
+		return -ENOMEM;
 
 	err = venet_start(get_ve0());
-	if (err)
+	if (err) {
+		veip_hash_free(veip_hash);
 		return err;
+	}
 
 #ifdef CONFIG_PROC_FS
 	de = proc_create("veip", S_IFREG | S_IRUSR, proc_vz_dir,
@@ -858,6 +977,9 @@ __exit void venet_exit(void)
 #endif
 	venet_stop(get_ve0());
 	veip_cleanup();
+	/* wait for ip_entry_free_rcu() callbacks */
+	rcu_barrier();
+	veip_hash_free(veip_hash);
 }
 
 module_init(venet_init);
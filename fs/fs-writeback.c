@@ -25,6 +25,8 @@
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
 #include <linux/buffer_head.h>
+#include <bc/beancounter.h>
+#include <bc/io_acct.h>
 #include "internal.h"
 
 #define inode_to_bdi(inode)	((inode)->i_mapping->backing_dev_info)
@@ -40,6 +42,7 @@ int nr_pdflush_threads;
 struct wb_writeback_args {
 	long nr_pages;
 	struct super_block *sb;
+	struct user_beancounter *wb_ub;
 	enum writeback_sync_modes sync_mode;
 	int for_kupdate:1;
 	int range_cyclic:1;
@@ -80,6 +83,7 @@ static inline void bdi_work_init(struct bdi_work *work,
 	INIT_RCU_HEAD(&work->rcu_head);
 	work->args = *args;
 	work->state = WS_USED;
+	get_beancounter(work->args.wb_ub);
 }
 
 /**
@@ -110,6 +114,7 @@ static void bdi_work_free(struct rcu_head *head)
 {
 	struct bdi_work *work = container_of(head, struct bdi_work, rcu_head);
 
+	put_beancounter(work->args.wb_ub);
 	if (!bdi_work_on_stack(work))
 		kfree(work);
 	else
@@ -635,6 +640,14 @@ static void writeback_inodes_wb(struct bdi_writeback *wb,
 			continue;
 		}
 
+		/*
+		 * beancounter given and the inode is dirtied by another one
+		 */
+		if (ub_should_skip_writeback(wbc->wb_ub, inode)) {
+			redirty_tail(inode);
+			continue;
+		}
+
 		if (!bdi_cap_writeback_dirty(wb->bdi)) {
 			redirty_tail(inode);
 			if (is_blkdev_sb) {
@@ -753,6 +766,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 	struct writeback_control wbc = {
 		.bdi			= wb->bdi,
 		.sb			= args->sb,
+		.wb_ub			= args->wb_ub,
 		.sync_mode		= args->sync_mode,
 		.older_than_this	= NULL,
 		.for_kupdate		= args->for_kupdate,
@@ -907,6 +921,9 @@ long wb_do_writeback(struct bdi_writeback *wb, int force_wait)
 		if (force_wait)
 			work->args.sync_mode = args.sync_mode = WB_SYNC_ALL;
 
+		/* the work may be freed before we are done */
+		get_beancounter(args.wb_ub);
+
 		/*
 		 * If this isn't a data integrity operation, just notify
 		 * that we have seen this work and we are now starting it.
@@ -922,6 +939,7 @@ long wb_do_writeback(struct bdi_writeback *wb, int force_wait)
 		 */
 		if (args.sync_mode == WB_SYNC_ALL)
 			wb_clear_pending(wb, work);
+		put_beancounter(args.wb_ub);
 	}
 
 	/*
@@ -976,10 +994,12 @@ int bdi_writeback_task(struct bdi_writeback *wb)
  * Schedule writeback for all backing devices. This does WB_SYNC_NONE
  * writeback, for integrity writeback see bdi_sync_writeback().
  */
-static void bdi_writeback_all(struct super_block *sb, long nr_pages)
+static void bdi_writeback_all(struct super_block *sb, long nr_pages,
+			      struct user_beancounter *ub)
 {
 	struct wb_writeback_args args = {
 		.sb		= sb,
+		.wb_ub		= ub,
 		.nr_pages	= nr_pages,
 		.sync_mode	= WB_SYNC_NONE,
 	};
@@ -1006,7 +1026,16 @@ void wakeup_flusher_threads(long nr_pages)
 	if (nr_pages == 0)
 		nr_pages = global_page_state(NR_FILE_DIRTY) +
 				global_page_state(NR_UNSTABLE_NFS);
-	bdi_writeback_all(NULL, nr_pages);
+	bdi_writeback_all(NULL, nr_pages, NULL);
+}
+
+/*
+ * Start writeback of `nr_pages' pages dirtied by the beancounter on
+ * all backing devices.
+ */
+void wakeup_flusher_threads_ub(long nr_pages, struct user_beancounter *ub)
+{
+	bdi_writeback_all(NULL, nr_pages, ub);
 }
 
 static noinline void block_dump___mark_inode_dirty(struct inode *inode)
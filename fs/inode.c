@@ -31,6 +31,8 @@
 #include <linux/async.h>
 #include <linux/posix_acl.h>
 #include <linux/vzstat.h>
+#include <bc/vmpages.h>
+#include <bc/io_acct.h>
 
 /*
  * This is needed for the following functions:
@@ -184,6 +186,12 @@ int inode_init_always(struct super_block *sb, struct inode *inode)
 	mapping->flags = 0;
 	mapping_set_gfp_mask(mapping, GFP_HIGHUSER_MOVABLE);
 	mapping->assoc_mapping = NULL;
+#ifdef CONFIG_BC_RSS_ACCOUNTING
+	mapping->cache_ub = NULL;
+#endif
+#ifdef CONFIG_BC_IO_ACCOUNTING
+	mapping->dirtied_ub = NULL;
+#endif
 	mapping->backing_dev_info = &default_backing_dev_info;
 	mapping->writeback_index = 0;
 
@@ -246,6 +254,8 @@ void __destroy_inode(struct inode *inode)
 	ima_inode_free(inode);
 	security_inode_free(inode);
 	fsnotify_inode_delete(inode);
+	ub_mapping_release(&inode->i_data);
+	ub_io_mapping_release(&inode->i_data);
 #ifdef CONFIG_FS_POSIX_ACL
 	if (inode->i_acl && inode->i_acl != ACL_NOT_CACHED)
 		posix_acl_release(inode->i_acl);
@@ -21,6 +21,7 @@
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/bio.h>
+#include <bc/io_acct.h>
 
 /*
  * Default IO end handler for temporary BJ_IO buffer_heads.
@@ -178,9 +179,14 @@ static void journal_do_submit_data(struct buffer_head **wbuf, int bufs,
 	int i;
 
 	for (i = 0; i < bufs; i++) {
+		struct user_beancounter *io_ub;
+
 		wbuf[i]->b_end_io = end_buffer_write_sync;
+		/* Ordered data goes to the group of who dirtied it */
+		io_ub = ub_io_mapping_writeback_begin(wbuf[i]->b_page->mapping);
 		/* We use-up our safety reference in submit_bh() */
 		submit_bh(write_op, wbuf[i]);
+		ub_io_writeback_end(io_ub);
 	}
 }
 
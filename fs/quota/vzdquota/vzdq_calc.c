@@ -0,0 +1,718 @@
+/*
+ * Copyright (C) 2011  Parallels
+ * All rights reserved.
+ *
+ * Licensing governed by "linux/COPYING.SWsoft" file.
+ *
+ * This file contains the in-kernel usage calculation (quotacheck) for
+ * Virtuozzo disk quota: the quota tree is walked by several threads and
+ * the result is stored into the quota master and its ugid tree.
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/completion.h>
+#include <linux/hash.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/dcache.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/cred.h>
+#include <linux/module.h>
+#include <linux/proc_fs.h>
+#include <linux/quota.h>
+#include <linux/vzquota.h>
+
+static unsigned int calc_threads = 4;
+module_param(calc_threads, uint, 0644);
+MODULE_PARM_DESC(calc_threads, "Number of threads walking the tree on "
+		"usage calculation");
+
+#define VZDQ_CALC_HASH_BITS	10
+#define VZDQ_CALC_HASH_SIZE	(1 << VZDQ_CALC_HASH_BITS)
+
+/* directory waiting to be read */
+struct vzdq_calc_dir {
+	struct list_head	list;
+	struct dentry		*dentry;
+};
+
+/* usage of one uid or gid */
+struct vzdq_calc_ugid {
+	struct hlist_node	hash;
+	unsigned int		id;
+	int			type;
+	qsize_t			bytes;
+	unsigned int		inodes;
+};
+
+/* inode with several links, counted only once */
+struct vzdq_calc_link {
+	struct hlist_node	hash;
+	unsigned long		ino;
+};
+
+struct vzdq_calc {
+	struct vz_quota_master	*qmblk;
+	struct vfsmount		*mnt;
+	const struct cred	*cred;
+
+	spinlock_t		lock;		/* protects the fields below */
+	struct list_head	dirs;		/* directories to read */
+	unsigned int		nr_busy;	/* threads reading a directory */
+	int			err;
+	unsigned long		dirs_done;
+	unsigned long		dirs_queued;
+	qsize_t			bytes;
+	unsigned long		inodes;
+	struct hlist_head	*ugid_hash;	/* merged per-thread results */
+
+	spinlock_t		link_lock;
+	struct hlist_head	*link_hash;
+
+	wait_queue_head_t	wait;
+	atomic_t		nr_workers;
+	unsigned int		nr_threads;
+	struct completion	done;
+	struct list_head	list;		/* in vzdq_calc_list */
+};
+
+struct vzdq_calc_worker {
+	struct vzdq_calc	*calc;
+	void			*page;		/* names from readdir */
+	qsize_t			bytes;
+	unsigned long		inodes;
+	struct hlist_head	*ugid_hash;
+};
+
+/* names are copied out of readdir, not to do lookups under it */
+struct vzdq_calc_name {
+	unsigned short		len;
+	char			name[0];
+};
+
+#define VZDQ_CALC_RECLEN(len)	ALIGN(offsetof(struct vzdq_calc_name, name) \
+					+ (len) + 1, sizeof(long))
+
+struct vzdq_calc_buf {
+	void			*page;
+	unsigned int		used;
+	int			full;
+};
+
+/* calculations in progress, for /proc */
+static LIST_HEAD(vzdq_calc_list);
+static DEFINE_SPINLOCK(vzdq_calc_list_lock);
+
+static struct hlist_head *vzdq_calc_hash_alloc(void)
+{
+	struct hlist_head *hash;
+	int i;
+
+	hash = kmalloc(VZDQ_CALC_HASH_SIZE * sizeof(*hash), GFP_KERNEL);
+	if (hash == NULL)
+		return NULL;
+	for (i = 0; i < VZDQ_CALC_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&hash[i]);
+	return hash;
+}
+
+/* frees the hash of vzdq_calc_ugid or vzdq_calc_link */
+static void vzdq_calc_hash_free(struct hlist_head *hash, size_t offset)
+{
+	struct hlist_node *pos, *n;
+	int i;
+
+	if (hash == NULL)
+		return;
+	for (i = 0; i < VZDQ_CALC_HASH_SIZE; i++)
+		hlist_for_each_safe(pos, n, &hash[i])
+			kfree((void *)pos - offset);
+	kfree(hash);
+}
+
+static inline struct hlist_head *vzdq_calc_ugid_head(struct hlist_head *hash,
+		unsigned int id, int type)
+{
+	return &hash[hash_32(id ^ ((u32)type << 31), VZDQ_CALC_HASH_BITS)];
+}
+
+static struct vzdq_calc_ugid *vzdq_calc_ugid_find(struct hlist_head *head,
+		unsigned int id, int type)
+{
+	struct vzdq_calc_ugid *ugid;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(ugid, pos, head, hash)
+		if (ugid->id == id && ugid->type == type)
+			return ugid;
+	return NULL;
+}
+
+static int vzdq_calc_ugid_add(struct vzdq_calc_worker *w,
+		unsigned int id, int type, qsize_t bytes)
+{
+	struct hlist_head *head;
+	struct vzdq_calc_ugid *ugid;
+
+	head = vzdq_calc_ugid_head(w->ugid_hash, id, type);
+	ugid = vzdq_calc_ugid_find(head, id, type);
+	if (ugid == NULL) {
+		ugid = kzalloc(sizeof(*ugid), GFP_KERNEL);
+		if (ugid == NULL)
+			return -ENOMEM;
+		ugid->id = id;
+		ugid->type = type;
+		hlist_add_head(&ugid->hash, head);
+	}
+	ugid->bytes += bytes;
+	ugid->inodes++;
+	return 0;
+}
+
+/*
+ * Moves the thread's ugid usage into the common hash.
+ * Called under calc->lock.
+ */
+static void vzdq_calc_ugid_merge(struct vzdq_calc *calc,
+		struct hlist_head *hash)
+{
+	struct vzdq_calc_ugid *ugid, *dst;
+	struct hlist_node *pos, *n;
+	struct hlist_head *head;
+	int i;
+
+	for (i = 0; i < VZDQ_CALC_HASH_SIZE; i++) {
+		hlist_for_each_entry_safe(ugid, pos, n, &hash[i], hash) {
+			hlist_del(&ugid->hash);
+			head = vzdq_calc_ugid_head(calc->ugid_hash,
+					ugid->id, ugid->type);
+			dst = vzdq_calc_ugid_find(head, ugid->id, ugid->type);
+			if (dst == NULL) {
+				hlist_add_head(&ugid->hash, head);
+				continue;
+			}
+			dst->bytes += ugid->bytes;
+			dst->inodes += ugid->inodes;
+			kfree(ugid);
+		}
+	}
+}
+
+/*
+ * Returns 1 if an inode with several links has already been counted,
+ * 0 if it is met for the first time.
+ */
+static int vzdq_calc_link_seen(struct vzdq_calc *calc, unsigned long ino)
+{
+	struct vzdq_calc_link *link, *new;
+	struct hlist_head *head;
+	struct hlist_node *pos;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (new == NULL)
+		return -ENOMEM;
+	new->ino = ino;
+
+	head = &calc->link_hash[hash_long(ino, VZDQ_CALC_HASH_BITS)];
+	spin_lock(&calc->link_lock);
+	hlist_for_each_entry(link, pos, head, hash)
+		if (link->ino == ino) {
+			spin_unlock(&calc->link_lock);
+			kfree(new);
+			return 1;
+		}
+	hlist_add_head(&new->hash, head);
+	spin_unlock(&calc->link_lock);
+	return 0;
+}
+
+static int vzdq_calc_inode(struct vzdq_calc_worker *w, struct inode *inode)
+{
+	qsize_t bytes;
+	int err;
+
+	/* the walk does not cross mountpoints, all inodes are from dq_sb */
+	if (!S_ISDIR(inode->i_mode) && inode->i_nlink > 1) {
+		err = vzdq_calc_link_seen(w->calc, inode->i_ino);
+		if (err)
+			return err < 0 ? err : 0;
+	}
+
+	bytes = inode_get_bytes(inode);
+	w->bytes += bytes;
+	w->inodes++;
+	err = vzdq_calc_ugid_add(w, inode->i_uid, USRQUOTA, bytes);
+	if (!err)
+		err = vzdq_calc_ugid_add(w, inode->i_gid, GRPQUOTA, bytes);
+	return err;
+}
+
+/* takes over the reference to @dentry */
+static int vzdq_calc_queue(struct vzdq_calc *calc, struct dentry *dentry)
+{
+	struct vzdq_calc_dir *dir;
+
+	dir = kmalloc(sizeof(*dir), GFP_KERNEL);
+	if (dir == NULL) {
+		dput(dentry);
+		return -ENOMEM;
+	}
+	dir->dentry = dentry;
+
+	spin_lock(&calc->lock);
+	/* LIFO: walk depth first, not to pin a whole tree level */
+	list_add(&dir->list, &calc->dirs);
+	calc->dirs_queued++;
+	spin_unlock(&calc->lock);
+	wake_up(&calc->wait);
+	return 0;
+}
+
+static int vzdq_calc_filldir(void *data, const char *name, int namlen,
+		loff_t offset, u64 ino, unsigned int d_type)
+{
+	struct vzdq_calc_buf *buf = data;
+	struct vzdq_calc_name *n;
+	unsigned int reclen;
+
+	if (name[0] == '.' &&
+	    (namlen == 1 || (namlen == 2 && name[1] == '.')))
+		return 0;
+
+	reclen = VZDQ_CALC_RECLEN(namlen);
+	if (buf->used + reclen > PAGE_SIZE) {
+		/* the entry is returned again on the next vfs_readdir */
+		buf->full = 1;
+		return -EINVAL;
+	}
+
+	n = buf->page + buf->used;
+	n->len = namlen;
+	memcpy(n->name, name, namlen);
+	n->name[namlen] = '\0';
+	buf->used += reclen;
+	return 0;
+}
+
+static int vzdq_calc_names(struct vzdq_calc_worker *w, struct dentry *dir,
+		struct vzdq_calc_buf *buf)
+{
+	struct vzdq_calc_name *n;
+	struct dentry *dentry;
+	unsigned int pos;
+	int err;
+
+	err = 0;
+	mutex_lock(&dir->d_inode->i_mutex);
+	for (pos = 0; pos < buf->used; pos += VZDQ_CALC_RECLEN(n->len)) {
+		n = buf->page + pos;
+
+		dentry = lookup_one_len(n->name, dir, n->len);
+		if (IS_ERR(dentry)) {
+			err = PTR_ERR(dentry);
+			break;
+		}
+		/* removed after readdir */
+		if (dentry->d_inode == NULL) {
+			dput(dentry);
+			continue;
+		}
+
+		err = vzdq_calc_inode(w, dentry->d_inode);
+		if (!err && S_ISDIR(dentry->d_inode->i_mode)) {
+			err = vzdq_calc_queue(w->calc, dentry);
+			dentry = NULL;
+		}
+		dput(dentry);
+		if (err)
+			break;
+	}
+	mutex_unlock(&dir->d_inode->i_mutex);
+	return err;
+}
+
+static int vzdq_calc_dir(struct vzdq_calc_worker *w, struct dentry *dir)
+{
+	struct vzdq_calc *calc = w->calc;
+	struct vzdq_calc_buf buf;
+	struct file *file;
+	int err;
+
+	file = dentry_open(dget(dir), mntget(calc->mnt),
+			O_RDONLY | O_DIRECTORY | O_LARGEFILE, calc->cred);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	buf.page = w->page;
+	do {
+		buf.used = 0;
+		buf.full = 0;
+		err = vfs_readdir(file, vzdq_calc_filldir, &buf);
+		if (err < 0)
+			break;
+		err = vzdq_calc_names(w, dir, &buf);
+	} while (!err && buf.full && buf.used);
+
+	fput(file);
+	return err;
+}
+
+static inline int vzdq_calc_wakeup(struct vzdq_calc *calc)
+{
+	return !list_empty(&calc->dirs) || calc->nr_busy == 0 || calc->err;
+}
+
+/*
+ * Accounts the result of the thread and picks the next directory.
+ * Returns NULL when the whole tree has been read or on error.
+ */
+static struct dentry *vzdq_calc_next(struct vzdq_calc_worker *w,
+		int done, int err)
+{
+	struct vzdq_calc *calc = w->calc;
+	struct vzdq_calc_dir *dir;
+	struct dentry *dentry;
+
+	spin_lock(&calc->lock);
+	if (done) {
+		calc->nr_busy--;
+		calc->dirs_done++;
+	}
+	if (err && !calc->err)
+		calc->err = err;
+	calc->bytes += w->bytes;
+	calc->inodes += w->inodes;
+	w->bytes = 0;
+	w->inodes = 0;
+
+	for (;;) {
+		if (fatal_signal_pending(current) && !calc->err)
+			calc->err = -EINTR;
+		if (calc->err)
+			break;
+		if (!list_empty(&calc->dirs)) {
+			dir = list_first_entry(&calc->dirs,
+					struct vzdq_calc_dir, list);
+			list_del(&dir->list);
+			calc->nr_busy++;
+			spin_unlock(&calc->lock);
+
+			dentry = dir->dentry;
+			kfree(dir);
+			return dentry;
+		}
+		if (calc->nr_busy == 0)
+			break;
+		spin_unlock(&calc->lock);
+		/* only the caller of VZ_DQ_CALC can be killed */
+		wait_event_killable(calc->wait, vzdq_calc_wakeup(calc));
+		spin_lock(&calc->lock);
+	}
+	spin_unlock(&calc->lock);
+	wake_up_all(&calc->wait);
+	return NULL;
+}
+
+static void vzdq_calc_work(struct vzdq_calc_worker *w)
+{
+	struct dentry *dentry;
+	int err;
+
+	for (dentry = vzdq_calc_next(w, 0, 0); dentry != NULL;
+	     dentry = vzdq_calc_next(w, 1, err)) {
+		err = vzdq_calc_dir(w, dentry);
+		dput(dentry);
+		cond_resched();
+	}
+
+	spin_lock(&w->calc->lock);
+	vzdq_calc_ugid_merge(w->calc, w->ugid_hash);
+	spin_unlock(&w->calc->lock);
+}
+
+static struct vzdq_calc_worker *vzdq_calc_worker_alloc(struct vzdq_calc *calc)
+{
+	struct vzdq_calc_worker *w;
+
+	w = kzalloc(sizeof(*w), GFP_KERNEL);
+	if (w == NULL)
+		goto out;
+	w->calc = calc;
+	w->page = (void *)__get_free_page(GFP_KERNEL);
+	if (w->page == NULL)
+		goto out_free;
+	w->ugid_hash = vzdq_calc_hash_alloc();
+	if (w->ugid_hash == NULL)
+		goto out_page;
+	return w;
+
+out_page:
+	free_page((unsigned long)w->page);
+out_free:
+	kfree(w);
+out:
+	return NULL;
+}
+
+static void vzdq_calc_worker_free(struct vzdq_calc_worker *w)
+{
+	vzdq_calc_hash_free(w->ugid_hash,
+			offsetof(struct vzdq_calc_ugid, hash));
+	free_page((unsigned long)w->page);
+	kfree(w);
+}
+
+static int vzdq_calc_thread(void *data)
+{
+	struct vzdq_calc_worker *w = data;
+	struct vzdq_calc *calc = w->calc;
+
+	vzdq_calc_work(w);
+	vzdq_calc_worker_free(w);
+	/* Don't return to the module code, it may be gone by then */
+	complete_and_exit(atomic_dec_and_test(&calc->nr_workers) ?
+			&calc->done : NULL, 0);
+}
+
+static int vzdq_calc_walk(struct vzdq_calc *calc, struct dentry *root)
+{
+	struct vzdq_calc_worker *w, *tw;
+	struct vzdq_calc_dir *dir, *tmp;
+	struct task_struct *tsk;
+	unsigned int i, nr;
+	int err;
+
+	w = vzdq_calc_worker_alloc(calc);
+	if (w == NULL)
+		return -ENOMEM;
+
+	err = vzdq_calc_inode(w, root->d_inode);
+	if (!err)
+		err = vzdq_calc_queue(calc, dget(root));
+	if (err) {
+		vzdq_calc_worker_free(w);
+		return err;
+	}
+
+	/* the caller is a worker too */
+	atomic_set(&calc->nr_workers, 1);
+	nr = clamp(calc_threads, 1U, num_online_cpus());
+	for (i = 1; i < nr; i++) {
+		tw = vzdq_calc_worker_alloc(calc);
+		if (tw == NULL)
+			break;
+		atomic_inc(&calc->nr_workers);
+		tsk = kthread_run(vzdq_calc_thread, tw, "vzdq_calc/%u",
+				calc->qmblk->dq_id);
+		if (IS_ERR(tsk)) {
+			atomic_dec(&calc->nr_workers);
+			vzdq_calc_worker_free(tw);
+			break;
+		}
+	}
+	calc->nr_threads = i;
+
+	spin_lock(&vzdq_calc_list_lock);
+	list_add_tail(&calc->list, &vzdq_calc_list);
+	spin_unlock(&vzdq_calc_list_lock);
+
+	vzdq_calc_work(w);
+	vzdq_calc_worker_free(w);
+	if (!atomic_dec_and_test(&calc->nr_workers))
+		wait_for_completion(&calc->done);
+
+	spin_lock(&vzdq_calc_list_lock);
+	list_del(&calc->list);
+	spin_unlock(&vzdq_calc_list_lock);
+
+	/* directories left after an error */
+	list_for_each_entry_safe(dir, tmp, &calc->dirs, list) {
+		dput(dir->dentry);
+		kfree(dir);
+	}
+	return calc->err;
+}
+
+#ifdef CONFIG_VZ_QUOTA_UGID
+/*
+ * Replaces the usage in the ugid tree with the calculated one.
+ * Called under vz_quota_mutex in VZDQ_STARTING state.
+ */
+static void vzdq_calc_apply_ugid(struct vzdq_calc *calc)
+{
+	struct vz_quota_master *qmblk = calc->qmblk;
+	struct vz_quota_ugid *qugid;
+	struct vzdq_calc_ugid *ugid;
+	struct quotatree_tree *tree;
+	struct hlist_node *pos;
+	int type, i;
+
+	mutex_lock(&qmblk->dq_mutex);
+	for (type = 0; type < MAXQUOTAS; type++) {
+		tree = QUGID_TREE(qmblk, type);
+		for (qugid = quotatree_leaf_byindex(tree, 0); qugid != NULL;
+		     qugid = quotatree_get_next(tree, qugid->qugid_id)) {
+			qugid->qugid_stat.bcurrent = 0;
+			qugid->qugid_stat.icurrent = 0;
+		}
+	}
+
+	for (i = 0; i < VZDQ_CALC_HASH_SIZE; i++) {
+		hlist_for_each_entry(ugid, pos, &calc->ugid_hash[i], hash) {
+			qugid = __vzquota_find_ugid(qmblk, ugid->id,
+					ugid->type, 0);
+			if (qugid == VZ_QUOTA_UGBAD) {
+				/* usage of some ugids stays unknown */
+				qmblk->dq_flags |= VZDQUG_FIXED_SET;
+				continue;
+			}
+			qugid->qugid_stat.bcurrent = ugid->bytes;
+			qugid->qugid_stat.icurrent = ugid->inodes;
+			vzquota_put_ugid(qmblk, qugid);
+		}
+	}
+	mutex_unlock(&qmblk->dq_mutex);
+}
+#endif
+
+/* Called under vz_quota_mutex in VZDQ_STARTING state. */
+static void vzdq_calc_apply(struct vzdq_calc *calc)
+{
+	struct vz_quota_master *qmblk = calc->qmblk;
+
+	qmblk_data_write_lock(qmblk);
+	qmblk->dq_stat.bcurrent = calc->bytes;
+	qmblk->dq_stat.icurrent = calc->inodes;
+	qmblk_data_write_unlock(qmblk);
+
+#ifdef CONFIG_VZ_QUOTA_UGID
+	if (qmblk->dq_flags & VZDQUG_ON)
+		vzdq_calc_apply_ugid(calc);
+#endif
+}
+
+/**
+ * vzquota_calc - calculate quota usage of a tree
+ *
+ * Walks the tree under @quota_root with calc_threads threads and stores
+ * the space, inodes and per-ugid usage into the quota master, which must
+ * not be turned on yet. The master is marked with VZDQ_CALC meanwhile,
+ * and vz_quota_mutex is not held during the walk.
+ */
+int vzquota_calc(unsigned int quota_id, const char __user *quota_root)
+{
+	struct vz_quota_master *qmblk;
+	struct vzdq_calc *calc;
+	struct path path;
+	int err;
+
+	err = user_path(quota_root, &path);
+	if (err)
+		goto out;
+	err = -ENOTDIR;
+	if (!S_ISDIR(path.dentry->d_inode->i_mode))
+		goto out_path;
+
+	err = -ENOMEM;
+	calc = kzalloc(sizeof(*calc), GFP_KERNEL);
+	if (calc == NULL)
+		goto out_path;
+	spin_lock_init(&calc->lock);
+	spin_lock_init(&calc->link_lock);
+	INIT_LIST_HEAD(&calc->dirs);
+	init_waitqueue_head(&calc->wait);
+	init_completion(&calc->done);
+	calc->mnt = path.mnt;
+	calc->cred = get_current_cred();
+	calc->ugid_hash = vzdq_calc_hash_alloc();
+	calc->link_hash = vzdq_calc_hash_alloc();
+	if (calc->ugid_hash == NULL || calc->link_hash == NULL)
+		goto out_free;
+
+	mutex_lock(&vz_quota_mutex);
+	err = -ENOENT;
+	qmblk = vzquota_find_master(quota_id);
+	if (qmblk == NULL)
+		goto out_unlock;
+	err = -EBUSY;
+	if (qmblk->dq_state != VZDQ_STARTING ||
+	    (qmblk->dq_flags & VZDQ_CALC))
+		goto out_unlock;
+	qmblk->dq_flags |= VZDQ_CALC;
+	calc->qmblk = qmblk_get(qmblk);
+	mutex_unlock(&vz_quota_mutex);
+
+	err = vzdq_calc_walk(calc, path.dentry);
+
+	mutex_lock(&vz_quota_mutex);
+	if (!err)
+		vzdq_calc_apply(calc);
+	qmblk->dq_flags &= ~VZDQ_CALC;
+	mutex_unlock(&vz_quota_mutex);
+	qmblk_put(qmblk);
+	goto out_free;
+
+out_unlock:
+	mutex_unlock(&vz_quota_mutex);
+out_free:
+	vzdq_calc_hash_free(calc->link_hash,
+			offsetof(struct vzdq_calc_link, hash));
+	vzdq_calc_hash_free(calc->ugid_hash,
+			offsetof(struct vzdq_calc_ugid, hash));
+	put_cred(calc->cred);
+	kfree(calc);
+out_path:
+	path_put(&path);
+out:
+	return err;
+}
+
+#if defined(CONFIG_PROC_FS)
+
+/*
+ * /proc/vz/vzquota_calc: progress of running calculations
+ */
+int vzquota_calc_read_proc(char *page, char **start, off_t off, int count,
+		int *eof, void *data)
+{
+	struct vzdq_calc *calc;
+	int len;
+
+	len = sprintf(page, "%10s %7s %12s %12s %12s %15s\n", "qid", "threads",
+			"dirs_done", "dirs_queued", "inodes", "1k-blocks");
+
+	spin_lock(&vzdq_calc_list_lock);
+	list_for_each_entry(calc, &vzdq_calc_list, list) {
+		if (len > PAGE_SIZE - 128)
+			break;
+		spin_lock(&calc->lock);
+		len += sprintf(page + len, "%10u %7u %12lu %12lu %12lu %15Lu\n",
+				calc->qmblk->dq_id, calc->nr_threads,
+				calc->dirs_done, calc->dirs_queued,
+				calc->inodes,
+				(unsigned long long)calc->bytes >> 10);
+		spin_unlock(&calc->lock);
+	}
+	spin_unlock(&vzdq_calc_list_lock);
+
+	if (off >= len) {
+		*eof = 1;
+		return 0;
+	}
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	else
+		*eof = 1;
+	return len;
+}
+
+#endif
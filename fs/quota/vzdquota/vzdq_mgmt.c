@@ -143,7 +143,8 @@ static int vzquota_on(unsigned int quota_id, const char __user *quota_root,
 		goto out;
 
 	err = -EBUSY;
-	if (qmblk->dq_state != VZDQ_STARTING)
+	if (qmblk->dq_state != VZDQ_STARTING ||
+	    (qmblk->dq_flags & VZDQ_CALC))
 		goto out;
 
 	err = user_path(quota_root, &path);
@@ -218,8 +219,10 @@ static int vzquota_destroy(unsigned int quota_id)
 	err = -EBUSY;
 	if (qmblk->dq_state == VZDQ_WORKING)
 		goto out; /* quota_off first */
+	if (qmblk->dq_flags & VZDQ_CALC)
+		goto out;
 
-	list_del_init(&qmblk->dq_hash);
+	list_del_rcu(&qmblk->dq_hash);
 	root = qmblk->dq_root_path;
 	qmblk->dq_root_path.dentry = NULL;
 	qmblk->dq_root_path.mnt = NULL;
@@ -444,6 +447,7 @@ out:
 /*
  * get quota limits.
  * very simple - just return stat buffer to user
+ * Does not take vz_quota_mutex, not to wait for quota on/off of other VEs.
  */
 static int vzquota_getstat(unsigned int quota_id,
 		struct vz_quota_stat __user *u_qstat, int compat)
@@ -452,18 +456,20 @@ static int vzquota_getstat(unsigned int quota_id,
 	struct vz_quota_stat qstat;
 	struct vz_quota_master *qmblk;
 
-	mutex_lock(&vz_quota_mutex);
-
-	err = -ENOENT;
+	rcu_read_lock();
 	qmblk = vzquota_find_master(quota_id);
-	if (qmblk == NULL)
-		goto out;
+	if (qmblk == NULL) {
+		rcu_read_unlock();
+		return -ENOENT;
+	}
 
 	qmblk_data_read_lock(qmblk);
 	/* copy whole buffer under lock */
+	vzquota_fold_usage(qmblk);
 	memcpy(&qstat.dq_stat, &qmblk->dq_stat, sizeof(qstat.dq_stat));
 	memcpy(&qstat.dq_info, &qmblk->dq_info, sizeof(qstat.dq_info));
 	qmblk_data_read_unlock(qmblk);
+	rcu_read_unlock();
 
 	if (!compat)
 		err = copy_to_user(u_qstat, &qstat, sizeof(qstat));
@@ -478,8 +484,6 @@ static int vzquota_getstat(unsigned int quota_id,
 	if (err)
 		err = -EFAULT;
 
-out:
-	mutex_unlock(&vz_quota_mutex);
 	return err;
 }
 
@@ -529,6 +533,9 @@ long do_vzquotactl(int cmd, unsigned int quota_id,
 		case VZ_DQ_GETSTAT:
 			ret = vzquota_getstat(quota_id, qstat, compat);
 			break;
+		case VZ_DQ_CALC:
+			ret = vzquota_calc(quota_id, ve_root);
+			break;
 
 		default:
 			ret = -EINVAL;
@@ -695,6 +702,9 @@ static int vzquota_read_proc(char *page, char **start, off_t off, int count,
 			/* we print quotaid and path only in VE0 */
 			if (capable(CAP_SYS_ADMIN))
 				len += print_proc_master_id(p+len,path_buf, qp);
+			qmblk_data_read_lock(qp);
+			vzquota_fold_usage(qp);
+			qmblk_data_read_unlock(qp);
 			len += print_proc_stat(p+len, &qp->dq_stat,
 					&qp->dq_info);
 			printed += len;
@@ -742,12 +752,22 @@ int vzquota_proc_init(void)
 
 	de->read_proc = vzquota_read_proc;
 	de->data = NULL;
+
+	de = proc_create("vzquota_calc", S_IFREG|S_IRUSR, proc_vz_dir, NULL);
+	if (de == NULL) {
+		remove_proc_entry("vzquota", proc_vz_dir);
+		return -EBUSY;
+	}
+
+	de->read_proc = vzquota_calc_read_proc;
+	de->data = NULL;
 	return 0;
 }
 
 void vzquota_proc_release(void)
 {
 	/* Unregister procfs read callback */
+	remove_proc_entry("vzquota_calc", proc_vz_dir);
 	remove_proc_entry("vzquota", proc_vz_dir);
 }
 
@@ -10,6 +10,8 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/quota.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
 #include <linux/vzquota.h>
 
 
@@ -51,6 +53,130 @@ static inline void vzquota_decr_space(struct dq_stat *dqstat,
 		dqstat->btime = (time_t) 0;
 }
 
+/* ----------------------------------------------------------------------
+ * Per-cpu usage.
+ *
+ * Charges of inodes without ugid quotas are accumulated in per-cpu deltas
+ * of the qmblk without inode_qmblk and qmblk_data locks, as long as the
+ * usage stays away from the limits. A cpu folds its delta into dq_stat
+ * when the delta exceeds the batch; the locked path and the readers of
+ * dq_stat fold the deltas of all cpus. So at most 2 * batch per cpu is
+ * not accounted in dq_stat, and a lockless charge is done only if the
+ * usage with this slack stays within the soft limit: the limits are
+ * checked as precisely as before.
+ * --------------------------------------------------------------------- */
+
+#define VZDQ_SPACE_BATCH	(1L << 20)	/* bytes */
+#define VZDQ_INODES_BATCH	32
+
+static void vzquota_add_usage(struct dq_stat *dqstat, s64 space, int inodes)
+{
+	if (space > 0)
+		vzquota_incr_space(dqstat, space);
+	else if (space < 0)
+		vzquota_decr_space(dqstat, -space);
+	if (inodes > 0)
+		vzquota_incr_inodes(dqstat, inodes);
+	else if (inodes < 0)
+		vzquota_decr_inodes(dqstat, -inodes);
+}
+
+/**
+ * vzquota_fold_usage - move per-cpu usage of all cpus to dq_stat
+ *
+ * Called under qmblk_data lock.
+ */
+void vzquota_fold_usage(struct vz_quota_master *qmblk)
+{
+	struct vz_quota_pcpu *pcpu;
+	s64 space = 0;
+	int inodes = 0;
+	int cpu;
+
+	if (qmblk->dq_pcpu == NULL)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(qmblk->dq_pcpu, cpu);
+		/* do not dirty idle cpus' lines */
+		if (atomic_long_read(&pcpu->bdelta))
+			space += atomic_long_xchg(&pcpu->bdelta, 0);
+		if (atomic_read(&pcpu->idelta))
+			inodes += atomic_xchg(&pcpu->idelta, 0);
+	}
+	vzquota_add_usage(&qmblk->dq_stat, space, inodes);
+}
+
+/*
+ * Can the usage be changed without checking limits and grace times,
+ * assuming the worst case of the unfolded per-cpu usage?
+ */
+static int vzquota_pcpu_room(struct dq_stat *dqstat, s64 space, s64 inodes)
+{
+	u64 bslack, islack;
+
+	bslack = (u64)num_possible_cpus() * 2 * VZDQ_SPACE_BATCH;
+	islack = (u64)num_possible_cpus() * 2 * VZDQ_INODES_BATCH;
+
+	if (space > 0 &&
+	    (dqstat->bcurrent + space + bslack > dqstat->bsoftlimit ||
+	     dqstat->bcurrent + space + bslack > dqstat->bhardlimit))
+		return 0;
+	if (space < 0 &&
+	    (dqstat->btime || dqstat->bcurrent < bslack - space))
+		return 0;
+
+	if (inodes > 0 &&
+	    ((u64)dqstat->icurrent + inodes + islack > dqstat->isoftlimit ||
+	     (u64)dqstat->icurrent + inodes + islack > dqstat->ihardlimit))
+		return 0;
+	if (inodes < 0 &&
+	    (dqstat->itime || (u64)dqstat->icurrent < islack - inodes))
+		return 0;
+
+	return 1;
+}
+
+/**
+ * vzquota_pcpu_charge - try to charge (or uncharge) the usage locklessly
+ *
+ * Returns 1 if the usage is accounted, 0 if the locked path is required.
+ */
+static int vzquota_pcpu_charge(struct inode *inode, s64 space, s64 inodes)
+{
+	struct vz_quota_master *qmblk;
+	struct vz_quota_pcpu *pcpu;
+	long bdelta;
+	int idelta;
+	int ret = 0;
+
+	if (space > VZDQ_SPACE_BATCH || space < -VZDQ_SPACE_BATCH ||
+	    inodes > VZDQ_INODES_BATCH || inodes < -VZDQ_INODES_BATCH)
+		return 0;
+
+	rcu_read_lock();
+	qmblk = vzquota_inode_qmblk_rcu(inode);
+	if (qmblk == NULL || !vzquota_pcpu_room(&qmblk->dq_stat, space, inodes))
+		goto out;
+
+	pcpu = per_cpu_ptr(qmblk->dq_pcpu, get_cpu());
+	bdelta = atomic_long_add_return(space, &pcpu->bdelta);
+	idelta = atomic_add_return(inodes, &pcpu->idelta);
+	if (bdelta > VZDQ_SPACE_BATCH || bdelta < -VZDQ_SPACE_BATCH ||
+	    idelta > VZDQ_INODES_BATCH || idelta < -VZDQ_INODES_BATCH) {
+		qmblk_data_write_lock(qmblk);
+		vzquota_add_usage(&qmblk->dq_stat,
+				atomic_long_xchg(&pcpu->bdelta, 0),
+				atomic_xchg(&pcpu->idelta, 0));
+		qmblk_data_write_unlock(qmblk);
+	}
+	put_cpu();
+	ret = 1;
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
 /*
  * better printk() message or use /proc/vzquotamsg interface
  * similar to /proc/kmsg
@@ -316,6 +442,9 @@ static int vzquota_alloc_space(struct inode *inode,
 	struct vz_quota_datast data;
 	int ret = QUOTA_OK;
 
+	if (vzquota_pcpu_charge(inode, number, 0))
+		goto out;
+
 	qmblk = vzquota_inode_data(inode, &data);
 	if (qmblk == VZ_QUOTA_BAD)
 		return NO_QUOTA;
@@ -326,6 +455,7 @@ static int vzquota_alloc_space(struct inode *inode,
 #endif
 
 		/* checking first */
+		vzquota_fold_usage(qmblk);
 		ret = vzquota_check_space(&qmblk->dq_info, &qmblk->dq_stat,
 				number, qmblk->dq_id, prealloc);
 		if (ret == NO_QUOTA)
@@ -349,6 +479,7 @@ static int vzquota_alloc_space(struct inode *inode,
 		vzquota_data_unlock(inode, &data);
 	}
 
+out:
 	inode_add_bytes(inode, number);
 	might_sleep();
 	return QUOTA_OK;
@@ -371,6 +502,9 @@ static int vzquota_alloc_inode(const struct inode *inode, qsize_t number)
 	struct vz_quota_datast data;
 	int ret = QUOTA_OK;
 
+	if (vzquota_pcpu_charge((struct inode *)inode, 0, number))
+		goto out;
+
 	qmblk = vzquota_inode_data((struct inode *)inode, &data);
 	if (qmblk == VZ_QUOTA_BAD)
 		return NO_QUOTA;
@@ -381,6 +515,7 @@ static int vzquota_alloc_inode(const struct inode *inode, qsize_t number)
 #endif
 
 		/* checking first */
+		vzquota_fold_usage(qmblk);
 		ret = vzquota_check_inodes(&qmblk->dq_info, &qmblk->dq_stat,
 				number, qmblk->dq_id);
 		if (ret == NO_QUOTA)
@@ -404,6 +539,7 @@ static int vzquota_alloc_inode(const struct inode *inode, qsize_t number)
 		vzquota_data_unlock((struct inode *)inode, &data);
 	}
 
+out:
 	might_sleep();
 	return QUOTA_OK;
 
@@ -420,6 +556,9 @@ static int vzquota_free_space(struct inode *inode, qsize_t number)
 	struct vz_quota_master *qmblk;
 	struct vz_quota_datast data;
 
+	if (vzquota_pcpu_charge(inode, -(s64)number, 0))
+		goto out;
+
 	qmblk = vzquota_inode_data(inode, &data);
 	if (qmblk == VZ_QUOTA_BAD)
 		return NO_QUOTA; /* isn't checked by the caller */
@@ -429,6 +568,7 @@ static int vzquota_free_space(struct inode *inode, qsize_t number)
 		struct vz_quota_ugid * qugid;
 #endif
 
+		vzquota_fold_usage(qmblk);
 		vzquota_decr_space(&qmblk->dq_stat, number);
 #ifdef CONFIG_VZ_QUOTA_UGID
 		for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
@@ -440,6 +580,7 @@ static int vzquota_free_space(struct inode *inode, qsize_t number)
 #endif
 		vzquota_data_unlock(inode, &data);
 	}
+out:
 	inode_sub_bytes(inode, number);
 	might_sleep();
 	return QUOTA_OK;
@@ -453,6 +594,9 @@ static int vzquota_free_inode(const struct inode *inode, qsize_t number)
 	struct vz_quota_master *qmblk;
 	struct vz_quota_datast data;
 
+	if (vzquota_pcpu_charge((struct inode *)inode, 0, -(s64)number))
+		goto out;
+
 	qmblk = vzquota_inode_data((struct inode *)inode, &data);
 	if (qmblk == VZ_QUOTA_BAD)
 		return NO_QUOTA;
@@ -462,6 +606,7 @@ static int vzquota_free_inode(const struct inode *inode, qsize_t number)
 		struct vz_quota_ugid * qugid;
 #endif
 
+		vzquota_fold_usage(qmblk);
 		vzquota_decr_inodes(&qmblk->dq_stat, number);
 #ifdef CONFIG_VZ_QUOTA_UGID
 		for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
@@ -473,6 +618,7 @@ static int vzquota_free_inode(const struct inode *inode, qsize_t number)
 #endif
 		vzquota_data_unlock((struct inode *)inode, &data);
 	}
+out:
 	might_sleep();
 	return QUOTA_OK;
 }
@@ -517,6 +663,7 @@ void vzquota_inode_off(struct inode * inode)
 
 		inode->i_flags |= S_NOQUOTA;
 
+		vzquota_fold_usage(qmblk);
 		vzquota_decr_space(&qmblk->dq_stat, bytes);
 		vzquota_decr_inodes(&qmblk->dq_stat, 1);
 #ifdef CONFIG_VZ_QUOTA_UGID
@@ -985,7 +985,8 @@ static int quota_ugid_setconfig(unsigned int quota_id,
 	err = 0;
 	qmblk->dq_ugid_max = kinfo.limit;
 	if (qmblk->dq_state == VZDQ_STARTING) {
-		qmblk->dq_flags = kinfo.flags;
+		qmblk->dq_flags = kinfo.flags |
+				(qmblk->dq_flags & VZDQ_CALC);
 		if (qmblk->dq_flags & VZDQUG_ON)
 			qmblk->dq_flags |= VZDQ_USRQUOTA | VZDQ_GRPQUOTA;
 	}		
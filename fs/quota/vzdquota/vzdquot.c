@@ -16,6 +16,7 @@
 #include <asm/atomic.h>
 #include <linux/spinlock.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
 #include <linux/fs_struct.h>
 #include <linux/fs.h>
 #include <linux/dcache.h>
@@ -106,7 +107,8 @@ struct quota_format_type vz_quota_empty_v2_format = {
  *
  * Master hash table handling.
  *
- * SMP not safe, serialied by vz_quota_mutex within quota syscalls
+ * Updates are serialized by vz_quota_mutex within quota syscalls,
+ * lookups may be done under rcu_read_lock() as well.
  *
  * --------------------------------------------------------------------- */
 
@@ -149,10 +151,13 @@ struct vz_quota_master *vzquota_alloc_master(unsigned int quota_id,
 	qmblk = kmem_cache_alloc(vzquota_cachep, GFP_KERNEL);
 	if (qmblk == NULL)
 		goto out;
+	qmblk->dq_pcpu = alloc_percpu(struct vz_quota_pcpu);
+	if (qmblk->dq_pcpu == NULL)
+		goto out_free;
 #ifdef CONFIG_VZ_QUOTA_UGID
 	qmblk->dq_uid_tree = quotatree_alloc();
 	if (!qmblk->dq_uid_tree)
-		goto out_free;
+		goto out_free_pcpu;
 
 	qmblk->dq_gid_tree = quotatree_alloc();
 	if (!qmblk->dq_gid_tree)
@@ -178,7 +183,7 @@ struct vz_quota_master *vzquota_alloc_master(unsigned int quota_id,
 	atomic_set(&qmblk->dq_count, 1);
 
 	/* insert in hash chain */
-	list_add(&qmblk->dq_hash,
+	list_add_rcu(&qmblk->dq_hash,
 		&vzquota_hash_table[vzquota_hash_func(quota_id)]);
 
 	/* success */
@@ -187,9 +192,11 @@ struct vz_quota_master *vzquota_alloc_master(unsigned int quota_id,
 #ifdef CONFIG_VZ_QUOTA_UGID
 out_free_tree:
 	quotatree_free(qmblk->dq_uid_tree, NULL);
+out_free_pcpu:
+	free_percpu(qmblk->dq_pcpu);
+#endif
 out_free:
 	kmem_cache_free(vzquota_cachep, qmblk);
-#endif
 out:
 	return ERR_PTR(err);
 }
@@ -214,7 +221,9 @@ static struct vz_quota_master *vzquota_alloc_fake(void)
  * vzquota_find_master - find master record with given id
  *
  * Returns qmblk without touching its refcounter.
- * Called under vz_quota_mutex.
+ * Called under vz_quota_mutex or rcu_read_lock(), in the latter case
+ * the qmblk may be already destroyed, but is not freed until
+ * rcu_read_unlock().
  */
 struct vz_quota_master *vzquota_find_master(unsigned int quota_id)
 {
@@ -222,18 +231,29 @@ struct vz_quota_master *vzquota_find_master(unsigned int quota_id)
 	struct vz_quota_master *qp;
 
 	i = vzquota_hash_func(quota_id);
-	list_for_each_entry(qp, &vzquota_hash_table[i], dq_hash) {
+	list_for_each_entry_rcu(qp, &vzquota_hash_table[i], dq_hash) {
 		if (qp->dq_id == quota_id)
 			return qp;
 	}
 	return NULL;
 }
 
+static void vzquota_free_master_rcu(struct rcu_head *head)
+{
+	struct vz_quota_master *qmblk;
+
+	qmblk = container_of(head, struct vz_quota_master, dq_rcu);
+	free_percpu(qmblk->dq_pcpu);
+	kmem_cache_free(vzquota_cachep, qmblk);
+}
+
 /**
  * vzquota_free_master - release resources taken by qmblk, freeing memory
  *
  * qmblk is assumed to be already taken out from the hash.
  * Should be called outside vz_quota_mutex.
+ * The memory is freed after a grace period, for lockless hash lookups
+ * and per-cpu charges (see vzquota_inode_qmblk_rcu).
  */
 void vzquota_free_master(struct vz_quota_master *qmblk)
 {
@@ -241,7 +261,7 @@ void vzquota_free_master(struct vz_quota_master *qmblk)
 	vzquota_kill_ugid(qmblk);
 #endif
 	BUG_ON(!list_empty(&qmblk->dq_ilink_list));
-	kmem_cache_free(vzquota_cachep, qmblk);
+	call_rcu(&qmblk->dq_rcu, vzquota_free_master_rcu);
 }
 
 
@@ -1366,6 +1386,40 @@ void vzquota_data_unlock(struct inode *inode,
 	vzquota_qlnk_destroy(&data->qlnk);
 }
 
+/**
+ * vzquota_inode_qmblk_rcu - get inode's qmblk for a lockless charge
+ *
+ * Returns qmblk if the inode's qlnk is actual and the inode is not
+ * charged to ugid quotas, so that only the per-cpu usage of the qmblk
+ * is to be updated. Otherwise returns NULL and the caller should take
+ * the locked path through vzquota_inode_data.
+ *
+ * Called under rcu_read_lock(). The qlnk may be changed concurrently,
+ * but the qmblk is not freed until rcu_read_unlock(); vzquota_off_qmblk
+ * waits for such charges to complete.
+ */
+struct vz_quota_master *vzquota_inode_qmblk_rcu(struct inode *inode)
+{
+	struct vz_quota_ilink *qlnk;
+	struct vz_quota_master *qmblk;
+
+	if (inode->i_dquot[USRQUOTA] == NULL ||
+	    (inode->i_flags & S_NOQUOTA))
+		return NULL;
+
+	qlnk = INODE_QLNK(inode);
+	qmblk = rcu_dereference(qlnk->qmblk);
+	if (qmblk == NULL || qmblk == __VZ_QUOTA_EMPTY ||
+	    qmblk == VZ_QUOTA_BAD || qmblk->dq_pcpu == NULL ||
+	    (qmblk->dq_flags & (VZDQ_NOACT | VZDQ_NOQUOT)))
+		return NULL;
+#ifdef CONFIG_VZ_QUOTA_UGID
+	if (qlnk->qugid[USRQUOTA] != NULL || qlnk->qugid[GRPQUOTA] != NULL)
+		return NULL;
+#endif
+	return qmblk;
+}
+
 #if defined(CONFIG_VZ_QUOTA_UGID)
 /**
  * vzquota_inode_transfer_call - call from vzquota_transfer
@@ -1730,6 +1784,10 @@ int vzquota_off_qmblk(struct super_block *sb, struct vz_quota_master *qmblk,
 		qmblk->dq_flags |= VZDQ_NOACT | VZDQ_NOQUOT;
 	inode_qmblk_unlock(sb);
 
+	/* usage must not change after off, wait for lockless charges */
+	if (!ret)
+		synchronize_rcu();
+
 	if (buf) {
 		if (copy_to_user(ubuf, buf, PAGE_SIZE))
 			;
@@ -1840,6 +1898,7 @@ static int vzquota_dstat(struct super_block *super, struct dq_stat *qstat)
 	}
 
 	qmblk_data_read_lock(qmblk);
+	vzquota_fold_usage(qmblk);
 	memcpy(qstat, &qmblk->dq_stat, sizeof(*qstat));
 	qmblk_data_read_unlock(qmblk);
 	qmblk_put(qmblk);
@@ -1883,6 +1942,7 @@ static void vzquota_cache_release(void)
 			BUG();
 
 	/* release caches */
+	rcu_barrier();
 	kmem_cache_destroy(vzquota_cachep);
 	vzquota_cachep = NULL;
 }
@@ -162,10 +162,15 @@ struct sock_private {
 struct ub_percpu_struct {
 	unsigned long unmap;
 	unsigned long swapin;
+	unsigned long reclaimed;
+	unsigned long zswap;
 #ifdef CONFIG_BC_IO_ACCOUNTING
 	unsigned long long bytes_wrote;
 	unsigned long long bytes_read;
 	unsigned long long bytes_cancelled;
+	unsigned long long bytes_dirtied;
+	unsigned long long bytes_dirty_missed;
+	unsigned long io_pb_held;
 #endif
 #ifdef CONFIG_BC_DEBUG_KMEM
 	long	pages_charged;
@@ -187,6 +192,9 @@ struct ub_percpu_struct {
 	unsigned long		read;
 	unsigned long long	wchar;
 	unsigned long long	rchar;
+
+	/* resources charged in advance, see charge_beancounter() */
+	atomic_long_t		precharge[UB_RESOURCES];
 };
 
 struct user_beancounter
@@ -207,6 +215,15 @@ struct user_beancounter
 
 	struct ub_rate_info	ub_limit_rl;
 	int			ub_oom_noproc;
+	/* container OOM state, protected with ub_lock */
+	int			ub_oom_running;
+	int			ub_oom_kill_counter;
+	int			ub_oom_generation;
+	/* pushes physpages back under the limit, see kernel/bc/vm_pages.c */
+	struct delayed_work	ub_reclaim_work;
+	unsigned long		ub_reclaim_delay;
+	/* KSM scan order of the container, < 0 - not scanned, see mm/ksm.c */
+	int			ub_ksm_priority;
 
 	struct page_private	ppriv;
 #define ub_unused_privvmpages	ppriv.ubp_unused_privvmpages
@@ -227,6 +244,11 @@ struct user_beancounter
 	int			ub_childs;
 	void			*private_data;
 	unsigned long		ub_aflags;
+	unsigned long		ub_precharge_mask;
+	/* resources with eventfd notifications, see kernel/bc/statd.c */
+	unsigned long		ub_event_mask;
+	struct list_head	ub_events;
+	int			ub_nr_events;
 
 #ifdef CONFIG_PROC_FS
 	struct proc_dir_entry	*proc;
@@ -238,12 +260,14 @@ struct user_beancounter
 	struct ubparm		ub_store[UB_RESOURCES];
 
 	struct ub_percpu_struct	*ub_percpu;
-#ifdef CONFIG_BC_IO_ACCOUNTING
-	/* these are protected with pb_lock */
-	unsigned long long	bytes_wrote;
-	unsigned long long	bytes_dirtied;
-	unsigned long long	bytes_dirty_missed;
-	unsigned long		io_pb_held;
+	/* sum of io_pb_held cached by ub_dirty_pages() */
+	unsigned long		ub_dirty_pages;
+	unsigned long		ub_dirty_stamp;
+	/* % of the global dirty limit the ub may hold, 0 - unlimited */
+	int			ub_dirty_ratio;
+#ifdef CONFIG_BC_IO_SCHED
+	/* container cgroup cached for the IO scheduler, see __ub_cgroup() */
+	struct cgroup		*ub_cgroup;
 #endif
 #ifdef CONFIG_BC_DEBUG_KMEM
 	struct list_head	ub_cclist;
@@ -411,18 +435,48 @@ extern int print_ub_uid(struct user_beancounter *ub, char *buf, int size);
  * Change user's account and compare against limits
  */
 
+void __ub_check_events(struct user_beancounter *ub, int resource, int failed);
+
+/* called under ub_lock */
+static inline void ub_check_events(struct user_beancounter *ub, int resource,
+		int failed)
+{
+	if (unlikely(test_bit(resource, &ub->ub_event_mask)))
+		__ub_check_events(ub, resource, failed);
+}
+
+static inline void ub_inc_failcnt(struct user_beancounter *ub, int resource)
+{
+	ub->ub_parms[resource].failcnt++;
+	ub_check_events(ub, resource, 1);
+}
+
 static inline void ub_adjust_maxheld(struct user_beancounter *ub, int resource)
 {
 	if (ub->ub_parms[resource].maxheld < ub->ub_parms[resource].held)
 		ub->ub_parms[resource].maxheld = ub->ub_parms[resource].held;
 	if (ub->ub_parms[resource].minheld > ub->ub_parms[resource].held)
 		ub->ub_parms[resource].minheld = ub->ub_parms[resource].held;
+	ub_check_events(ub, resource, 0);
 }
 
 int charge_beancounter(struct user_beancounter *ub, int resource,
 		unsigned long val, enum ub_severity strict);
 void uncharge_beancounter(struct user_beancounter *ub, int resource,
 		unsigned long val);
+void ub_precharge_drain(struct user_beancounter *ub, int resource);
+unsigned long ub_precharged(struct user_beancounter *ub, int resource);
+
+/* held without precharged amounts, for reporting */
+static inline unsigned long ub_held(struct user_beancounter *ub, int resource)
+{
+	unsigned long held, precharged;
+
+	held = ub->ub_parms[resource].held;
+	precharged = ub_precharged(ub, resource);
+	return precharged < held ? held - precharged : 0;
+}
+
 void __charge_beancounter_notop(struct user_beancounter *ub, int resource,
 		unsigned long val);
 void __uncharge_beancounter_notop(struct user_beancounter *ub, int resource,
@@ -37,6 +37,12 @@ static inline struct user_beancounter *get_io_ub(void)
 {
 	struct user_beancounter *ub;
 
+#ifdef CONFIG_BC_IO_SCHED
+	/* writeback of a page dirtied by ub, see ub_io_writeback_begin() */
+	ub = current->task_bc.io_ub;
+	if (ub != NULL)
+		return ub;
+#endif
 	ub = get_exec_ub();
 	if (unlikely(ub == NULL))
 		ub = get_task_ub(current);
@@ -77,6 +83,14 @@ static inline void ub_io_account_write_cancelled(size_t bytes)
 	ub_percpu_add(get_io_ub(), bytes_cancelled, bytes);
 }
 
+struct user_beancounter *ub_dirty_exceeded(unsigned long dirty_thresh);
+
+struct address_space;
+struct inode;
+extern void ub_io_mapping_release(struct address_space *mapping);
+extern int ub_should_skip_writeback(struct user_beancounter *ub,
+		struct inode *inode);
+
 void ub_init_io(struct kmem_cache *);
 #else /* BC_IO_ACCOUNTING */
 #define page_iopb(page)		(NULL)
@@ -102,9 +116,55 @@ static inline void ub_io_account_write_cancelled(size_t bytes)
 {
 }
 
+struct user_beancounter;
+struct address_space;
+struct inode;
+
+static inline struct user_beancounter *
+ub_dirty_exceeded(unsigned long dirty_thresh)
+{
+	return NULL;
+}
+
+static inline void ub_io_mapping_release(struct address_space *mapping)
+{
+}
+
+static inline int ub_should_skip_writeback(struct user_beancounter *ub,
+		struct inode *inode)
+{
+	return 0;
+}
+
 static inline void ub_init_io(struct kmem_cache *pb_cachep) { };
 #endif
 
+#ifdef CONFIG_BC_IO_SCHED
+extern struct user_beancounter *ub_io_writeback_begin(struct page *pg);
+extern struct user_beancounter *
+ub_io_mapping_writeback_begin(struct address_space *mapping);
+extern void ub_io_writeback_end(struct user_beancounter *ub);
+#else
+struct user_beancounter;
+struct page;
+struct address_space;
+
+static inline struct user_beancounter *ub_io_writeback_begin(struct page *pg)
+{
+	return NULL;
+}
+
+static inline struct user_beancounter *
+ub_io_mapping_writeback_begin(struct address_space *mapping)
+{
+	return NULL;
+}
+
+static inline void ub_io_writeback_end(struct user_beancounter *ub)
+{
+}
+#endif
+
 #ifdef CONFIG_BC_DEBUG_IO
 extern void ub_io_release_debug(struct page *pg);
 #else
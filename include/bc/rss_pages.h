@@ -11,6 +11,9 @@
 #ifndef __RSS_PAGES_H_
 #define __RSS_PAGES_H_
 
+#include <linux/spinlock.h>
+#include <linux/cache.h>
+
 /*
  * Page_beancounters
  */
@@ -49,7 +52,18 @@ struct page_beancounter {
 
 #define page_pbc(__page)        ((__page)->bc.page_pb)
 
-extern spinlock_t pb_lock;
+#define PB_LOCK_BITS	8
+#define PB_LOCKS	(1 << PB_LOCK_BITS)
+
+struct pb_lock_struct {
+	spinlock_t lock;
+} ____cacheline_aligned_in_smp;
+
+extern struct pb_lock_struct pb_locks[PB_LOCKS];
+
+/* protects page_pbc(page) and pbs of this page */
+#define pb_page_lock(__page)	\
+	(&pb_locks[page_to_pfn(__page) & (PB_LOCKS - 1)].lock)
 
 struct address_space;
 extern int is_shmem_mapping(struct address_space *);
@@ -18,6 +18,9 @@
 #define UBSTAT_UBLIST			0x040000
 #define UBSTAT_UBPARMNUM		0x050000
 #define UBSTAT_GETTIME			0x060000
+#define UBSTAT_READ_BULK		0x070000
+#define UBSTAT_EVENT_ADD		0x080000
+#define UBSTAT_EVENT_DEL		0x090000
 
 #define UBSTAT_CMD(func)		((func) & 0xF0000)
 #define UBSTAT_PARMID(func)		((func) & 0x0FFFF)
@@ -60,7 +63,54 @@ typedef struct {
 	ubstatparmf_t	param[0];
 } ubstatfull_t;
 
+/*
+ * UBSTAT_READ_BULK: current values of all top-level beancounters visible
+ * to the caller, one record with UBSTAT_UBPARMNUM params per beancounter.
+ * Fails with -ENOSPC if the buffer cannot hold all of the records.
+ * Values are read without locking, so different resources may be
+ * sampled at slightly different moments.
+ */
+typedef struct {
+	unsigned long	uid;
+	unsigned long	__unused;
+	ubstatparmf_t	param[0];
+} ubstatbulk_t;
+
+/*
+ * UBSTAT_EVENT_ADD/UBSTAT_EVENT_DEL: (un)register an eventfd to be
+ * signalled by beancounter arg1 itself, no polling is needed. Threshold
+ * events fire once held grows up to percent of barrier/limit and are
+ * rearmed when held goes below it again.
+ */
+#define UBSTAT_EV_FAILCNT	0	/* failcnt of the resource grows */
+#define UBSTAT_EV_BARRIER	1	/* held reaches percent of barrier */
+#define UBSTAT_EV_LIMIT		2	/* held reaches percent of limit */
+
+typedef struct {
+	int		eventfd;
+	unsigned int	resource;
+	unsigned int	type;
+	unsigned int	percent;
+} ubstatevent_t;
+
 #ifdef __KERNEL__
+struct eventfd_ctx;
+
+/* eventfd notifications a beancounter may have at once */
+#define UB_EVENTS_MAX		64
+
+struct ub_event {
+	struct list_head	list;
+	struct eventfd_ctx	*ctx;
+	int			resource;
+	int			type;
+	unsigned int		percent;
+	int			armed;
+};
+
+struct user_beancounter;
+extern void ub_events_release(struct user_beancounter *ub);
+
 struct ub_stat_notify {
 	struct list_head	list;
 	struct task_struct	*task;
@@ -20,6 +20,7 @@ struct task_beancounter {
 	struct user_beancounter *saved_ub;
 	struct user_beancounter	*task_ub;
 	struct user_beancounter *fork_sub;
+	struct user_beancounter *io_ub;
 	unsigned long file_precharged, file_quant, file_count;
 	unsigned long kmem_precharged;
 	char dentry_alloc, pgfault_handle;
@@ -107,6 +107,18 @@ struct page_beancounter;
 #define PRIVVM_TO_PRIVATE	1
 #define PRIVVM_TO_SHARED	2
 
+/*
+ * physpages barrier is a soft limit: reclaim goes to the containers
+ * above it first. Above the limit the container is shrunk in background.
+ */
+static inline int ub_physpages_over_barrier(struct user_beancounter *ub)
+{
+	struct ubparm *p = &ub->ub_parms[UB_PHYSPAGES];
+
+	return p->barrier != 0 && p->held > p->barrier;
+}
+
+extern void ub_init_reclaim(struct user_beancounter *ub);
 extern void __ub_update_physpages(struct user_beancounter *ub);
 extern void __ub_update_oomguarpages(struct user_beancounter *ub);
 extern void __ub_update_privvm(struct user_beancounter *ub);
@@ -134,6 +146,14 @@ PB_DECLARE_VOID_FUNC(pb_remove_ref(struct page *page,
 			struct mm_struct *mm))
 
 PB_DECLARE_FUNC(struct user_beancounter *, pb_grab_page_ub(struct page *page))
+PB_DECLARE_FUNC(int, pb_page_owned(struct page *page,
+			struct user_beancounter *ub))
+
+struct address_space;
+PB_DECLARE_VOID_FUNC(ub_mapping_set_owner(struct address_space *mapping))
+PB_DECLARE_VOID_FUNC(ub_mapping_release(struct address_space *mapping))
+PB_DECLARE_FUNC(int, ub_page_cache_owned(struct page *page,
+			struct user_beancounter *ub))
 #endif
 
 #ifdef CONFIG_BC_SWAP_ACCOUNTING
@@ -150,3 +170,8 @@ SWP_DECLARE_VOID_FUNC(ub_swap_fini(struct swap_info_struct *si))
 SWP_DECLARE_VOID_FUNC(ub_swapentry_inc(struct swap_info_struct *si, pgoff_t n,
 			struct user_beancounter *ub))
 SWP_DECLARE_VOID_FUNC(ub_swapentry_dec(struct swap_info_struct *si, pgoff_t n))
+SWP_DECLARE_FUNC(struct user_beancounter *,
+		ub_swapcache_charge(struct swap_info_struct *si, pgoff_t n,
+			unsigned long size))
+SWP_DECLARE_VOID_FUNC(ub_swapcache_uncharge(struct user_beancounter *ub,
+			unsigned long size))
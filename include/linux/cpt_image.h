@@ -100,6 +100,7 @@ enum _cpt_object_type
 	CPT_OBJ_NET_VETH,
 	CPT_OBJ_NET_STATS,
 	CPT_OBJ_NET_IPIP_TUNNEL,
+	CPT_OBJ_DUPPAGES,
 
 	/* 2.6.27-specific */
 	CPT_OBJ_NET_TAP_FILTER = 0x01000000,
@@ -270,6 +271,7 @@ enum _cpt_content_type {
 	CPT_CONTENT_SEMARRAY,
 	CPT_CONTENT_SEMUNDO,
 	CPT_CONTENT_NLMARRAY,
+	CPT_CONTENT_LZO,
 	CPT_CONTENT_MAX
 };
 
@@ -1059,6 +1061,15 @@ struct cpt_page_block
 	__u64	cpt_end;
 } __attribute__ ((aligned (8)));
 
+/* CPT_CONTENT_LZO: pages of CPT_OBJ_PAGES are compressed one by one.
+ * Each page is preceded by its compressed length, length equal
+ * to page size means that the page is stored as is.
+ */
+struct cpt_lzo_page
+{
+	__u32	cpt_len;
+};
+
 struct cpt_remappage_block
 {
 	__u64	cpt_next;
@@ -1107,6 +1118,36 @@ struct cpt_iterpage_block
 } __attribute__ ((aligned (8)));
 /* Followed by array of PFNs */
 
+/* CPT_OBJ_DUPPAGES: pages, which are equal to pages already stored
+ * in the image. Followed by array of image positions of the originals,
+ * one per page. cpt_content is format of the originals: CPT_CONTENT_DATA
+ * or CPT_CONTENT_LZO.
+ */
+struct cpt_duppage_block
+{
+	__u64	cpt_next;
+	__u32	cpt_object;
+	__u16	cpt_hdrlen;
+	__u16	cpt_content;
+
+	__u64	cpt_start;
+	__u64	cpt_end;
+} __attribute__ ((aligned (8)));
+
+/* Stream sent by CPT_ITER before the image itself. Each round is
+ * a sequence of records followed by PAGE_SIZE bytes of page data,
+ * closed by a record with cpt_pfn == CPT_NULL and no data.
+ * CPT_ITER_LAST in the closing record means no more rounds follow.
+ * PFNs are those of the source node, CPT_OBJ_ITERPAGES refer to them.
+ */
+struct cpt_iterpage_hdr
+{
+	__u64	cpt_pfn;
+	__u32	cpt_flags;
+#define CPT_ITER_LAST		1
+	__u32	__cpt_pad1;
+} __attribute__ ((aligned (8)));
+
 struct cpt_vma_image
 {
 	__u64	cpt_next;
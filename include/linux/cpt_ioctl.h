@@ -41,5 +41,7 @@
 #define CPT_ITER	_IOW(CPTCTLTYPE, 23, int)
 #define CPT_LINKDIR_ADD	_IOW(CPTCTLTYPE, 24, int)
 #define CPT_HARDLNK_ON	_IOW(CPTCTLTYPE, 25, int)
+#define CPT_SET_COMPRESS _IOW(CPTCTLTYPE, 26, int)
+#define CPT_SET_DEDUP	_IOW(CPTCTLTYPE, 27, int)
 
 #endif
@@ -27,6 +27,7 @@ struct fairsched_node {
 	unsigned weight;
 	unsigned char rate_limited;
 	unsigned rate;
+	unsigned vcpus;
 #ifdef CONFIG_VE
 	struct ve_struct *owner_env;
 #endif
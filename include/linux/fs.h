@@ -648,6 +648,12 @@ struct address_space {
 	spinlock_t		private_lock;	/* for use by the address_space */
 	struct list_head	private_list;	/* ditto */
 	struct address_space	*assoc_mapping;	/* ditto */
+#ifdef CONFIG_BC_RSS_ACCOUNTING
+	struct user_beancounter	*cache_ub;	/* who added the pages last */
+#endif
+#ifdef CONFIG_BC_IO_ACCOUNTING
+	struct user_beancounter	*dirtied_ub;	/* who dirtied the pages last */
+#endif
 } __attribute__((aligned(sizeof(long))));
 	/*
 	 * On most architectures that alignment is already the case; but
@@ -28,6 +28,7 @@ extern unsigned long num_physpages;
 extern unsigned long totalram_pages;
 extern void * high_memory;
 extern int page_cluster;
+extern int sysctl_swap_vma_readahead;
 
 #ifdef CONFIG_SYSCTL
 extern int sysctl_legacy_va_layout;
@@ -784,6 +785,8 @@ int copy_page_range(struct mm_struct *dst, struct mm_struct *src,
 		struct vm_area_struct *dst_vma, struct vm_area_struct *src_vma);
 int __copy_page_range(struct vm_area_struct *dst_vma, struct vm_area_struct *vma,
 		      unsigned long addr, size_t size);
+int install_anon_page(struct vm_area_struct *vma, unsigned long address,
+		      struct page *page);
 void unmap_mapping_range(struct address_space *mapping,
 		loff_t const holebegin, loff_t const holelen, int even_cows);
 int follow_pfn(struct vm_area_struct *vma, unsigned long address,
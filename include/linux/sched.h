@@ -2038,6 +2038,9 @@ static inline unsigned int get_sysctl_timer_migration(void)
 #endif
 extern unsigned int sysctl_sched_rt_period;
 extern int sysctl_sched_rt_runtime;
+#ifdef CONFIG_CFS_BANDWIDTH
+extern unsigned int sysctl_sched_cfs_bandwidth_slice;
+#endif
 
 int sched_rt_handler(struct ctl_table *table, int write,
 		void __user *buffer, size_t *lenp,
@@ -2724,6 +2727,16 @@ extern void sched_move_task(struct task_struct *tsk);
 #ifdef CONFIG_FAIR_GROUP_SCHED
 extern int sched_group_set_shares(struct task_group *tg, unsigned long shares);
 extern unsigned long sched_group_shares(struct task_group *tg);
+extern int sched_group_set_vcpus(struct task_group *tg, unsigned int vcpus);
+extern unsigned int sched_group_vcpus(struct task_group *tg);
+#endif
+#ifdef CONFIG_CFS_BANDWIDTH
+extern int sched_group_set_cfs_quota(struct task_group *tg,
+				     long cfs_quota_us);
+extern long sched_group_cfs_quota(struct task_group *tg);
+extern int sched_group_set_cfs_period(struct task_group *tg,
+				      long cfs_period_us);
+extern long sched_group_cfs_period(struct task_group *tg);
 #endif
 #ifdef CONFIG_RT_GROUP_SCHED
 extern int sched_group_set_rt_runtime(struct task_group *tg,
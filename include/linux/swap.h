@@ -184,6 +184,9 @@ struct swap_info_struct {
 #ifdef CONFIG_BC_SWAP_ACCOUNTING
 	struct user_beancounter **swap_ubs;
 #endif
+	/* pseudo swap areas have no backing file, pages are read by ->readpage */
+	int (*readpage)(struct swap_info_struct *, struct page *);
+	void *private;
 };
 
 struct swap_list_t {
@@ -253,6 +256,20 @@ extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						unsigned int swappiness,
 						struct zone *zone,
 						int nid);
+#ifdef CONFIG_BC_RSS_ACCOUNTING
+extern unsigned long try_to_free_ub_pages(struct user_beancounter *ub,
+						gfp_t gfp_mask,
+						unsigned long nr_pages,
+						bool noswap);
+#else
+static inline unsigned long try_to_free_ub_pages(struct user_beancounter *ub,
+						gfp_t gfp_mask,
+						unsigned long nr_pages,
+						bool noswap)
+{
+	return 0;
+}
+#endif
 extern int __isolate_lru_page(struct page *page, int mode, int file);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
 extern int vm_swappiness;
@@ -294,6 +311,7 @@ extern void swap_unplug_io_fn(struct backing_dev_info *, struct page *);
 /* linux/mm/page_io.c */
 extern int swap_readpage(struct page *);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
+extern int __swap_writepage(struct page *page, struct writeback_control *wbc);
 extern void end_swap_bio_read(struct bio *bio, int err);
 
 /* linux/mm/swap_state.c */
@@ -307,11 +325,15 @@ extern int __add_to_swap_cache(struct page *page, swp_entry_t entry);
 extern void delete_from_swap_cache(struct page *);
 extern void free_page_and_swap_cache(struct page *);
 extern void free_pages_and_swap_cache(struct page **, int);
-extern struct page *lookup_swap_cache(swp_entry_t);
+extern struct page *lookup_swap_cache(swp_entry_t,
+			struct vm_area_struct *vma, unsigned long addr);
 extern struct page *read_swap_cache_async(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
+extern struct page *swapin_vma_readahead(swp_entry_t, gfp_t,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd);
 
 /* linux/mm/swapfile.c */
 extern long nr_swap_pages;
@@ -333,8 +355,18 @@ extern struct swap_info_struct *get_swap_info_struct(unsigned);
 extern int reuse_swap_page(struct page *);
 extern int try_to_free_swap(struct page *);
 extern int swap_readonly(struct page *);
+extern struct swap_info_struct *swapon_pseudo(unsigned int pages,
+		int (*readpage)(struct swap_info_struct *, struct page *),
+		void *private);
+extern int swapoff_pseudo(struct swap_info_struct *);
+extern swp_entry_t get_pseudo_swap_page(struct swap_info_struct *, pgoff_t,
+		struct user_beancounter *);
 struct backing_dev_info;
 
+/* linux/mm/memory.c */
+extern int install_swap_pte(struct vm_area_struct *, unsigned long,
+		swp_entry_t);
+
 /* linux/mm/thrash.c */
 extern struct mm_struct *swap_token_mm;
 extern void grab_swap_token(struct mm_struct *);
@@ -413,12 +445,20 @@ static inline struct page *swapin_readahead(swp_entry_t swp, gfp_t gfp_mask,
 	return NULL;
 }
 
+static inline struct page *swapin_vma_readahead(swp_entry_t swp,
+			gfp_t gfp_mask, struct vm_area_struct *vma,
+			unsigned long addr, pmd_t *pmd)
+{
+	return NULL;
+}
+
 static inline int swap_writepage(struct page *p, struct writeback_control *wbc)
 {
 	return 0;
 }
 
-static inline struct page *lookup_swap_cache(swp_entry_t swp)
+static inline struct page *lookup_swap_cache(swp_entry_t swp,
+			struct vm_area_struct *vma, unsigned long addr)
 {
 	return NULL;
 }
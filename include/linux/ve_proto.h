@@ -14,6 +14,7 @@
 #ifdef CONFIG_VE
 
 struct ve_struct;
+struct cgroup;
 
 struct seq_file;
 
@@ -32,12 +33,17 @@ int venet_init(void);
 #define VE_IOPRIO_MIN 0
 #define VE_IOPRIO_MAX 8
 extern int ve_set_ioprio(int veid, int ioprio);
+extern int ve_set_iolimit(int veid, unsigned int iops, u64 bps);
 
 extern struct list_head ve_list_head;
 #define for_each_ve(ve)	list_for_each_entry((ve), &ve_list_head, ve_list)
 extern rwlock_t ve_list_lock;
 extern struct ve_struct *get_ve_by_id(envid_t);
 extern struct ve_struct *__find_ve_by_id(envid_t);
+extern struct cgroup *__ve_cgroup_by_id(envid_t);
+extern void ve_set_cgroup(struct ve_struct *ve, struct cgroup *cgroup);
+struct user_beancounter;
+extern struct cgroup *__ub_cgroup(struct user_beancounter *ub);
 
 struct env_create_param3;
 extern int real_env_create(envid_t veid, unsigned flags, u32 class_id,
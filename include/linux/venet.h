@@ -13,11 +13,13 @@
 
 #include <linux/list.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 #include <linux/vzcalluser.h>
 #include <linux/veip.h>
 #include <linux/netdevice.h>
 
 #define VEIP_HASH_SZ 512
+#define VEIP_HASH_MAX (1 << 16)
 
 struct ve_struct;
 struct venet_stat;
@@ -32,10 +34,30 @@ struct ip_entry_struct
 	struct ve_struct	*active_env;
 	struct venet_stat	*stat;
 	struct veip_struct	*veip;
-	struct list_head 	ip_hash;
+	/*
+	 * Two hash links: while the table is being resized, readers of the
+	 * old table walk one of them and the new table is built on the other.
+	 */
+	struct hlist_node	ip_hash[2];
 	struct list_head 	ve_list;
+	struct rcu_head		rcu;
 };
 
+/*
+ * IP entries hash. Lookups are done under rcu_read_lock(), modifications
+ * under veip_hash_lock taken for write. The table is replaced by a bigger
+ * one when the number of entries exceeds the number of buckets.
+ */
+struct veip_hash
+{
+	unsigned int		size;	/* power of two */
+	unsigned int		node;	/* index in ip_entry_struct->ip_hash */
+	struct hlist_head	heads[0];
+};
+
+#define veip_hash_entry(n, idx) \
+	container_of((n) - (idx), struct ip_entry_struct, ip_hash[0])
+
 struct ext_entry_struct
 {
 	struct list_head	list;
@@ -64,8 +86,12 @@ venet_stats(struct net_device *dev, int cpu)
 void ip_entry_hash(struct ip_entry_struct *entry, struct veip_struct *veip);
 /* veip_hash_lock should be taken for write by caller */
 void ip_entry_unhash(struct ip_entry_struct *entry);
-/* veip_hash_lock should be taken for read by caller */
+/* frees entry after RCU grace period */
+void ip_entry_free(struct ip_entry_struct *entry);
+/* rcu_read_lock or veip_hash_lock should be taken by caller */
 struct ip_entry_struct *venet_entry_lookup(struct ve_addr_struct *);
+/* grows the hash if it is overloaded, may sleep */
+void veip_hash_grow(void);
 
 /* veip_hash_lock should be taken for read by caller */
 struct veip_struct *veip_find(envid_t veid);
@@ -85,7 +111,7 @@ int venet_change_skb_owner(struct sk_buff *skb);
 struct ext_entry_struct *venet_ext_lookup(struct ve_struct *ve,
 		struct ve_addr_struct *addr);
 
-extern struct list_head ip_entry_hash_table[];
+extern struct veip_hash *veip_hash;
 extern rwlock_t veip_hash_lock;
 
 #ifdef CONFIG_PROC_FS
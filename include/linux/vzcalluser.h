@@ -69,6 +69,22 @@ struct vzctl_ve_meminfo {
 	unsigned long val;
 };
 
+struct vzctl_ve_iolimit {
+	envid_t veid;
+	__u32 iops;		/* requests per second, 0 - unlimited */
+	__u64 bps;		/* bytes per second, 0 - unlimited */
+};
+
+struct vzctl_ve_ksm {
+	envid_t veid;
+	int priority;		/* < 0 - opted out, higher is merged first */
+};
+
+struct vzctl_ve_dirty {
+	envid_t veid;
+	int ratio;		/* % of the global dirty limit, 0 - unlimited */
+};
+
 struct vzctl_env_create_cid {
 	envid_t veid;
 	unsigned flags;
@@ -166,6 +182,12 @@ struct vzctl_cpustatctl {
 					struct vzctl_ve_netdev)
 #define VZCTL_VE_MEMINFO	_IOW(VZCTLTYPE, 13,                     \
 					struct vzctl_ve_meminfo)
+#define VZCTL_VE_IOLIMIT	_IOW(VZCTLTYPE, 14,			\
+					struct vzctl_ve_iolimit)
+#define VZCTL_VE_KSM		_IOW(VZCTLTYPE, 15,			\
+					struct vzctl_ve_ksm)
+#define VZCTL_VE_DIRTY		_IOW(VZCTLTYPE, 16,			\
+					struct vzctl_ve_dirty)
 
 #ifdef __KERNEL__
 #ifdef CONFIG_COMPAT
@@ -22,6 +22,7 @@
 #define VZ_DQ_SETLIMIT		9 /* set new limits */
 #define VZ_DQ_GETSTAT		10 /* get usage statistic */
 #define VZ_DQ_OFF_FORCED	11 /* forced off */
+#define VZ_DQ_CALC		12 /* calculate usage of not yet on quota */
 /* set of syscalls to maintain UGID quotas */
 #define VZ_DQ_UGID_GETSTAT	1 /* get usage/limits for ugid(s) */
 #define VZ_DQ_UGID_ADDSTAT	2 /* set usage/limits statistic for ugid(s) */
@@ -161,6 +162,7 @@ static inline void dqinfo2compat_dqinfo(struct dq_info *dqi,
 #define VZDQ_GRPQUOTA		0x20
 #define VZDQ_NOACT		0x1000	/* not actual */
 #define VZDQ_NOQUOT		0x2000	/* not under quota tree */
+#define VZDQ_CALC		0x4000	/* usage calculation in progress */
 
 struct vz_quota_ugid_stat {
 	unsigned int	limit;	/* max amount of ugid records */
@@ -186,6 +188,7 @@ struct vz_quota_ugid_setinfo {
 #include <linux/vzquota_qlnk.h>
 #include <linux/vzdq_tree.h>
 #include <linux/semaphore.h>
+#include <linux/rcupdate.h>
 
 /* Values for dq_info flags */
 #define VZ_QUOTA_INODES	0x01	   /* inodes limit warning printed */
@@ -196,6 +199,12 @@ struct vz_quota_ugid_setinfo {
 #define VZDQ_WORKING		1 /* quota created, turned on */
 #define VZDQ_STOPING		2 /* created, turned on and off */
 
+/* usage charged on a cpu and not yet folded into dq_stat */
+struct vz_quota_pcpu {
+	atomic_long_t		bdelta;
+	atomic_t		idelta;
+};
+
 /* master quota record - one per veid */
 struct vz_quota_master {
 	struct list_head	dq_hash;	/* next quota in hash list */
@@ -206,6 +215,7 @@ struct vz_quota_master {
 	struct dq_stat		dq_stat; 	/* limits, grace, usage stats */
 	struct dq_info		dq_info;	/* grace times and flags */
 	spinlock_t		dq_data_lock;	/* for dq_stat */
+	struct vz_quota_pcpu	*dq_pcpu;	/* per-cpu usage, NULL for fake */
 
 	struct mutex		dq_mutex;	/* mutex to protect
 						   ugid tree */
@@ -219,6 +229,7 @@ struct vz_quota_master {
 
 	struct path		dq_root_path;	/* path of fs tree */
 	struct super_block	*dq_sb;	      /* superblock of our quota root */
+	struct rcu_head		dq_rcu;
 };
 
 /* UID/GID quota record - one per pair (quota_master, uid or gid) */
@@ -292,6 +303,8 @@ void vzquota_data_unlock(struct inode *inode, struct vz_quota_datast *);
 int vzquota_rename_check(struct inode *inode,
 		struct inode *old_dir, struct inode *new_dir);
 struct vz_quota_master *vzquota_inode_qmblk(struct inode *inode);
+struct vz_quota_master *vzquota_inode_qmblk_rcu(struct inode *inode);
+void vzquota_fold_usage(struct vz_quota_master *qmblk);
 /* for second-level quota */
 struct vz_quota_master *vzquota_find_qmblk(struct super_block *);
 /* for management operations */
@@ -370,6 +383,9 @@ long do_vzquotactl(int cmd, unsigned int quota_id,
 		int compat);
 int vzquota_proc_init(void);
 void vzquota_proc_release(void);
+int vzquota_calc(unsigned int quota_id, const char __user *quota_root);
+int vzquota_calc_read_proc(char *page, char **start, off_t off, int count,
+		int *eof, void *data);
 struct vz_quota_master *vzquota_find_qmblk(struct super_block *);
 
 void vzaquota_init(void);
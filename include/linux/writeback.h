@@ -8,6 +8,7 @@
 #include <linux/fs.h>
 
 struct backing_dev_info;
+struct user_beancounter;
 
 extern spinlock_t inode_lock;
 extern struct list_head inode_in_use;
@@ -37,6 +38,8 @@ struct writeback_control {
 	long nr_to_write;		/* Write this many pages, and decrement
 					   this for each page written */
 	long pages_skipped;		/* Pages which were not written */
+	struct user_beancounter *wb_ub;	/* If !NULL, only write back inodes
+					   dirtied by this beancounter */
 
 	/*
 	 * For a_ops->writepages(): is start or end are non-zero then this is
@@ -74,6 +77,7 @@ void sync_inodes_sb(struct super_block *);
 void writeback_inodes_wbc(struct writeback_control *wbc);
 long wb_do_writeback(struct bdi_writeback *wb, int force_wait);
 void wakeup_flusher_threads(long nr_pages);
+void wakeup_flusher_threads_ub(long nr_pages, struct user_beancounter *ub);
 
 /* writeback.h requires fs.h; it, too, is not included from here. */
 static inline void wait_on_inode(struct inode *inode)
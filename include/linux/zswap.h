@@ -0,0 +1,42 @@
+#ifndef __LINUX_ZSWAP_H
+#define __LINUX_ZSWAP_H
+/*
+ * Compressed in-memory cache for swap pages.
+ *
+ * Pages being swapped out are compressed and kept in RAM when possible,
+ * and are written to the swap device only when the pool gets full.
+ */
+
+#include <linux/types.h>
+#include <linux/errno.h>
+
+struct page;
+
+#ifdef CONFIG_ZSWAP
+int zswap_store(struct page *page);
+int zswap_load(struct page *page);
+void zswap_invalidate(unsigned type, pgoff_t offset);
+void zswap_invalidate_area(unsigned type);
+
+#else  /* !CONFIG_ZSWAP */
+
+static inline int zswap_store(struct page *page)
+{
+	return -ENOSYS;
+}
+
+static inline int zswap_load(struct page *page)
+{
+	return -ENOSYS;
+}
+
+static inline void zswap_invalidate(unsigned type, pgoff_t offset)
+{
+}
+
+static inline void zswap_invalidate_area(unsigned type)
+{
+}
+#endif /* !CONFIG_ZSWAP */
+
+#endif
@@ -37,6 +37,7 @@
 #include <bc/hash.h>
 #include <bc/vmpages.h>
 #include <bc/proc.h>
+#include <bc/statd.h>
 
 static struct kmem_cache *ub_cachep;
 static struct user_beancounter default_beancounter;
@@ -197,8 +198,20 @@ struct user_beancounter *get_beancounter_byuid(uid_t uid, int create)
 	struct user_beancounter *new_ub, *ub;
 	unsigned long flags;
 	struct hlist_head *hash;
+	struct hlist_node *ptr;
 
 	hash = &ub_hash[ub_hash_fun(uid)];
+
+	/* Lockless lookup, beancounters are freed after a grace period */
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(ub, ptr, hash, ub_hash)
+		if (ub->ub_uid == uid && ub->parent == NULL &&
+				get_beancounter_rcu(ub) != NULL) {
+			rcu_read_unlock();
+			return ub;
+		}
+	rcu_read_unlock();
+
 	new_ub = NULL;
 retry:
 	spin_lock_irqsave(&ub_hash_lock, flags);
@@ -219,7 +232,7 @@ retry:
 
 	if (new_ub != NULL) {
 		list_add_rcu(&new_ub->ub_list, &ub_list_head);
-		hlist_add_head(&new_ub->ub_hash, hash);
+		hlist_add_head_rcu(&new_ub->ub_hash, hash);
 		ub_count_inc(new_ub);
 		spin_unlock_irqrestore(&ub_hash_lock, flags);
 		return new_ub;
@@ -265,7 +278,7 @@ retry:
 
 	if (new_ub != NULL) {
 		list_add_rcu(&new_ub->ub_list, &ub_list_head);
-		hlist_add_head(&new_ub->ub_hash, hash);
+		hlist_add_head_rcu(&new_ub->ub_hash, hash);
 		ub_count_inc(new_ub);
 		spin_unlock_irqrestore(&ub_hash_lock, flags);
 		return new_ub;
@@ -333,6 +346,7 @@ static void delayed_release_beancounter(struct work_struct *w)
 {
 	struct user_beancounter *ub, *parent;
 	unsigned long flags;
+	int i;
 
 	ub = container_of(w, struct user_beancounter, cleanup.work);
 again:
@@ -343,11 +357,15 @@ again:
 		return;
 	}
 
-	hlist_del(&ub->ub_hash);
+	hlist_del_rcu(&ub->ub_hash);
 	ub_count_dec(ub);
 	list_del_rcu(&ub->ub_list);
 	spin_unlock_irqrestore(&ub_hash_lock, flags);
 
+	/* events are charged to the ub itself */
+	ub_events_release(ub);
+	for (i = 0; i < UB_RESOURCES; i++)
+		ub_precharge_drain(ub, i);
 	bc_verify_held(ub);
 	ub_free_counters(ub);
 	percpu_counter_destroy(&ub->ub_orphan_count);
@@ -439,11 +457,147 @@ int __charge_beancounter_locked(struct user_beancounter *ub,
 	if (strict == UB_SOFT && ub_ratelimit(&ub->ub_limit_rl))
 		printk(KERN_INFO "Fatal resource shortage: %s, UB %d.\n",
 		       ub_rnames[resource], ub->ub_uid);
-	ub->ub_parms[resource].failcnt++;
+	ub_inc_failcnt(ub, resource);
 	ub->ub_parms[resource].held -= val;
 	return -ENOMEM;
 }
 
+/*
+ * Per-CPU precharge.
+ *
+ * Top-level beancounters keep some amount of a resource charged in advance
+ * on every CPU, so that most of charges and uncharges do not take ub_lock.
+ * Precharged amounts are accounted in held. They are kept only while held
+ * plus the whole possible slack (2 quants per CPU) is below the barrier,
+ * otherwise they are returned back, so that limit checks are exact when
+ * it matters.
+ */
+static const unsigned long ub_charge_quant[UB_RESOURCES] = {
+	[UB_KMEMSIZE]		= 64 * 1024,
+	[UB_NUMFLOCK]		= 4,
+	[UB_NUMFILE]		= 16,
+	[UB_TCPSNDBUF]		= 64 * 1024,
+	[UB_TCPRCVBUF]		= 64 * 1024,
+	[UB_OTHERSOCKBUF]	= 64 * 1024,
+	[UB_DGRAMRCVBUF]	= 64 * 1024,
+};
+
+static inline int ub_precharge_ok(struct user_beancounter *ub, int resource)
+{
+	struct ubparm *p;
+
+	if (ub->parent != NULL || ub_charge_quant[resource] == 0)
+		return 0;
+	p = ub->ub_parms + resource;
+	return p->held + 2 * ub_charge_quant[resource] * num_online_cpus()
+		<= p->barrier;
+}
+
+static inline atomic_long_t *ub_precharge_ptr(struct user_beancounter *ub,
+		int resource, int cpu)
+{
+	return &per_cpu_ptr(ub->ub_percpu, cpu)->precharge[resource];
+}
+
+/* Takes @val from precharge of this CPU */
+static int ub_charge_precharged(struct user_beancounter *ub, int resource,
+		unsigned long val)
+{
+	atomic_long_t *pc;
+	long old, cur;
+	int ret = 0;
+
+	pc = ub_precharge_ptr(ub, resource, get_cpu());
+	old = atomic_long_read(pc);
+	while (old >= (long)val) {
+		cur = atomic_long_cmpxchg(pc, old, old - val);
+		if (cur == old) {
+			ret = 1;
+			break;
+		}
+		old = cur;
+	}
+	put_cpu();
+	return ret;
+}
+
+/* Puts @val back to precharge of this CPU, if it is not full yet */
+static int ub_uncharge_precharged(struct user_beancounter *ub, int resource,
+		unsigned long val)
+{
+	unsigned long max = 2 * ub_charge_quant[resource];
+	atomic_long_t *pc;
+	long old, cur;
+	int ret = 0;
+
+	if (val > max || !ub_precharge_ok(ub, resource))
+		return 0;
+
+	pc = ub_precharge_ptr(ub, resource, get_cpu());
+	old = atomic_long_read(pc);
+	while (old + val <= max) {
+		cur = atomic_long_cmpxchg(pc, old, old + val);
+		if (cur == old) {
+			ret = 1;
+			break;
+		}
+		old = cur;
+	}
+	put_cpu();
+	if (ret && !test_bit(resource, &ub->ub_precharge_mask))
+		set_bit(resource, &ub->ub_precharge_mask);
+	return ret;
+}
+
+/* Called under ub_lock after successful charge */
+static void ub_precharge_refill(struct user_beancounter *ub, int resource)
+{
+	unsigned long quant = ub_charge_quant[resource];
+
+	if (!ub_precharge_ok(ub, resource))
+		return;
+
+	ub->ub_parms[resource].held += quant;
+	ub_adjust_maxheld(ub, resource);
+	atomic_long_add(quant, ub_precharge_ptr(ub, resource,
+				smp_processor_id()));
+	if (!test_bit(resource, &ub->ub_precharge_mask))
+		set_bit(resource, &ub->ub_precharge_mask);
+}
+
+void ub_precharge_drain(struct user_beancounter *ub, int resource)
+{
+	unsigned long flags, sum;
+	int cpu;
+
+	if (!test_and_clear_bit(resource, &ub->ub_precharge_mask))
+		return;
+
+	sum = 0;
+	for_each_possible_cpu(cpu)
+		sum += atomic_long_xchg(ub_precharge_ptr(ub, resource, cpu), 0);
+	if (sum == 0)
+		return;
+
+	spin_lock_irqsave(&ub->ub_lock, flags);
+	__uncharge_beancounter_locked(ub, resource, sum);
+	spin_unlock_irqrestore(&ub->ub_lock, flags);
+}
+
+unsigned long ub_precharged(struct user_beancounter *ub, int resource)
+{
+	unsigned long sum;
+	int cpu;
+
+	if (!test_bit(resource, &ub->ub_precharge_mask))
+		return 0;
+
+	sum = 0;
+	for_each_possible_cpu(cpu)
+		sum += atomic_long_read(ub_precharge_ptr(ub, resource, cpu));
+	return sum;
+}
+
 int charge_beancounter(struct user_beancounter *ub,
 		int resource, unsigned long val, enum ub_severity strict)
 {
@@ -455,10 +609,21 @@ int charge_beancounter(struct user_beancounter *ub,
 	if (val > UB_MAXVALUE)
 		goto out;
 
+	if (ub->parent == NULL && ub_charge_quant[resource]) {
+		if (ub_charge_precharged(ub, resource, val))
+			return 0;
+		/* Close to the barrier, all CPUs' precharges are returned */
+		if (!ub_precharge_ok(ub, resource))
+			ub_precharge_drain(ub, resource);
+	}
+
 	local_irq_save(flags);
 	for (p = ub; p != NULL; p = p->parent) {
 		spin_lock(&p->ub_lock);
 		retval = __charge_beancounter_locked(p, resource, val, strict);
+		if (!retval && p->parent == NULL && p == ub &&
+				ub_charge_quant[resource])
+			ub_precharge_refill(p, resource);
 		spin_unlock(&p->ub_lock);
 		if (retval)
 			goto unroll;
@@ -518,6 +683,7 @@ void __uncharge_beancounter_locked(struct user_beancounter *ub,
 		val = ub->ub_parms[resource].held;
 	}
 	ub->ub_parms[resource].held -= val;
+	ub_check_events(ub, resource, 0);
 }
 
 void uncharge_beancounter(struct user_beancounter *ub,
@@ -526,6 +692,10 @@ void uncharge_beancounter(struct user_beancounter *ub,
 	unsigned long flags;
 	struct user_beancounter *p;
 
+	if (ub->parent == NULL && ub_charge_quant[resource] &&
+			ub_uncharge_precharged(ub, resource, val))
+		return;
+
 	for (p = ub; p != NULL; p = p->parent) {
 		spin_lock_irqsave(&p->ub_lock, flags);
 		__uncharge_beancounter_locked(p, resource, val);
@@ -609,6 +779,9 @@ static void init_beancounter_struct(struct user_beancounter *ub)
 #ifdef CONFIG_BC_DEBUG_KMEM
 	INIT_LIST_HEAD(&ub->ub_cclist);
 #endif
+	INIT_LIST_HEAD(&ub->ub_events);
+	ub->ub_nr_events = 0;
+	ub_init_reclaim(ub);
 }
 
 static void init_beancounter_store(struct user_beancounter *ub)
@@ -84,18 +84,23 @@ struct page_beancounter **page_pblist(struct page *page)
 
 #ifdef CONFIG_BC_DEBUG_IO
 static LIST_HEAD(pb_io_list);
+static DEFINE_SPINLOCK(pb_io_lock);
 static unsigned long anon_pages, not_released;
 
 static inline void io_debug_save(struct page_beancounter *pb,
 		struct page_beancounter *mpb)
 {
 	pb->io_debug = (mpb == NULL);
+	spin_lock(&pb_io_lock);
 	list_add(&pb->io_list, &pb_io_list);
+	spin_unlock(&pb_io_lock);
 }
 
 static inline void io_debug_release(struct page_beancounter *pb)
 {
+	spin_lock(&pb_io_lock);
 	list_del(&pb->io_list);
+	spin_unlock(&pb_io_lock);
 }
 
 void ub_io_release_debug(struct page *page)
@@ -113,13 +118,16 @@ void ub_io_release_debug(struct page *page)
 		once = 1;
 	}
 
-	spin_lock(&pb_lock);
-	not_released++;
+	spin_lock(pb_page_lock(page));
 	pb = iopb_to_pb(pb);
 	page_pbc(page) = NULL;
 	io_debug_release(pb);
-	pb->ub->io_pb_held--;
-	spin_unlock(&pb_lock);
+	ub_percpu_dec(pb->ub, io_pb_held);
+	spin_unlock(pb_page_lock(page));
+
+	spin_lock(&pb_io_lock);
+	not_released++;
+	spin_unlock(&pb_io_lock);
 
 	put_beancounter(pb->ub);
 	io_pb_free(pb);
@@ -128,7 +136,9 @@ void ub_io_release_debug(struct page *page)
 static inline int io_debug_precheck_save(struct page *page)
 {
 	if (unlikely(PageAnon(page))) {
+		spin_lock(&pb_io_lock);
 		anon_pages++;
+		spin_unlock(&pb_io_lock);
 		return 1;
 	}
 
@@ -156,16 +166,48 @@ static inline void set_page_io(struct page *page, struct page_beancounter *pb,
 
 	page_pbc(page) = (struct page_beancounter *)val;
 	io_debug_save(pb, mapped_pb);
-	pb->ub->io_pb_held++;
+	ub_percpu_inc(pb->ub, io_pb_held);
 }
 
 static inline void put_page_io(struct page *page, struct page_beancounter *pb)
 {
-	pb->ub->io_pb_held--;
+	ub_percpu_dec(pb->ub, io_pb_held);
 	io_debug_release(pb);
 	page_pbc(page) = pb->page_pb_list;
 }
 
+/*
+ * The mapping remembers the beancounter which dirtied its pages last and
+ * holds a reference on it. Writeback on behalf of a container skips the
+ * inodes dirtied by others, see ub_should_skip_writeback().
+ */
+static void ub_io_mapping_set_dirtier(struct address_space *mapping,
+		struct user_beancounter *ub)
+{
+	struct user_beancounter *old;
+
+	/* swap cache is not written back by inodes */
+	if (mapping == NULL || mapping->host == NULL)
+		return;
+	if (likely(mapping->dirtied_ub == ub))
+		return;
+
+	old = xchg(&mapping->dirtied_ub, get_beancounter(ub));
+	put_beancounter(old);
+}
+
+void ub_io_mapping_release(struct address_space *mapping)
+{
+	put_beancounter(mapping->dirtied_ub);
+	mapping->dirtied_ub = NULL;
+}
+
+/* The pointer is only compared, the inode may be dirtied meanwhile */
+int ub_should_skip_writeback(struct user_beancounter *ub, struct inode *inode)
+{
+	return ub != NULL && inode->i_mapping->dirtied_ub != ub;
+}
+
 void ub_io_save_context(struct page *page, size_t bytes_dirtied)
 {
 	struct user_beancounter *ub;
@@ -184,7 +226,7 @@ void ub_io_save_context(struct page *page, size_t bytes_dirtied)
 	pb = io_pb_alloc();
 	io_pb = NULL;
 
-	spin_lock(&pb_lock);
+	spin_lock(pb_page_lock(page));
 	if (io_debug_precheck_save(page))
 		goto out_unlock;
 
@@ -216,14 +258,15 @@ void ub_io_save_context(struct page *page, size_t bytes_dirtied)
 		 * writes for ub_io_release_context()
 		 */
 		if (io_pb != NULL)
-			io_pb->ub->bytes_wrote += PAGE_CACHE_SIZE;
+			ub_percpu_add(io_pb->ub, bytes_wrote,
+					PAGE_CACHE_SIZE);
 		if (pb != NULL)
 			io_pb_free(pb);
 		goto out_unlock;
 	}
 
 	if (pb == NULL) {
-		ub->bytes_dirty_missed += bytes_dirtied;
+		ub_percpu_add(ub, bytes_dirty_missed, bytes_dirtied);
 		goto out_unlock;
 	}
 
@@ -234,13 +277,17 @@ void ub_io_save_context(struct page *page, size_t bytes_dirtied)
 
 	pb->ub = get_beancounter(ub);
 	pb->page_pb_list = mapped_pb;
-	ub->bytes_dirtied += bytes_dirtied;
+	ub_percpu_add(ub, bytes_dirtied, bytes_dirtied);
 
 	set_page_io(page, pb, mapped_pb);
+	spin_unlock(pb_page_lock(page));
 
-out_unlock:
-	spin_unlock(&pb_lock);
+	ub_io_mapping_set_dirtier(page_mapping(page), ub);
+	goto out;
 
+out_unlock:
+	spin_unlock(pb_page_lock(page));
+out:
 	if (io_pb != NULL) {
 		put_beancounter(io_pb->ub);
 		io_pb_free(io_pb);
@@ -259,7 +306,7 @@ void ub_io_release_context(struct page *page, size_t wrote)
 		return;
 	}
 
-	spin_lock(&pb_lock);
+	spin_lock(pb_page_lock(page));
 	pb = iopb_to_pb(page_pbc(page));
 	if (unlikely(pb == NULL))
 		/*
@@ -269,11 +316,11 @@ void ub_io_release_context(struct page *page, size_t wrote)
 		goto out_unlock;
 
 	if (wrote)
-		pb->ub->bytes_wrote += wrote;
+		ub_percpu_add(pb->ub, bytes_wrote, wrote);
 
 	put_page_io(page, pb);
 out_unlock:
-	spin_unlock(&pb_lock);
+	spin_unlock(pb_page_lock(page));
 
 	if (pb != NULL) {
 		put_beancounter(pb->ub);
@@ -281,6 +328,113 @@ out_unlock:
 	}
 }
 
+#ifdef CONFIG_BC_IO_SCHED
+/*
+ * Writeback is issued by flusher threads and reclaim, not by the tasks
+ * which dirtied the pages. Make the beancounter from the page IO context
+ * the IO beancounter of current for the time of ->writepage, so the IO
+ * scheduler puts the requests into the container's group.
+ */
+struct user_beancounter *ub_io_writeback_begin(struct page *page)
+{
+	struct page_beancounter *pb;
+	struct user_beancounter *ub;
+
+	if (current->task_bc.io_ub != NULL)
+		return NULL;
+
+	ub = NULL;
+	spin_lock(pb_page_lock(page));
+	pb = iopb_to_pb(page_pbc(page));
+	if (pb != NULL)
+		ub = get_beancounter(pb->ub);
+	spin_unlock(pb_page_lock(page));
+
+	current->task_bc.io_ub = ub;
+	return ub;
+}
+
+/*
+ * ->writepages() implementations and data=ordered commits submit pages
+ * after clear_page_dirty_for_io() has released their IO context (ext4
+ * delayed allocation, jbd data buffers), so the whole mapping goes to
+ * the beancounter which dirtied it last.
+ */
+struct user_beancounter *
+ub_io_mapping_writeback_begin(struct address_space *mapping)
+{
+	struct user_beancounter *ub;
+
+	if (current->task_bc.io_ub != NULL || mapping == NULL)
+		return NULL;
+
+	rcu_read_lock();
+	ub = rcu_dereference(mapping->dirtied_ub);
+	if (ub != NULL)
+		ub = get_beancounter_rcu(ub);
+	rcu_read_unlock();
+
+	current->task_bc.io_ub = ub;
+	return ub;
+}
+
+void ub_io_writeback_end(struct user_beancounter *ub)
+{
+	if (ub == NULL)
+		return;
+
+	current->task_bc.io_ub = NULL;
+	put_beancounter(ub);
+}
+#endif
+
+/*
+ * Dirty pages of a container are the pages with its IO context, i.e.
+ * dirtied and neither written nor cancelled yet. The container may keep
+ * ub_dirty_ratio percent of the global dirty threshold (VZCTL_VE_DIRTY),
+ * see balance_dirty_pages(). It is not limited by default.
+ */
+
+/*
+ * The per-cpu counters are summed at most once a jiffy, the callers in
+ * between get the cached value. The check is approximate anyway.
+ */
+static unsigned long ub_dirty_pages(struct user_beancounter *ub)
+{
+	long pages;
+	int cpu;
+
+	if (ub->ub_dirty_stamp == jiffies)
+		return ub->ub_dirty_pages;
+
+	pages = 0;
+	for_each_possible_cpu(cpu)
+		pages += per_cpu_ptr(ub->ub_percpu, cpu)->io_pb_held;
+
+	ub->ub_dirty_pages = pages > 0 ? pages : 0;
+	ub->ub_dirty_stamp = jiffies;
+	return ub->ub_dirty_pages;
+}
+
+/*
+ * Returns the current container if it has more dirty pages than its
+ * share of @dirty_thresh, NULL otherwise.
+ */
+struct user_beancounter *ub_dirty_exceeded(unsigned long dirty_thresh)
+{
+	struct user_beancounter *ub;
+	int ratio;
+
+	ub = get_io_ub();
+	ratio = ub->ub_dirty_ratio;
+	if (ratio == 0 || ratio >= 100)
+		return NULL;
+
+	if (ub_dirty_pages(ub) <= dirty_thresh * ratio / 100)
+		return NULL;
+	return ub;
+}
+
 void __init ub_init_io(struct kmem_cache *pb_cachep)
 {
 	pb_pool = mempool_create_slab_pool(PB_MIN_IO, pb_cachep);
@@ -294,7 +448,8 @@ void __init ub_init_io(struct kmem_cache *pb_cachep)
 static int bc_ioacct_show(struct seq_file *f, void *v)
 {
 	int i;
-	unsigned long long read, write, cancel;
+	unsigned long long read, write, cancel, dirty, missed;
+	unsigned long io_pbs;
 	unsigned long sync, sync_done;
 	unsigned long fsync, fsync_done;
 	unsigned long fdsync, fdsync_done;
@@ -305,7 +460,8 @@ static int bc_ioacct_show(struct seq_file *f, void *v)
 
 	ub = seq_beancounter(f);
 
-	read = write = cancel = 0;
+	read = write = cancel = dirty = missed = 0;
+	io_pbs = 0;
 	sync = sync_done = fsync = fsync_done =
 		fdsync = fdsync_done = frsync = frsync_done = 0;
 	reads = writes = 0;
@@ -317,6 +473,9 @@ static int bc_ioacct_show(struct seq_file *f, void *v)
 		read += ub_percpu->bytes_read;
 		write += ub_percpu->bytes_wrote;
 		cancel += ub_percpu->bytes_cancelled;
+		dirty += ub_percpu->bytes_dirtied;
+		missed += ub_percpu->bytes_dirty_missed;
+		io_pbs += ub_percpu->io_pb_held;
 
 		sync += ub_percpu->sync;
 		fsync += ub_percpu->fsync;
@@ -334,10 +493,10 @@ static int bc_ioacct_show(struct seq_file *f, void *v)
 	}
 
 	seq_printf(f, bc_proc_llu_fmt, "read", read);
-	seq_printf(f, bc_proc_llu_fmt, "write", ub->bytes_wrote + write);
-	seq_printf(f, bc_proc_llu_fmt, "dirty", ub->bytes_dirtied);
+	seq_printf(f, bc_proc_llu_fmt, "write", write);
+	seq_printf(f, bc_proc_llu_fmt, "dirty", dirty);
 	seq_printf(f, bc_proc_llu_fmt, "cancel", cancel);
-	seq_printf(f, bc_proc_llu_fmt, "missed", ub->bytes_dirty_missed);
+	seq_printf(f, bc_proc_llu_fmt, "missed", missed);
 
 	seq_printf(f, bc_proc_lu_lfmt, "syncs_total", sync);
 	seq_printf(f, bc_proc_lu_lfmt, "fsyncs_total", fsync);
@@ -354,7 +513,7 @@ static int bc_ioacct_show(struct seq_file *f, void *v)
 	seq_printf(f, bc_proc_lu_lfmt, "vfs_writes", writes);
 	seq_printf(f, bc_proc_llu_fmt, "vfs_write_chars", wchar);
 
-	seq_printf(f, bc_proc_lu_lfmt, "io_pbs", ub->io_pb_held);
+	seq_printf(f, bc_proc_lu_lfmt, "io_pbs", io_pbs);
 	return 0;
 }
 
@@ -408,7 +567,7 @@ static int bc_io_show(struct seq_file *f, void *v)
 
 static void *bc_io_start(struct seq_file *f, loff_t *ppos)
 {
-	spin_lock(&pb_lock);
+	spin_lock(&pb_io_lock);
 	return seq_list_start_head(&pb_io_list, *ppos);
 }
 
@@ -419,7 +578,7 @@ static void *bc_io_next(struct seq_file *f, void *v, loff_t *ppos)
 
 static void bc_io_stop(struct seq_file *f, void *v)
 {
-	spin_unlock(&pb_lock);
+	spin_unlock(&pb_io_lock);
 }
 
 static struct seq_operations bc_io_seq_ops = {
@@ -465,8 +624,7 @@ static int bc_ioacct_notify(struct vnotifier_block *self,
 		return old_ret;
 
 	/* Think over: do we need to account here bytes_dirty_missed? */
-	bout = ub->bytes_wrote;
-	bin = 0;
+	bout = bin = 0;
 	for_each_online_cpu(i) {
 		bout += per_cpu_ptr(ub->ub_percpu, i)->bytes_wrote;
 		bin += per_cpu_ptr(ub->ub_percpu, i)->bytes_read;
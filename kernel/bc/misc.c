@@ -63,6 +63,7 @@ void ub_init_task_bc(struct task_beancounter *tbc)
 
 	tbc->kmem_precharged = 0;
 	tbc->dentry_alloc = 0;
+	tbc->io_ub = NULL;
 }
 
 int ub_task_charge(struct task_struct *parent, struct task_struct *task)
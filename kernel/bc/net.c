@@ -665,7 +665,7 @@ unroll:
 			"sk %p sz %lu pr %lu hd %lu wc %lu sb %d.\n",
 			sk, size, skbc->poll_reserv, ub->ub_parms[bufid].held,
 			skbc->ub_wcharged, sk->sk_sndbuf);
-	ub->ub_parms[bufid].failcnt++;
+	ub_inc_failcnt(ub, bufid);
 	ub->ub_parms[bufid].held -= size - skbc->poll_reserv;
 
 	if (sk->sk_socket != NULL) {
@@ -888,7 +888,7 @@ excess:
 		retval = -ENOMEM;
 	if (retval) {
 		ub->ub_parms[UB_TCPRCVBUF].held -= chargesize;
-		ub->ub_parms[UB_TCPRCVBUF].failcnt++;
+		ub_inc_failcnt(ub, UB_TCPRCVBUF);
 	}
 	ub_adjust_maxheld(ub, UB_TCPRCVBUF);
 	spin_unlock_irqrestore(&ub->ub_lock, flags);
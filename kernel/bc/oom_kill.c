@@ -12,7 +12,7 @@
 #define UB_OOM_TIMEOUT	(5 * HZ)
 
 int oom_generation;
-int oom_kill_counter;
+atomic_t oom_kill_counter;
 static DEFINE_SPINLOCK(oom_lock);
 static DECLARE_WAIT_QUEUE_HEAD(oom_wq);
 
@@ -46,7 +46,7 @@ int ub_oom_lock(void)
 	tsk = current;
 
 	spin_lock(&oom_lock);
-	if (!oom_kill_counter)
+	if (!atomic_read(&oom_kill_counter))
 		goto out_do_oom;
 
 	timeout = UB_OOM_TIMEOUT;
@@ -140,9 +140,16 @@ struct user_beancounter *ub_oom_select_worst(void)
 void ub_oom_mm_killed(struct user_beancounter *ub)
 {
 	static struct ub_rate_info ri = { 5, 60*HZ };
-
-	/* increment is serialized with oom_lock */
-	ub->ub_parms[UB_OOMGUARPAGES].failcnt++;
+	struct user_beancounter *p;
+	unsigned long flags;
+
+	for (p = ub; p != NULL; p = p->parent) {
+		spin_lock_irqsave(&p->ub_lock, flags);
+		if (p == ub)
+			ub_inc_failcnt(ub, UB_OOMGUARPAGES);
+		p->ub_oom_kill_counter++;
+		spin_unlock_irqrestore(&p->ub_lock, flags);
+	}
 
 	if (ub_ratelimit(&ri))
 		show_mem();
@@ -153,43 +160,149 @@ void ub_oom_unlock(void)
 	spin_unlock(&oom_lock);
 }
 
-void ub_oom_task_dead(struct task_struct *tsk)
+void ub_oom_task_dead(struct mm_struct *mm)
 {
+	struct task_struct *tsk = current;
+	struct user_beancounter *ub;
+	unsigned long flags;
+
 	spin_lock(&oom_lock);
-	oom_kill_counter = 0;
+	atomic_set(&oom_kill_counter, 0);
 	oom_generation++;
 
 	printk("OOM killed process %s (pid=%d, ve=%d) exited, "
 			"free=%lu gen=%d.\n",
 			tsk->comm, tsk->pid, VEID(tsk->ve_task_info.owner_env),
 			nr_free_pages(), oom_generation);
+	spin_unlock(&oom_lock);
+
+	for (ub = mm_ub(mm); ub != NULL; ub = ub->parent) {
+		spin_lock_irqsave(&ub->ub_lock, flags);
+		ub->ub_oom_kill_counter = 0;
+		ub->ub_oom_generation++;
+		spin_unlock_irqrestore(&ub->ub_lock, flags);
+	}
+
 	/* if there is time to sleep in ub_oom_lock -> sleep will continue */
 	wake_up_all(&oom_wq);
-	spin_unlock(&oom_lock);
 }
 
+/*
+ * Container OOM is serialized per beancounter, not with oom_lock, so
+ * an OOM in one container does not stall allocations in the others.
+ * Like ub_oom_lock(), wait for the previous victim to exit and give up
+ * if it did.
+ */
+static int ub_oom_scope_lock(struct user_beancounter *ub)
+{
+	int generation, timeout;
+	unsigned long flags;
+	DEFINE_WAIT(oom_w);
+
+	timeout = UB_OOM_TIMEOUT;
+	spin_lock_irqsave(&ub->ub_lock, flags);
+	generation = ub->ub_oom_generation;
+	while (ub->ub_oom_running || ub->ub_oom_kill_counter) {
+		if (test_thread_flag(TIF_MEMDIE) ||
+				ub->ub_oom_generation != generation) {
+			spin_unlock_irqrestore(&ub->ub_lock, flags);
+			return -EINVAL;
+		}
+
+		if (timeout == 0)
+			break;
+
+		prepare_to_wait(&oom_wq, &oom_w, TASK_UNINTERRUPTIBLE);
+		spin_unlock_irqrestore(&ub->ub_lock, flags);
+
+		timeout = schedule_timeout(timeout);
+
+		finish_wait(&oom_wq, &oom_w);
+		spin_lock_irqsave(&ub->ub_lock, flags);
+	}
+	ub->ub_oom_running = 1;
+	spin_unlock_irqrestore(&ub->ub_lock, flags);
+	return 0;
+}
+
+static void ub_oom_scope_unlock(struct user_beancounter *ub)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ub->ub_lock, flags);
+	ub->ub_oom_running = 0;
+	spin_unlock_irqrestore(&ub->ub_lock, flags);
+	wake_up_all(&oom_wq);
+}
+
+/*
+ * Low watermark pass: before killing anything try to bring the container
+ * back under its oomguarpages barrier by reclaiming its own page cache.
+ */
+static int ub_oom_reclaim(struct user_beancounter *ub)
+{
+	unsigned long nr_pages;
+	long overdraft;
+
+	overdraft = ub_current_overdraft(ub);
+	nr_pages = max_t(long, overdraft, SWAP_CLUSTER_MAX);
+
+	return try_to_free_ub_pages(ub, GFP_KERNEL, nr_pages, true) >= nr_pages;
+}
+
+/*
+ * Kill a task from the scope beancounter. May sleep, the caller
+ * holds a reference on the scope.
+ */
 void ub_out_of_memory(struct user_beancounter *scope)
 {
-	struct user_beancounter *ub;
 	struct task_struct *p;
 
-	spin_lock(&oom_lock);
-	ub_clear_oom();
-	ub = get_beancounter(scope);
+	might_sleep();
+
+	/* one reclaimer and killer per scope, the others wait for it */
+	if (ub_oom_scope_lock(scope))
+		return;
+
+	if (ub_oom_reclaim(scope))
+		goto out;
 
 	read_lock(&tasklist_lock);
 retry:
-	p = select_bad_process(ub, NULL);
+	p = select_bad_process(scope, NULL);
 	if (p == NULL || PTR_ERR(p) == -1UL)
 		goto unlock;
 
 	if (oom_kill_process(p, (gfp_t)-1, -1, NULL, "UB Out of memory"))
 		goto retry;
 
-	put_beancounter(ub);
-
 unlock:
 	read_unlock(&tasklist_lock);
-	spin_unlock(&oom_lock);
+out:
+	ub_oom_scope_unlock(scope);
 }
 EXPORT_SYMBOL(ub_out_of_memory);
+
+/*
+ * A fault failed to allocate memory. If the faulting container is above
+ * its OOM guarantee, it's the container who should pay: handle the OOM
+ * in its scope only without taking global oom_lock.
+ */
+int ub_pagefault_out_of_memory(void)
+{
+	struct user_beancounter *ub;
+
+	if (current->mm == NULL || mm_ub(current->mm) == NULL)
+		return 0;
+
+	ub = top_beancounter(mm_ub(current->mm));
+	if (ub == get_ub0())
+		return 0;
+	if (ub_current_overdraft(ub) <= 0)
+		return 0;
+
+	get_beancounter(ub);
+	ub_out_of_memory(ub);
+	put_beancounter(ub);
+	return 1;
+}
@@ -52,7 +52,7 @@ static void ub_show_res(struct seq_file *f, struct user_beancounter *ub,
 		strcpy(ub_uid, "");
 
 	seq_printf(f, res_fmt, ub_uid, ub_rnames[r],
-			ub->ub_parms[r].held,
+			ub_held(ub, r),
 			ub->ub_parms[r].maxheld,
 			ub->ub_parms[r].barrier,
 			ub->ub_parms[r].limit,
@@ -8,6 +8,8 @@
  *
  */
 
+#include <linux/init.h>
+#include <linux/string.h>
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
@@ -22,10 +24,37 @@
 #include <bc/io_acct.h>
 
 static struct kmem_cache *pb_cachep;
-spinlock_t pb_lock = SPIN_LOCK_UNLOCKED;
 static struct page_beancounter **pb_hash_table;
 static unsigned int pb_hash_mask;
 
+/*
+ * The page list of pbs and the hash chains holding this page's pbs are
+ * protected with the lock chosen by the page pfn. The lower PB_LOCK_BITS
+ * bits of the hash value are taken from the pfn, so any hash chain has
+ * pbs of pages with the same lock only.
+ */
+struct pb_lock_struct pb_locks[PB_LOCKS];
+
+/*
+ * ub_rss=owner: a page is charged as a whole to the beancounter that maps
+ * it first, the other beancounters mapping it are not charged. Such page
+ * has a single pb counting all its mappings, so fork does not allocate
+ * pbs and the shares are not rebalanced. physpages becomes approximate.
+ */
+static int pb_owner_mode __read_mostly;
+
+static int __init pb_setup_mode(char *str)
+{
+	if (!strcmp(str, "owner"))
+		pb_owner_mode = 1;
+	else if (!strcmp(str, "share"))
+		pb_owner_mode = 0;
+	else
+		return 0;
+	return 1;
+}
+__setup("ub_rss=", pb_setup_mode);
+
 /*
  * Auxiliary staff
  */
@@ -53,52 +82,44 @@ static inline void set_held_pages(struct user_beancounter *bc)
 	__ub_update_privvm(bc);
 }
 
-static inline void do_dec_held_pages(struct user_beancounter *ub, int value)
+/*
+ * ub_pbcs is changed together with the held pages, as pbs of one
+ * beancounter are inserted and removed under different pb locks
+ */
+static inline void do_dec_held_pages(struct user_beancounter *ub, int value,
+		int pbcs)
 {
 	unsigned long flags;
 
 	spin_lock_irqsave(&ub->ub_lock, flags);
 	ub->ub_held_pages -= value;
+	ub->ub_pbcs -= pbcs;
 	set_held_pages(ub);
 	spin_unlock_irqrestore(&ub->ub_lock, flags);
 }
 
-static void dec_held_pages(struct user_beancounter *ub, int value)
+static void dec_held_pages(struct user_beancounter *ub, int value, int pbcs)
 {
 	for (; ub != NULL; ub = ub->parent)
-		do_dec_held_pages(ub, value);
+		do_dec_held_pages(ub, value, pbcs);
 }
 
-static inline void do_inc_held_pages(struct user_beancounter *ub, int value)
+static inline void do_inc_held_pages(struct user_beancounter *ub, int value,
+		int pbcs)
 {
 	unsigned long flags;
 
 	spin_lock_irqsave(&ub->ub_lock, flags);
 	ub->ub_held_pages += value;
+	ub->ub_pbcs += pbcs;
 	set_held_pages(ub);
 	spin_unlock_irqrestore(&ub->ub_lock, flags);
 }
 
-static void inc_held_pages(struct user_beancounter *ub, int value)
-{
-	for (; ub != NULL; ub = ub->parent)
-		do_inc_held_pages(ub, value);
-}
-
-/*
- * ++ and -- beyond are protected with pb_lock
- */
-
-static inline void inc_pbc_count(struct user_beancounter *ub)
+static void inc_held_pages(struct user_beancounter *ub, int value, int pbcs)
 {
 	for (; ub != NULL; ub = ub->parent)
-		ub->ub_pbcs++;
-}
-
-static inline void dec_pbc_count(struct user_beancounter *ub)
-{
-	for (; ub != NULL; ub = ub->parent)
-		ub->ub_pbcs--;
+		do_inc_held_pages(ub, value, pbcs);
 }
 
 /*
@@ -167,6 +188,10 @@ int pb_alloc_list(struct page_beancounter **p_pb, int num)
 {
 	struct page_beancounter *list;
 
+	/* pages copied on fork already have their pb */
+	if (pb_owner_mode)
+		return 0;
+
 	for (list = *p_pb; list != NULL && num; list = list->next_hash, num--);
 	if (!num)
 		return 0;
@@ -195,10 +220,14 @@ int pb_alloc_all(struct page_beancounter **pbs)
 	struct user_beancounter *ub;
 
 	need_alloc = 0;
-	rcu_read_lock();
-	for_each_beancounter(ub)
-		need_alloc++;
-	rcu_read_unlock();
+	if (pb_owner_mode)
+		need_alloc = 1;
+	else {
+		rcu_read_lock();
+		for_each_beancounter(ub)
+			need_alloc++;
+		rcu_read_unlock();
+	}
 
 	if (!__alloc_list(pbs, need_alloc))
 		return 0;
@@ -213,10 +242,11 @@ int pb_alloc_all(struct page_beancounter **pbs)
 
 static inline int pb_hash(struct user_beancounter *ub, struct page *page)
 {
-	return (page_to_pfn(page) ^ ub->ub_cookie) & pb_hash_mask;
+	return (page_to_pfn(page) ^ (ub->ub_cookie & ~(PB_LOCKS - 1))) &
+		pb_hash_mask;
 }
 
-/* pb_lock should be held */
+/* page pb lock should be held */
 static inline void insert_pb(struct page_beancounter *p, struct page *page,
 		struct user_beancounter *ub, int hash)
 {
@@ -224,7 +254,6 @@ static inline void insert_pb(struct page_beancounter *p, struct page *page,
 	p->ub = get_beancounter(ub);
 	p->next_hash = pb_hash_table[hash];
 	pb_hash_table[hash] = p;
-	inc_pbc_count(ub);
 }
 
 /*
@@ -274,7 +303,7 @@ static void __pb_add_ref(struct page *page, struct user_beancounter *bc,
 		 * Update user beancounter, the share of head has been changed.
 		 * Note that the shift counter is taken after increment. 
 		 */
-		dec_held_pages(head->ub, UB_PAGE_WEIGHT >> shift);
+		dec_held_pages(head->ub, UB_PAGE_WEIGHT >> shift, 0);
 		/* add the new page beancounter to the end of the list */
 		head = *hp;
 		list_add_tail(&p->page_list, &head->page_list);
@@ -286,7 +315,69 @@ static void __pb_add_ref(struct page *page, struct user_beancounter *bc,
 
 	p->refcount = PB_REFCOUNT_MAKE(shift, 1);
 	/* update user beancounter for the new page beancounter */
-	inc_held_pages(bc, UB_PAGE_WEIGHT >> shift);
+	inc_held_pages(bc, UB_PAGE_WEIGHT >> shift, 1);
+}
+
+/*
+ * Owner mode
+ */
+
+static void pb_owner_add_ref(struct page *page, struct user_beancounter *bc,
+		struct page_beancounter **ppb)
+{
+	struct page_beancounter *p, **hp;
+
+	spin_lock(pb_page_lock(page));
+	hp = page_pblist(page);
+	p = *hp;
+	if (p != NULL) {
+		BUG_ON(p->pb_magic != PB_MAGIC);
+		p->refcount++;
+		goto out_unlock;
+	}
+
+	p = *ppb;
+	*ppb = p->next_hash;
+	p->page = page;
+	p->ub = get_beancounter(bc);
+	p->refcount = 1;
+	INIT_LIST_HEAD(&p->page_list);
+	*hp = p;
+	inc_held_pages(bc, UB_PAGE_WEIGHT, 1);
+out_unlock:
+	spin_unlock(pb_page_lock(page));
+}
+
+static void pb_owner_dup_ref(struct page *page)
+{
+	struct page_beancounter *p;
+
+	spin_lock(pb_page_lock(page));
+	p = *page_pblist(page);
+	/* pages like ZERO_PAGE are not accounted */
+	if (p != NULL)
+		p->refcount++;
+	spin_unlock(pb_page_lock(page));
+}
+
+static void pb_owner_remove_ref(struct page *page)
+{
+	struct page_beancounter *p, **hp;
+
+	spin_lock(pb_page_lock(page));
+	hp = page_pblist(page);
+	p = *hp;
+	if (p == NULL || --p->refcount) {
+		spin_unlock(pb_page_lock(page));
+		return;
+	}
+
+	*hp = NULL;
+	dec_held_pages(p->ub, UB_PAGE_WEIGHT, 1);
+	spin_unlock(pb_page_lock(page));
+
+	put_beancounter(p->ub);
+	pb_free(&p);
 }
 
 void pb_add_ref(struct page *page, struct mm_struct *mm,
@@ -302,12 +393,17 @@ void pb_add_ref(struct page *page, struct mm_struct *mm,
 	if (!PageAnon(page) && is_shmem_mapping(page->mapping))
 		return;
 
+	if (pb_owner_mode) {
+		pb_owner_add_ref(page, bc, p_pb);
+		return;
+	}
+
 	hash = pb_hash(bc, page);
 
-	spin_lock(&pb_lock);
+	spin_lock(pb_page_lock(page));
 	if (__pb_dup_ref(page, bc, hash))
 		__pb_add_ref(page, bc, p_pb, hash);
-	spin_unlock(&pb_lock);
+	spin_unlock(pb_page_lock(page));
 }
 
 void pb_dup_ref(struct page *page, struct mm_struct *mm,
@@ -323,9 +419,14 @@ void pb_dup_ref(struct page *page, struct mm_struct *mm,
 	if (!PageAnon(page) && is_shmem_mapping(page->mapping))
 		return;
 
+	if (pb_owner_mode) {
+		pb_owner_dup_ref(page);
+		return;
+	}
+
 	hash = pb_hash(bc, page);
 
-	spin_lock(&pb_lock);
+	spin_lock(pb_page_lock(page));
 	if (*page_pblist(page) == NULL)
 		/*
 		 * pages like ZERO_PAGE must not be accounted in pbc
@@ -338,7 +439,7 @@ void pb_dup_ref(struct page *page, struct mm_struct *mm,
 	else if (unlikely(__pb_dup_ref(page, bc, hash)))
 		WARN_ON(1);
 out_unlock:
-	spin_unlock(&pb_lock);
+	spin_unlock(pb_page_lock(page));
 }
 
 void pb_remove_ref(struct page *page, struct mm_struct *mm)
@@ -355,9 +456,14 @@ void pb_remove_ref(struct page *page, struct mm_struct *mm)
 	if (!PageAnon(page) && is_shmem_mapping(page->mapping))
 		return;
 
+	if (pb_owner_mode) {
+		pb_owner_remove_ref(page);
+		return;
+	}
+
 	hash = pb_hash(bc, page);
 
-	spin_lock(&pb_lock);
+	spin_lock(pb_page_lock(page));
 	for (q = pb_hash_table + hash, p = *q;
 			p != NULL && (p->page != page || p->ub != bc);
 			q = &p->next_hash, p = *q);
@@ -378,7 +484,7 @@ void pb_remove_ref(struct page *page, struct mm_struct *mm)
 
 	shift = PB_SHIFT_GET(p->refcount);
 
-	dec_held_pages(p->ub, UB_PAGE_WEIGHT >> shift);
+	dec_held_pages(p->ub, UB_PAGE_WEIGHT >> shift, 1);
 
 	q = page_pblist(page);
 	if (*q == p) {
@@ -397,7 +503,7 @@ void pb_remove_ref(struct page *page, struct mm_struct *mm)
 	*q = p;
 	PB_SHIFT_DEC(p->refcount);
 
-	inc_held_pages(p->ub, UB_PAGE_WEIGHT >> shiftt);
+	inc_held_pages(p->ub, UB_PAGE_WEIGHT >> shiftt, 0);
 
 	/* 
 	 * If the shift counter of the moved beancounter is different from the
@@ -407,18 +513,17 @@ void pb_remove_ref(struct page *page, struct mm_struct *mm)
 		p = prev_page_pb(*q);
 		*q = p;
 		PB_SHIFT_DEC(p->refcount);
-		inc_held_pages(p->ub, UB_PAGE_WEIGHT >> shiftt);
+		inc_held_pages(p->ub, UB_PAGE_WEIGHT >> shiftt, 0);
 	}
 out_free:
-	dec_pbc_count(f->ub);
-	spin_unlock(&pb_lock);
+	spin_unlock(pb_page_lock(page));
 
 	put_beancounter(f->ub);
 	pb_free(&f);
 	return;
 
 out_unlock:
-	spin_unlock(&pb_lock);
+	spin_unlock(pb_page_lock(page));
 }
 
 struct user_beancounter *pb_grab_page_ub(struct page *page)
@@ -426,22 +531,128 @@ struct user_beancounter *pb_grab_page_ub(struct page *page)
 	struct page_beancounter *pb;
 	struct user_beancounter *ub;
 
-	spin_lock(&pb_lock);
+	spin_lock(pb_page_lock(page));
 	pb = *page_pblist(page);
 	ub = (pb == NULL ? ERR_PTR(-EINVAL) :
 			get_beancounter(pb->ub));
-	spin_unlock(&pb_lock);
+	spin_unlock(pb_page_lock(page));
 	return ub;
 }
 
+static inline int pb_in_ub(struct page_beancounter *pb,
+		struct user_beancounter *ub)
+{
+	struct user_beancounter *p;
+
+	for (p = pb->ub; p != NULL; p = p->parent)
+		if (p == ub)
+			return 1;
+	return 0;
+}
+
+/*
+ * Tells whether the page is mapped or was dirtied by the ub (or its
+ * sub-beancounters). Used by reclaim to pick the beancounter's pages.
+ */
+int pb_page_owned(struct page *page, struct user_beancounter *ub)
+{
+	struct page_beancounter *head, *pb;
+	int ret;
+
+	ret = 0;
+	spin_lock(pb_page_lock(page));
+#ifdef CONFIG_BC_IO_ACCOUNTING
+	pb = iopb_to_pb(page_pbc(page));
+	if (pb != NULL && pb_in_ub(pb, ub)) {
+		ret = 1;
+		goto out;
+	}
+#endif
+	head = *page_pblist(page);
+	if (head == NULL)
+		goto out;
+
+	pb = head;
+	do {
+		if (pb_in_ub(pb, ub)) {
+			ret = 1;
+			break;
+		}
+		pb = next_page_pb(pb);
+	} while (pb != head);
+out:
+	spin_unlock(pb_page_lock(page));
+	return ret;
+}
+
+/*
+ * Unmapped page cache has no pbs. It is attributed to the beancounter
+ * which added pages to the mapping last, the mapping holds a reference
+ * on it. Beancounters are freed via RCU, so the owner can be replaced
+ * under the readers.
+ */
+void ub_mapping_set_owner(struct address_space *mapping)
+{
+	struct user_beancounter *ub, *old;
+
+	ub = get_exec_ub();
+	if (likely(mapping->cache_ub == ub))
+		return;
+
+	old = xchg(&mapping->cache_ub, get_beancounter(ub));
+	if (old != NULL)
+		put_beancounter(old);
+}
+
+void ub_mapping_release(struct address_space *mapping)
+{
+	if (mapping->cache_ub != NULL) {
+		put_beancounter(mapping->cache_ub);
+		mapping->cache_ub = NULL;
+	}
+}
+
+/* The page is locked, so its mapping cannot go away */
+int ub_page_cache_owned(struct page *page, struct user_beancounter *ub)
+{
+	struct address_space *mapping;
+	struct user_beancounter *p;
+	int ret;
+
+	mapping = page->mapping;
+	if (mapping == NULL || PageAnon(page))
+		return 0;
+
+	ret = 0;
+	rcu_read_lock();
+	for (p = rcu_dereference(mapping->cache_ub); p != NULL; p = p->parent)
+		if (p == ub) {
+			ret = 1;
+			break;
+		}
+	rcu_read_unlock();
+	return ret;
+}
+
 void __init ub_init_pbc(void)
 {
 	unsigned long hash_size;
+	int i;
+
+	for (i = 0; i < PB_LOCKS; i++)
+		spin_lock_init(&pb_locks[i].lock);
 
 	pb_cachep = kmem_cache_create("page_beancounter", 
 			sizeof(struct page_beancounter), 0,
 			SLAB_HWCACHE_ALIGN | SLAB_PANIC, NULL);
-	hash_size = num_physpages >> 2;
+	if (pb_owner_mode) {
+		/* the hash is not used */
+		printk(KERN_INFO "Page beancounters charge pages "
+				"to the first mapper.\n");
+		goto out;
+	}
+
+	hash_size = max(num_physpages >> 2, (unsigned long)PB_LOCKS);
 	for (pb_hash_mask = 1;
 		(hash_size & pb_hash_mask) != hash_size;
 		pb_hash_mask = (pb_hash_mask << 1) + 1);
@@ -449,6 +660,6 @@ void __init ub_init_pbc(void)
 	printk(KERN_INFO "Page beancounter hash is %lu entries.\n", hash_size);
 	pb_hash_table = vmalloc(hash_size * sizeof(struct page_beancounter *));
 	memset(pb_hash_table, 0, hash_size * sizeof(struct page_beancounter *));
-
+out:
 	ub_init_io(pb_cachep);
 }
@@ -16,6 +16,10 @@
 #include <linux/errno.h>
 #include <linux/suspend.h>
 #include <linux/freezer.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/eventfd.h>
 
 #include <asm/uaccess.h>
 #include <asm/param.h>
@@ -23,8 +27,11 @@
 #include <bc/beancounter.h>
 #include <bc/hash.h>
 #include <bc/statd.h>
+#include <bc/kmem.h>
 
 static spinlock_t ubs_notify_lock = SPIN_LOCK_UNLOCKED;
+/* Protects ubs_*_time and ub_store of all beancounters for readers */
+static seqcount_t ubs_seq = SEQCNT_ZERO;
 static LIST_HEAD(ubs_notify_list);
 static long ubs_min_interval;
 static ubstattime_t ubs_start_time, ubs_end_time;
@@ -46,7 +53,7 @@ static int ubstat_get_list(void __user *buf, long size)
 	ptr = page;
 	end = page + PAGE_SIZE / sizeof(*ptr);
 
-	spin_lock_irq(&ub_hash_lock);
+	rcu_read_lock();
 	for_each_beancounter(ub) {
 		if (ub->parent != NULL)
 			continue;
@@ -54,8 +61,12 @@ static int ubstat_get_list(void __user *buf, long size)
 		if (ptr != end)
 			continue;
 
-		get_beancounter(ub);
-		spin_unlock_irq(&ub_hash_lock);
+		/* Referenced beancounter stays in the list */
+		if (get_beancounter_rcu(ub) == NULL) {
+			ptr--;
+			continue;
+		}
+		rcu_read_unlock();
 
 		put_beancounter(ubp);
 		ubp = ub;
@@ -74,9 +85,9 @@ static int ubstat_get_list(void __user *buf, long size)
 		ptr = page;
 		end = page + PAGE_SIZE / sizeof(*ptr);
 
-		spin_lock_irq(&ub_hash_lock);
+		rcu_read_lock();
 	}
-	spin_unlock_irq(&ub_hash_lock);
+	rcu_read_unlock();
 
 	put_beancounter(ubp);
 	size = min_t(long, (ptr - page) * sizeof(*ptr), size);
@@ -95,13 +106,16 @@ out_put:
 static int ubstat_gettime(void __user *buf, long size)
 {
 	ubgettime_t data;
+	unsigned seq;
 	int retval;
 
-	spin_lock(&ubs_notify_lock);
-	data.start_time = ubs_start_time;
-	data.end_time = ubs_end_time;
-	data.cur_time = ubs_start_time + (jiffies - ubs_start_time * HZ) / HZ;
-	spin_unlock(&ubs_notify_lock);
+	do {
+		seq = read_seqcount_begin(&ubs_seq);
+		data.start_time = ubs_start_time;
+		data.end_time = ubs_end_time;
+		data.cur_time = ubs_start_time +
+			(jiffies - ubs_start_time * HZ) / HZ;
+	} while (read_seqcount_retry(&ubs_seq, seq));
 
 	retval = min_t(long, sizeof(data), size);
 	if (copy_to_user(buf, &data, retval))
@@ -186,13 +200,15 @@ static int ubstat_get_stat(struct user_beancounter *ub, long cmd,
 		void __user *buf, long size)
 {
 	void *kbuf;
+	unsigned seq;
 	int retval;
 
 	kbuf = (void *)__get_free_page(GFP_KERNEL);
 	if (kbuf == NULL)
 		return -ENOMEM;
 
-	spin_lock(&ubs_notify_lock);
+again:
+	seq = read_seqcount_begin(&ubs_seq);
 	switch (UBSTAT_CMD(cmd)) {
 		case UBSTAT_READ_ONE:
 			retval = -EINVAL;
@@ -210,7 +226,8 @@ static int ubstat_get_stat(struct user_beancounter *ub, long cmd,
 		default:
 			retval = -EINVAL;
 	}
-	spin_unlock(&ubs_notify_lock);
+	if (read_seqcount_retry(&ubs_seq, seq))
+		goto again;
 
 	if (retval > 0) {
 		retval = min_t(long, retval, size);
@@ -222,6 +239,91 @@ static int ubstat_get_stat(struct user_beancounter *ub, long cmd,
 	return retval;
 }
 
+static int ubstat_accessible(struct user_beancounter *exec,
+		struct user_beancounter *target)
+{
+	struct user_beancounter *p;
+
+	p = top_beancounter(exec);
+	return p == get_ub0() || p == target;
+}
+
+static void ubstat_fill_bulk(struct user_beancounter *ub, ubstatbulk_t *rec)
+{
+	int resource;
+
+	rec->uid = ub->ub_uid;
+	rec->__unused = 0;
+	for (resource = 0; resource < UB_RESOURCES; resource++) {
+		ubstatparmf_t *p = &rec->param[resource];
+		struct ubparm *u = &ub->ub_parms[resource];
+
+		p->barrier = u->barrier;
+		p->limit = u->limit;
+		p->held = ub_held(ub, resource);
+		p->maxheld = u->maxheld;
+		p->minheld = u->minheld;
+		p->failcnt = u->failcnt;
+		p->__unused1 = 0;
+		p->__unused2 = 0;
+	}
+}
+
+/*
+ * One call for all beancounters. Neither ub_hash_lock, nor ub_lock
+ * is taken, the list is walked under RCU.
+ */
+static int ubstat_get_bulk(void __user *buf, long size)
+{
+	struct user_beancounter *ub, *ubp, *exec_ub;
+	ubstatbulk_t *rec;
+	int len, retval;
+
+	len = sizeof(*rec) + UB_RESOURCES * sizeof(ubstatparmf_t);
+	rec = kmalloc(len, GFP_KERNEL);
+	if (rec == NULL)
+		return -ENOMEM;
+
+	exec_ub = get_exec_ub();
+	retval = 0;
+	ubp = NULL;
+
+	rcu_read_lock();
+	for_each_beancounter(ub) {
+		if (ub->parent != NULL)
+			continue;
+		if (!ubstat_accessible(exec_ub, ub))
+			continue;
+		if (size < len) {
+			retval = -ENOSPC;
+			break;
+		}
+		if (get_beancounter_rcu(ub) == NULL)
+			continue;
+		rcu_read_unlock();
+
+		put_beancounter(ubp);
+		ubp = ub;
+
+		ubstat_fill_bulk(ub, rec);
+		if (copy_to_user(buf, rec, len)) {
+			retval = -EFAULT;
+			goto out_put;
+		}
+		buf += len;
+		size -= len;
+		retval += len;
+
+		rcu_read_lock();
+	}
+	rcu_read_unlock();
+
+out_put:
+	put_beancounter(ubp);
+	kfree(rec);
+	return retval;
+}
+
 static int ubstat_handle_notifrq(ubnotifrq_t *req)
 {
 	int retval;
@@ -283,6 +385,182 @@ out_unlock:
 	return retval;
 }
 
+/*
+ * Event notifications. Checked right from the charge/uncharge paths
+ * under ub_lock, so nothing is polled and the latency does not depend
+ * on ubstatd interval.
+ */
+
+static unsigned long ub_event_threshold(struct user_beancounter *ub,
+		struct ub_event *ev)
+{
+	unsigned long val;
+
+	if (ev->type == UBSTAT_EV_BARRIER)
+		val = ub->ub_parms[ev->resource].barrier;
+	else
+		val = ub->ub_parms[ev->resource].limit;
+	if (val == UB_MAXVALUE)
+		return UB_MAXVALUE;
+	return val / 100 * ev->percent + val % 100 * ev->percent / 100;
+}
+
+void __ub_check_events(struct user_beancounter *ub, int resource, int failed)
+{
+	struct ub_event *ev;
+	unsigned long held;
+
+	held = ub->ub_parms[resource].held;
+	list_for_each_entry(ev, &ub->ub_events, list) {
+		if (ev->resource != resource)
+			continue;
+
+		if (ev->type == UBSTAT_EV_FAILCNT) {
+			if (failed)
+				eventfd_signal(ev->ctx, 1);
+			continue;
+		}
+
+		if (held < ub_event_threshold(ub, ev))
+			ev->armed = 1;
+		else if (ev->armed) {
+			ev->armed = 0;
+			eventfd_signal(ev->ctx, 1);
+		}
+	}
+}
+
+static void ub_events_recalc_mask(struct user_beancounter *ub)
+{
+	struct ub_event *ev;
+
+	ub->ub_event_mask = 0;
+	list_for_each_entry(ev, &ub->ub_events, list)
+		__set_bit(ev->resource, &ub->ub_event_mask);
+}
+
+static int ubstat_event_add(struct user_beancounter *ub,
+		ubstatevent_t *req)
+{
+	struct ub_event *ev;
+	struct eventfd_ctx *ctx;
+	unsigned long flags;
+	int err;
+
+	if (req->resource >= UB_RESOURCES)
+		return -EINVAL;
+	if (req->type > UBSTAT_EV_LIMIT)
+		return -EINVAL;
+	if (req->type != UBSTAT_EV_FAILCNT &&
+			(req->percent == 0 || req->percent > 100))
+		return -EINVAL;
+	/* events are checked in the charge paths of the container */
+	if (!ve_is_super(get_exec_env()) || !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	/* charged to the kmemsize of the caller, not of the monitored ub */
+	ev = kmalloc(sizeof(*ev), GFP_KERNEL_UBC);
+	if (ev == NULL)
+		return -ENOMEM;
+
+	ctx = eventfd_ctx_fdget(req->eventfd);
+	if (IS_ERR(ctx)) {
+		err = PTR_ERR(ctx);
+		goto out_free;
+	}
+
+	ev->ctx = ctx;
+	ev->resource = req->resource;
+	ev->type = req->type;
+	ev->percent = req->percent;
+	ev->armed = 1;
+
+	spin_lock_irqsave(&ub->ub_lock, flags);
+	if (ub->ub_nr_events >= UB_EVENTS_MAX) {
+		spin_unlock_irqrestore(&ub->ub_lock, flags);
+		eventfd_ctx_put(ctx);
+		err = -ENOSPC;
+		goto out_free;
+	}
+	ub->ub_nr_events++;
+	list_add_tail(&ev->list, &ub->ub_events);
+	set_bit(ev->resource, &ub->ub_event_mask);
+	/* fire at once if we are already above the threshold */
+	if (ev->type != UBSTAT_EV_FAILCNT)
+		__ub_check_events(ub, ev->resource, 0);
+	spin_unlock_irqrestore(&ub->ub_lock, flags);
+	return 0;
+
+out_free:
+	kfree(ev);
+	return err;
+}
+
+static int ubstat_event_del(struct user_beancounter *ub,
+		ubstatevent_t *req)
+{
+	struct ub_event *ev, *tmp;
+	struct eventfd_ctx *ctx;
+	unsigned long flags;
+	LIST_HEAD(dead);
+
+	ctx = eventfd_ctx_fdget(req->eventfd);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	spin_lock_irqsave(&ub->ub_lock, flags);
+	list_for_each_entry_safe(ev, tmp, &ub->ub_events, list) {
+		if (ev->ctx != ctx || ev->resource != req->resource ||
+				ev->type != req->type)
+			continue;
+		list_move(&ev->list, &dead);
+		ub->ub_nr_events--;
+	}
+	ub_events_recalc_mask(ub);
+	spin_unlock_irqrestore(&ub->ub_lock, flags);
+	eventfd_ctx_put(ctx);
+
+	if (list_empty(&dead))
+		return -ENOENT;
+
+	list_for_each_entry_safe(ev, tmp, &dead, list) {
+		eventfd_ctx_put(ev->ctx);
+		kfree(ev);
+	}
+	return 0;
+}
+
+static int ubstat_handle_event(struct user_beancounter *ub, long cmd,
+		void __user *buf, long size)
+{
+	ubstatevent_t req;
+
+	if (!ubstat_accessible(get_exec_ub(), ub))
+		return -EPERM;
+	if (size < sizeof(req))
+		return -EINVAL;
+	if (copy_from_user(&req, buf, sizeof(req)))
+		return -EFAULT;
+
+	if (UBSTAT_CMD(cmd) == UBSTAT_EVENT_ADD)
+		return ubstat_event_add(ub, &req);
+	return ubstat_event_del(ub, &req);
+}
+
+/* called on the last put, nobody can charge the ub any longer */
+void ub_events_release(struct user_beancounter *ub)
+{
+	struct ub_event *ev, *tmp;
+
+	list_for_each_entry_safe(ev, tmp, &ub->ub_events, list) {
+		list_del(&ev->list);
+		eventfd_ctx_put(ev->ctx);
+		kfree(ev);
+	}
+	ub->ub_nr_events = 0;
+	ub->ub_event_mask = 0;
+}
+
 /*
  * former sys_ubstat
  */
@@ -303,6 +581,10 @@ long do_ubstat(int func, unsigned long arg1, unsigned long arg2,
 		retval = ubstat_gettime(buf, size);
 		goto notify;
 	}
+	if (func == UBSTAT_READ_BULK) {
+		retval = ubstat_get_bulk(buf, size);
+		goto notify;
+	}
 
 	ub = get_exec_ub();
 	if (ub != NULL && ub->ub_uid == arg1)
@@ -313,6 +595,13 @@ long do_ubstat(int func, unsigned long arg1, unsigned long arg2,
 	if (ub == NULL)
 		return -ESRCH;
 
+	if (UBSTAT_CMD(func) == UBSTAT_EVENT_ADD ||
+			UBSTAT_CMD(func) == UBSTAT_EVENT_DEL) {
+		retval = ubstat_handle_event(ub, func, buf, size);
+		put_beancounter(ub);
+		return retval;
+	}
+
 	retval = ubstat_get_stat(ub, func, buf, size);
 	put_beancounter(ub);
 notify:
@@ -385,6 +674,7 @@ static inline void do_notifies(void)
 	struct ub_stat_notify *tmp;
 
 	spin_lock(&ubs_notify_lock);
+	write_seqcount_begin(&ubs_seq);
 	ubs_start_time = ubs_end_time;
 	/*
 	 * the expression below relies on time being unsigned long and
@@ -395,6 +685,7 @@ static inline void do_notifies(void)
 	ubs_min_interval = TIME_MAX_SEC;
 	/* save statistics accumulated for the interval */
 	ubstat_save_statistics();
+	write_seqcount_end(&ubs_seq);
 	/* send signals */
 	read_lock(&tasklist_lock);
 	while (!list_empty(&ubs_notify_list)) {
@@ -118,6 +118,8 @@ long do_setublimit(uid_t uid, unsigned long resource,
 	ub->ub_parms[resource].barrier = new_limits[0];
 	ub->ub_parms[resource].limit = new_limits[1];
 	spin_unlock_irqrestore(&ub->ub_lock, flags);
+	/* precharges taken under old limits can exceed new ones */
+	ub_precharge_drain(ub, resource);
 
 	put_beancounter(ub);
 
@@ -15,6 +15,9 @@
 #include <linux/shmem_fs.h>
 #include <linux/vmalloc.h>
 #include <linux/init.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
+#include <linux/err.h>
 
 #include <asm/pgtable.h>
 #include <asm/page.h>
@@ -95,11 +98,100 @@ unsigned long pages_in_vma_range(struct vm_area_struct *vma,
 	return ret;
 }
 
+#ifdef CONFIG_BC_RSS_ACCOUNTING
+static struct workqueue_struct *ub_reclaim_wq;
+
+/*
+ * A pass which frees nothing is not repeated at once: the next one is
+ * started by a physpages update no earlier than ub_reclaim_delay later,
+ * and the delay doubles on every fruitless pass.
+ */
+#define UB_RECLAIM_MIN_DELAY	(HZ / 10)
+#define UB_RECLAIM_MAX_DELAY	(10 * HZ)
+
+static void ub_start_reclaim(struct user_beancounter *ub);
+
+static unsigned long ub_reclaim_target(struct user_beancounter *ub)
+{
+	unsigned long target;
+
+	target = ub->ub_parms[UB_PHYSPAGES].limit;
+	if (ub->ub_parms[UB_PHYSPAGES].barrier != 0 &&
+			ub->ub_parms[UB_PHYSPAGES].barrier < target)
+		target = ub->ub_parms[UB_PHYSPAGES].barrier;
+	return target;
+}
+
+/* Shrink the container's own pages down to the barrier, or the limit */
+static void ub_reclaim_work_fn(struct work_struct *work)
+{
+	struct user_beancounter *ub;
+	unsigned long held, target, freed;
+	unsigned long flags;
+
+	ub = container_of(work, struct user_beancounter, ub_reclaim_work.work);
+
+	held = ub->ub_parms[UB_PHYSPAGES].held;
+	target = ub_reclaim_target(ub);
+	freed = 0;
+	if (held > target)
+		freed = try_to_free_ub_pages(ub, GFP_KERNEL,
+				held - target, false);
+
+	spin_lock_irqsave(&ub->ub_lock, flags);
+	if (freed) {
+		ub->ub_reclaim_delay = 0;
+		/* made progress, go on while still over the limit */
+		if (ub->ub_parms[UB_PHYSPAGES].held >
+				ub->ub_parms[UB_PHYSPAGES].limit)
+			ub_start_reclaim(ub);
+	} else if (held > target)
+		ub->ub_reclaim_delay = clamp(ub->ub_reclaim_delay * 2,
+				(unsigned long)UB_RECLAIM_MIN_DELAY,
+				(unsigned long)UB_RECLAIM_MAX_DELAY);
+	spin_unlock_irqrestore(&ub->ub_lock, flags);
+
+	put_beancounter(ub);
+}
+
+/* Called under ub_lock */
+static void ub_start_reclaim(struct user_beancounter *ub)
+{
+	if (ub_reclaim_wq == NULL || delayed_work_pending(&ub->ub_reclaim_work))
+		return;
+
+	get_beancounter(ub);
+	if (!queue_delayed_work(ub_reclaim_wq, &ub->ub_reclaim_work,
+				ub->ub_reclaim_delay))
+		__put_beancounter_batch(ub, 1);
+}
+
+void ub_init_reclaim(struct user_beancounter *ub)
+{
+	INIT_DELAYED_WORK(&ub->ub_reclaim_work, ub_reclaim_work_fn);
+	ub->ub_reclaim_delay = 0;
+}
+
+static int __init ub_reclaim_init(void)
+{
+	ub_reclaim_wq = create_singlethread_workqueue("ubreclaim");
+	return ub_reclaim_wq == NULL ? -ENOMEM : 0;
+}
+__initcall(ub_reclaim_init);
+#else
+static inline void ub_start_reclaim(struct user_beancounter *ub) { }
+void ub_init_reclaim(struct user_beancounter *ub) { }
+#endif
+
 void __ub_update_physpages(struct user_beancounter *ub)
 {
 	ub->ub_parms[UB_PHYSPAGES].held = ub->ub_tmpfs_respages
 		+ (ub->ub_held_pages >> UB_PAGE_WEIGHT_SHIFT);
 	ub_adjust_maxheld(ub, UB_PHYSPAGES);
+
+	if (unlikely(ub->ub_parms[UB_PHYSPAGES].held >
+				ub->ub_parms[UB_PHYSPAGES].limit))
+		ub_start_reclaim(ub);
 }
 
 void __ub_update_oomguarpages(struct user_beancounter *ub)
@@ -444,6 +536,41 @@ void ub_swapentry_dec(struct swap_info_struct *si, pgoff_t num)
 }
 EXPORT_SYMBOL(ub_swapentry_dec);
 
+/*
+ * Pages kept compressed in memory by zswap still own their swap entry
+ * and are thus charged to swappages together with it. The @size bytes
+ * of compressed data are kernel memory and are charged to kmemsize.
+ * Beancounters over the swappages limit are not allowed to occupy the
+ * shared pool, their pages go straight to the device.
+ */
+struct user_beancounter *ub_swapcache_charge(struct swap_info_struct *si,
+		pgoff_t num, unsigned long size)
+{
+	struct user_beancounter *ub;
+
+	ub = si->swap_ubs[num];
+	if (ub == NULL)
+		return NULL;
+	if (ub->ub_parms[UB_SWAPPAGES].held >
+			ub->ub_parms[UB_SWAPPAGES].limit)
+		return ERR_PTR(-ENOSPC);
+	if (charge_beancounter(ub, UB_KMEMSIZE, size, UB_HARD))
+		return ERR_PTR(-ENOMEM);
+
+	ub_percpu_inc(ub, zswap);
+	return get_beancounter(ub);
+}
+
+void ub_swapcache_uncharge(struct user_beancounter *ub, unsigned long size)
+{
+	if (ub == NULL)
+		return;
+
+	uncharge_beancounter(ub, UB_KMEMSIZE, size);
+	ub_percpu_dec(ub, zswap);
+	put_beancounter(ub);
+}
+
 int ub_swap_init(struct swap_info_struct *si, pgoff_t num)
 {
 	struct user_beancounter **ubs;
@@ -510,15 +637,17 @@ module_exit(fini_vmguar_notifier);
 static int bc_vmaux_show(struct seq_file *f, void *v)
 {
 	struct user_beancounter *ub;
-	unsigned long swap, unmap;
+	unsigned long swap, unmap, reclaimed, zswap;
 	int i;
 
 	ub = seq_beancounter(f);
 
-	swap = unmap = 0;
+	swap = unmap = reclaimed = zswap = 0;
 	for_each_online_cpu(i) {
 		swap += per_cpu_ptr(ub->ub_percpu, i)->swapin;
 		unmap += per_cpu_ptr(ub->ub_percpu, i)->unmap;
+		reclaimed += per_cpu_ptr(ub->ub_percpu, i)->reclaimed;
+		zswap += per_cpu_ptr(ub->ub_percpu, i)->zswap;
 	}
 
 	seq_printf(f, bc_proc_lu_fmt, ub_rnames[UB_UNUSEDPRIVVM],
@@ -529,6 +658,8 @@ static int bc_vmaux_show(struct seq_file *f, void *v)
 
 	seq_printf(f, bc_proc_lu_fmt, "swapin", swap);
 	seq_printf(f, bc_proc_lu_fmt, "unmap", unmap);
+	seq_printf(f, bc_proc_lu_fmt, "reclaimed", reclaimed);
+	seq_printf(f, bc_proc_lu_fmt, "zswap", zswap);
 	return 0;
 }
 static struct bc_proc_entry bc_vmaux_entry = {
@@ -6,6 +6,7 @@
 #include <linux/seq_file.h>
 #include <linux/fs.h>
 #include <linux/ve.h>
+#include <linux/ve_proto.h>
 #include <linux/proc_fs.h>
 #include <linux/module.h>
 
@@ -144,8 +145,8 @@ int init_ve_cgroups(struct ve_struct *ve)
 		goto err_subsys;
 
 	g->parent = &init_cgroup;
-	ve->ve_cgroup = g;
 	ve->ve_css_set = cs;
+	ve_set_cgroup(ve, g);
 	return 0;
 
 err_subsys:
@@ -165,6 +166,9 @@ void fini_ve_cgroups(struct ve_struct *ve)
 	struct cgroup *g = ve->ve_cgroup;
 	struct css_set *css = ve->ve_css_set;
 
+	/* __ve_cgroup_by_id() users must not see the cgroup any longer */
+	ve_set_cgroup(ve, NULL);
+
 	for (i = 0; i < CGROUP_SUBSYS_COUNT; i++) {
 		struct cgroup_subsys *cs = subsys[i];
 		struct cgroup_subsys_state *ss = css->subsys[i];
@@ -184,7 +188,6 @@ void fini_ve_cgroups(struct ve_struct *ve)
 	fini_cgroup_id(g);
 	kfree(g);
 	kfree(css);
-	ve->ve_cgroup = NULL;
 	ve->ve_css_set = NULL;
 }
 EXPORT_SYMBOL(fini_ve_cgroups);
@@ -19,15 +19,26 @@
 #include <linux/mm.h>
 #include <linux/errno.h>
 #include <linux/pagemap.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
 
 #include <linux/cpt_image.h>
 #include <linux/cpt_export.h>
 
 #include "cpt_obj.h"
 #include "cpt_context.h"
+#include "cpt_mm.h"
 
 
-static void file_write(const void *addr, size_t count, struct cpt_context *ctx)
+/*
+ * Dump file is written through a large buffer. file->f_pos is the logical
+ * position and the buffer holds data of [wbuf_pos, f_pos). Object headers
+ * are patched by pwrite() mostly while they are still in the buffer.
+ */
+#define CPT_WBUF_SIZE	(512*1024)
+
+static void __file_pwrite(const void *addr, size_t count,
+			  struct cpt_context *ctx, loff_t pos)
 {
 	mm_segment_t oldfs;
 	ssize_t err = -EBADF;
@@ -35,32 +46,99 @@ static void file_write(const void *addr, size_t count, struct cpt_context *ctx)
 
 	oldfs = get_fs(); set_fs(KERNEL_DS);
 	if (file)
-		err = file->f_op->write(file, addr, count, &file->f_pos);
+		err = file->f_op->write(file, addr, count, &pos);
 	set_fs(oldfs);
 	if (err != count && !ctx->write_error)
 		ctx->write_error = err < 0 ? err : -EIO;
 }
 
-static void file_pwrite(void *addr, size_t count, struct cpt_context *ctx, loff_t pos)
+static void file_flush(struct cpt_context *ctx)
+{
+	if (ctx->wbuf_len) {
+		__file_pwrite(ctx->wbuf, ctx->wbuf_len, ctx, ctx->wbuf_pos);
+		ctx->wbuf_len = 0;
+	}
+}
+
+static void file_write(const void *addr, size_t count, struct cpt_context *ctx)
 {
 	mm_segment_t oldfs;
 	ssize_t err = -EBADF;
 	struct file *file = ctx->file;
 
+	if (file && ctx->wbuf) {
+		while (count) {
+			size_t n = min(count, CPT_WBUF_SIZE - ctx->wbuf_len);
+
+			if (ctx->wbuf_len == 0)
+				ctx->wbuf_pos = file->f_pos;
+			memcpy(ctx->wbuf + ctx->wbuf_len, addr, n);
+			ctx->wbuf_len += n;
+			file->f_pos += n;
+			addr += n;
+			count -= n;
+			if (ctx->wbuf_len == CPT_WBUF_SIZE)
+				file_flush(ctx);
+		}
+		return;
+	}
+
 	oldfs = get_fs(); set_fs(KERNEL_DS);
 	if (file)
-		err = file->f_op->write(file, addr, count, &pos);
+		err = file->f_op->write(file, addr, count, &file->f_pos);
 	set_fs(oldfs);
 	if (err != count && !ctx->write_error)
 		ctx->write_error = err < 0 ? err : -EIO;
 }
 
+static void file_pwrite(void *addr, size_t count, struct cpt_context *ctx, loff_t pos)
+{
+	if (ctx->wbuf_len) {
+		loff_t end = ctx->wbuf_pos + ctx->wbuf_len;
+
+		if (pos >= ctx->wbuf_pos && pos + count <= end) {
+			memcpy(ctx->wbuf + (pos - ctx->wbuf_pos), addr, count);
+			return;
+		}
+		if (pos < end && pos + count > ctx->wbuf_pos)
+			file_flush(ctx);
+	}
+	__file_pwrite(addr, count, ctx, pos);
+}
+
+/* Moves the logical position of the dump file. The buffered data is
+ * flushed first, otherwise it would be written at the new position.
+ * f_pos of the dump file must not be changed in any other way.
+ */
+void cpt_seek(loff_t pos, struct cpt_context *ctx)
+{
+	file_flush(ctx);
+	ctx->file->f_pos = pos;
+}
+
+/* Skips @size bytes of the dump file, they are filled later with pwrite()
+ * bypassing the buffer. So, the buffer must not cover the hole.
+ */
+loff_t cpt_reserve_space(size_t size, struct cpt_context *ctx)
+{
+	loff_t pos = ctx->file->f_pos;
+
+	cpt_seek(pos + size, ctx);
+	return pos;
+}
+
 static void file_align(struct cpt_context *ctx)
 {
+	static const char zeros[8];
 	struct file *file = ctx->file;
 
-	if (file)
-		file->f_pos = CPT_ALIGN(file->f_pos);
+	if (file == NULL)
+		return;
+	/* Hole in the middle of the buffer must be filled */
+	if (ctx->wbuf_len)
+		file_write(zeros, CPT_ALIGN(file->f_pos) - file->f_pos, ctx);
+	else
+		cpt_seek(CPT_ALIGN(file->f_pos), ctx);
 }
 
 static void cpt_push(loff_t *p, struct cpt_context *ctx)
@@ -113,17 +191,52 @@ void cpt_context_init(struct cpt_context *ctx)
 	cpt_object_init(ctx);
 }
 
+static void cpt_free_lzo(struct cpt_context *ctx)
+{
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	vfree(ctx->lzo_wrkmem);
+	ctx->lzo_wrkmem = NULL;
+	kfree(ctx->lzo_buf);
+	ctx->lzo_buf = NULL;
+#endif
+}
+
 int cpt_open_dumpfile(struct cpt_context *ctx)
 {
 	ctx->tmpbuf = (char*)__get_free_page(GFP_KERNEL);
 	if (ctx->tmpbuf == NULL)
 		return -ENOMEM;
 	__cpt_release_buf(ctx);
+
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	if (ctx->compress) {
+		ctx->lzo_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+		ctx->lzo_buf = kmalloc(lzo1x_worst_compress(PAGE_SIZE),
+				       GFP_KERNEL);
+		if (ctx->lzo_wrkmem == NULL || ctx->lzo_buf == NULL) {
+			cpt_free_lzo(ctx);
+			free_page((unsigned long)ctx->tmpbuf);
+			ctx->tmpbuf = NULL;
+			return -ENOMEM;
+		}
+	}
+#endif
+
+	/* Not fatal, the file is written directly then */
+	ctx->wbuf = vmalloc(CPT_WBUF_SIZE);
+	ctx->wbuf_len = 0;
 	return 0;
 }
 
 int cpt_close_dumpfile(struct cpt_context *ctx)
 {
+	cpt_stop_page_workers(ctx);
+	if (ctx->wbuf) {
+		file_flush(ctx);
+		vfree(ctx->wbuf);
+		ctx->wbuf = NULL;
+	}
+	cpt_free_lzo(ctx);
 	if (ctx->file) {
 		fput(ctx->file);
 		ctx->file = NULL;
@@ -260,6 +373,11 @@ int cpt_dump_tail(struct cpt_context *ctx)
 	if (ctx->file == NULL)
 		return 0;
 
+	/* Page contents of the image must be complete before the trailer */
+	cpt_stop_page_workers(ctx);
+	if (ctx->write_error)
+		return ctx->write_error;
+
 	cpt_open_section(ctx, CPT_SECT_TRAILER);
 	memset(&hdr, 0, sizeof(hdr));
 	hdr.cpt_next = sizeof(hdr);
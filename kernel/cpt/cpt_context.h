@@ -34,6 +34,17 @@ typedef struct cpt_context
 	struct file	*file;
 	char		*tmpbuf;
 	int		pagesize;
+	char		*wbuf;		/* write-behind buffer of dump file */
+	size_t		wbuf_len;
+	loff_t		wbuf_pos;
+	struct cpt_page_workers	*pgdump;
+	struct cpt_dedup	*dedup;
+	int		dedup_pages;	/* CPT_OBJ_DUPPAGES may be dumped */
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	int		compress;
+	void		*lzo_buf;
+	void		*lzo_wrkmem;
+#endif
 #ifdef CONFIG_VZ_CHECKPOINT_ITER
 	int		iter_done;
 	void		*iter_dir;
@@ -80,6 +91,7 @@ typedef struct cpt_context
 	struct task_struct	*pgin_task;
 	unsigned long	last_pagein;
 	struct pagein_desc	**pgin_dir;
+	int		pgin_dir_size;
 	struct pgin_device	*pagein_dev;
 	struct completion	pgin_notify;
 	struct completion	*pgind_completion;
@@ -136,6 +148,8 @@ void rst_report_error(int err, cpt_context_t *ctx);
 
 int cpt_major_hdr_out(struct cpt_context *ctx);
 int cpt_dump_tail(struct cpt_context *ctx);
+void cpt_seek(loff_t pos, struct cpt_context *ctx);
+loff_t cpt_reserve_space(size_t size, struct cpt_context *ctx);
 int cpt_close_section(struct cpt_context *ctx);
 int cpt_open_section(struct cpt_context *ctx, __u32 type);
 int cpt_close_object(struct cpt_context *ctx);
@@ -0,0 +1,292 @@
+/*
+ *
+ *  kernel/cpt/cpt_iterative.c
+ *
+ *  Copyright (C) 2000-2005  SWsoft
+ *  All rights reserved.
+ *
+ *  Licensing governed by "linux/COPYING.SWsoft" file.
+ *
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/ksm.h>
+#include <linux/errno.h>
+#include <linux/ve.h>
+#include <linux/ve_proto.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <asm/tlbflush.h>
+#include <linux/cpt_image.h>
+
+#include "cpt_obj.h"
+#include "cpt_context.h"
+#include "cpt_mm.h"
+
+/*
+ * Iterative transfer of memory while VE is still running.
+ *
+ * Each round walks all anonymous pages of VE, which do not have
+ * PG_checkpointed set, marks them, write protects their ptes and
+ * sends their contents together with pfn. Any subsequent write to such
+ * page goes through do_wp_page(), which either clears PG_checkpointed
+ * (page is reused) or COWs it to a new unmarked page. Unmapping
+ * the page clears the flag as well. So, at the moment of the final dump
+ * a page, which is still marked, has the same contents as was sent and
+ * cpt_dump_vm() refers to it by pfn (CPT_OBJ_ITERPAGES) instead
+ * of copying it. Only the residual dirty set is copied while VE is
+ * frozen.
+ *
+ * Rounds are repeated until the dirty set is small or stops shrinking
+ * (the VE dirties memory as fast as we send it), or the limit
+ * of rounds is hit.
+ */
+
+#define CPT_ITER_MAX_ROUNDS	8
+/* The dirty set is small enough to be sent with VE frozen (4MB) */
+#define CPT_ITER_MIN_PAGES	(4*1024*1024/PAGE_SIZE)
+/* Round is not productive, unless it shrinks dirty set by 1/8 */
+#define CPT_ITER_CONVERGE(sent, prev)	((sent) <= (prev) - ((prev) >> 3))
+
+#define CPT_ITER_BATCH		16
+
+struct iter_round
+{
+	int		resend;
+	unsigned long	sent;
+	unsigned long	skipped;
+};
+
+static int iter_skip_vma(struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & (VM_IO|VM_PFNMAP|VM_HUGETLB|VM_SHARED|VM_MAYSHARE))
+		return 1;
+	return vma->anon_vma == NULL;
+}
+
+static void iter_send_page(struct page *pg, cpt_context_t *ctx)
+{
+	struct cpt_iterpage_hdr h;
+	char *maddr;
+
+	h.cpt_pfn = page_to_pfn(pg);
+	h.cpt_flags = 0;
+	h.__cpt_pad1 = 0;
+	ctx->write(&h, sizeof(h), ctx);
+
+	maddr = kmap(pg);
+	ctx->write(maddr, PAGE_SIZE, ctx);
+	kunmap(pg);
+}
+
+static int iter_one_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+			unsigned long addr, unsigned long end,
+			struct iter_round *r, cpt_context_t *ctx)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *batch[CPT_ITER_BATCH];
+
+	while (addr < end) {
+		unsigned long start = addr;
+		pte_t *pte;
+		spinlock_t *ptl;
+		int n = 0, i;
+
+		pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+		for ( ; addr < end && n < CPT_ITER_BATCH; addr += PAGE_SIZE, pte++) {
+			pte_t ptent = *pte;
+			struct page *pg;
+
+			if (!pte_present(ptent))
+				continue;
+			pg = vm_normal_page(vma, addr, ptent);
+			if (pg == NULL || !PageAnon(pg) || PageKsm(pg))
+				continue;
+			if (!r->resend && PageCheckpointed(pg))
+				continue;
+			/* Somebody (f.e. direct IO) holds the page and can
+			 * change it bypassing ptes. Leave it to the final dump.
+			 */
+			if (page_count(pg) != page_mapcount(pg) +
+			    !!PageSwapCache(pg)) {
+				r->skipped++;
+				continue;
+			}
+
+			get_page(pg);
+			SetPageCheckpointed(pg);
+			if (pte_write(ptent))
+				ptep_set_wrprotect(mm, addr, pte);
+			batch[n++] = pg;
+		}
+		pte_unmap_unlock(pte - 1, ptl);
+
+		if (n == 0)
+			continue;
+
+		/* Page contents are read after the flush, so that any write
+		 * after this point either faults or is caught by the copy.
+		 */
+		flush_tlb_range(vma, start, addr);
+
+		for (i = 0; i < n; i++) {
+			iter_send_page(batch[i], ctx);
+			put_page(batch[i]);
+		}
+		r->sent += n;
+
+		if (ctx->write_error)
+			return ctx->write_error;
+		if (signal_pending(current))
+			return -EINTR;
+		cond_resched();
+	}
+	return 0;
+}
+
+static int iter_one_vma(struct vm_area_struct *vma, struct iter_round *r,
+			cpt_context_t *ctx)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr, next;
+	int err = 0;
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr = next) {
+		pgd_t *pgd;
+		pud_t *pud;
+		pmd_t *pmd;
+
+		next = pmd_addr_end(addr, vma->vm_end);
+
+		pgd = pgd_offset(mm, addr);
+		if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+			continue;
+		pud = pud_offset(pgd, addr);
+		if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+			continue;
+		pmd = pmd_offset(pud, addr);
+		if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd)))
+			continue;
+
+		err = iter_one_pmd(vma, pmd, addr, next, r, ctx);
+		if (err)
+			break;
+	}
+	return err;
+}
+
+static int iter_one_round(struct list_head *mms, struct iter_round *r,
+			  cpt_context_t *ctx)
+{
+	struct cpt_iterpage_hdr h;
+	struct cpt_ve_mm *im;
+	int err = 0;
+
+	list_for_each_entry(im, mms, list) {
+		struct mm_struct *mm = im->mm;
+		struct vm_area_struct *vma;
+
+		down_read(&mm->mmap_sem);
+		for (vma = mm->mmap; vma; vma = vma->vm_next) {
+			if (iter_skip_vma(vma))
+				continue;
+			err = iter_one_vma(vma, r, ctx);
+			if (err)
+				break;
+		}
+		up_read(&mm->mmap_sem);
+		if (err)
+			return err;
+	}
+
+	h.cpt_pfn = CPT_NULL;
+	h.cpt_flags = 0;
+	h.__cpt_pad1 = 0;
+	ctx->write(&h, sizeof(h), ctx);
+	return ctx->write_error;
+}
+
+static int iter_close_stream(cpt_context_t *ctx)
+{
+	struct cpt_iterpage_hdr h;
+
+	h.cpt_pfn = CPT_NULL;
+	h.cpt_flags = CPT_ITER_LAST;
+	h.__cpt_pad1 = 0;
+	ctx->write(&h, sizeof(h), ctx);
+	return ctx->write_error;
+}
+
+/*
+ * CPT_ITER: @rounds is the maximal number of rounds, 0 means default.
+ * The first iteration on a context resends all the pages, marks left
+ * from an aborted migration are meaningless for the new destination.
+ */
+int cpt_iteration(cpt_context_t *ctx, int rounds)
+{
+	struct ve_struct *env, *oldenv;
+	struct iter_round r;
+	LIST_HEAD(mms);
+	unsigned long prev = ULONG_MAX;
+	int round, err;
+
+	if (!ctx->ve_id || rounds < 0)
+		return -EINVAL;
+	if (rounds == 0)
+		rounds = CPT_ITER_MAX_ROUNDS;
+	if (!ctx->file)
+		return -EBADF;
+
+	env = get_ve_by_id(ctx->ve_id);
+	if (!env)
+		return -ESRCH;
+
+	oldenv = set_exec_env(env);
+	err = cpt_collect_ve_mms(&mms);
+	set_exec_env(oldenv);
+	if (err)
+		goto out;
+
+	ctx->write_error = 0;
+	r.resend = !ctx->iter_done;
+	/* Iteration is not usable by the dump until it is complete */
+	ctx->iter_done = 0;
+
+	for (round = 0; round < rounds; round++) {
+		r.sent = r.skipped = 0;
+
+		err = iter_one_round(&mms, &r, ctx);
+		if (err)
+			break;
+
+		dprintk_ctx("iteration %d: %lu pages sent, %lu busy\n",
+			    round, r.sent, r.skipped);
+
+		r.resend = 0;
+		if (r.sent <= CPT_ITER_MIN_PAGES)
+			break;
+		if (!CPT_ITER_CONVERGE(r.sent, prev))
+			break;
+		prev = r.sent;
+	}
+
+	if (!err)
+		err = iter_close_stream(ctx);
+	if (!err)
+		ctx->iter_done = 1;
+	else
+		eprintk_ctx("iteration failed: %d\n", err);
+
+out:
+	cpt_release_ve_mms(&mms);
+	put_ve(env);
+	return err;
+}
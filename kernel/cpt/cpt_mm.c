@@ -22,6 +22,11 @@
 #include <linux/ve.h>
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
+#include <linux/lzo.h>
+#include <linux/kthread.h>
+#include <linux/jhash.h>
+#include <linux/hash.h>
+#include <linux/vmalloc.h>
 #ifdef CONFIG_X86
 #include <asm/ldt.h>
 #endif
@@ -39,6 +44,62 @@
 #endif
 #include "cpt_ubc.h"
 
+#if defined(CONFIG_VZ_CHECKPOINT_ITER) || defined(CONFIG_VZ_CHECKPOINT_LAZY)
+/* Collects mms of all the tasks of current exec env, each mm once */
+int cpt_collect_ve_mms(struct list_head *head)
+{
+	struct task_struct *p;
+	struct mm_struct *drop = NULL;
+	struct cpt_ve_mm *im;
+	int err = 0;
+
+	read_lock(&tasklist_lock);
+	for_each_process_ve(p) {
+		struct mm_struct *mm;
+
+		mm = get_task_mm(p);
+		if (mm == NULL)
+			continue;
+
+		list_for_each_entry(im, head, list) {
+			if (im->mm == mm)
+				break;
+		}
+		if (&im->list != head) {
+			/* Not the last reference, it is held by the list */
+			mmput(mm);
+			continue;
+		}
+
+		im = kmalloc(sizeof(*im), GFP_ATOMIC);
+		if (im == NULL) {
+			drop = mm;
+			err = -ENOMEM;
+			break;
+		}
+		im->mm = mm;
+		list_add_tail(&im->list, head);
+	}
+	read_unlock(&tasklist_lock);
+
+	/* mmput() may sleep, if the task has just exited */
+	if (drop)
+		mmput(drop);
+	return err;
+}
+
+void cpt_release_ve_mms(struct list_head *head)
+{
+	struct cpt_ve_mm *im, *tmp;
+
+	list_for_each_entry_safe(im, tmp, head, list) {
+		list_del(&im->list);
+		mmput(im->mm);
+		kfree(im);
+	}
+}
+#endif
+
 static int collect_one_aio_ctx(struct mm_struct *mm, struct kioctx *aio_ctx,
 			       cpt_context_t *ctx)
 {
@@ -408,8 +469,7 @@ retry:
 		}
 	}
 #ifdef CONFIG_VZ_CHECKPOINT_ITER
-	if (ctx->iter_done &&
-	    test_bit(PG_checkpointed, &pg->flags)) {
+	if (ctx->iter_done && PageCheckpointed(pg)) {
 		if (pte_write(pte)) {
 			wprintk_ctx("writable PG_checkpointed page\n");
 		}
@@ -443,14 +503,78 @@ out_unsupported:
 	goto out_put;
 }
 
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+static void dump_lzo_page(char *maddr, struct cpt_context *ctx)
+{
+	struct cpt_lzo_page lp;
+	size_t len = lzo1x_worst_compress(PAGE_SIZE);
+
+	if (lzo1x_1_compress(maddr, PAGE_SIZE, ctx->lzo_buf, &len,
+			     ctx->lzo_wrkmem) != LZO_E_OK || len >= PAGE_SIZE) {
+		lp.cpt_len = PAGE_SIZE;
+		ctx->write(&lp, sizeof(lp), ctx);
+		ctx->write(maddr, PAGE_SIZE, ctx);
+		return;
+	}
+	lp.cpt_len = len;
+	ctx->write(&lp, sizeof(lp), ctx);
+	ctx->write(ctx->lzo_buf, len, ctx);
+}
+#endif
+
 /* ATTN: We give "current" to get_user_pages(). This is wrong, but get_user_pages()
  * does not really need this thing. It just stores some page fault stats there.
  *
  * BUG: some archs (f.e. sparc64, but not Intel*) require flush cache pages
  * before accessing vma.
  */
-void dump_pages(struct vm_area_struct *vma, unsigned long start,
-		unsigned long end, struct cpt_context *ctx)
+/*
+ * With CPT_SET_DEDUP zero pages are dumped as CPT_CONTENT_VOID blocks.
+ * Pages equal to a page already put to the image are dumped as
+ * CPT_OBJ_DUPPAGES blocks, which refer to image positions of the
+ * originals. Originals are held until the end of cpt_dump_vm(), VE is
+ * frozen, so they do not change. Zero checks and checksums of a chunk
+ * are computed by the page workers, the main thread only looks the
+ * checksums up.
+ */
+#define CPT_DEDUP_HASH_BITS	14
+/* Limit of tracked pages, each costs struct cpt_dedup_page */
+#define CPT_DEDUP_MAX		(256*1024)
+/* Pages are classified in chunks, then runs of one kind are dumped */
+#define CPT_DEDUP_CHUNK		512
+
+enum {
+	DD_NEW,
+	DD_ZERO,
+	DD_DUP,
+	DD_FAULT,	/* not classified, dumped as new */
+};
+
+struct cpt_dedup_page
+{
+	struct hlist_node	hash;
+	struct page		*page;
+	u32			csum;
+	loff_t			pos;
+};
+
+struct cpt_dedup
+{
+	struct hlist_head	hash[1 << CPT_DEDUP_HASH_BITS];
+	unsigned long		nr;
+	unsigned long		zero;
+	unsigned long		dup;
+	u8			type[CPT_DEDUP_CHUNK];
+	u32			csum[CPT_DEDUP_CHUNK];
+	struct cpt_dedup_page	*ref[CPT_DEDUP_CHUNK];
+	/* checksum jobs of the chunk not done yet */
+	atomic_t		pending;
+	wait_queue_head_t	wait;
+};
+
+static void __dump_pages(struct vm_area_struct *vma, unsigned long start,
+			 unsigned long end, struct cpt_dedup_page **refs,
+			 struct cpt_context *ctx)
 {
 #define MAX_PAGE_BATCH 16
 	struct page *pg[MAX_PAGE_BATCH];
@@ -469,6 +593,13 @@ void dump_pages(struct vm_area_struct *vma, unsigned long start,
 			int i;
 			for (i=0; i<n; i++) {
 				char *maddr = kmap(pg[i]);
+				if (refs && refs[count + i])
+					refs[count + i]->pos = ctx->file->f_pos;
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+				if (ctx->compress)
+					dump_lzo_page(maddr, ctx);
+				else
+#endif
 				ctx->write(maddr, PAGE_SIZE, ctx);
 				kunmap(pg[i]);
 			}
@@ -486,9 +617,287 @@ void dump_pages(struct vm_area_struct *vma, unsigned long start,
 	return;
 }
 
-int dump_page_block(struct vm_area_struct *vma, struct cpt_page_block *pgb,
-		    int copy,
-		    struct cpt_context *ctx)
+void dump_pages(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, struct cpt_context *ctx)
+{
+	__dump_pages(vma, start, end, NULL, ctx);
+}
+
+static int cpt_page_is_zero(const char *maddr)
+{
+	const unsigned long *p = (const unsigned long *)maddr;
+	int i;
+
+	for (i = 0; i < PAGE_SIZE/sizeof(unsigned long); i++)
+		if (p[i])
+			return 0;
+	return 1;
+}
+
+/*
+ * Classifies @npages pages at @addr into dd->type[] and dd->csum[] from
+ * index @first. The main thread does not take mmap_sem, VE is frozen.
+ */
+static void cpt_csum_pages(struct mm_struct *mm, unsigned long addr,
+			   int first, int npages, struct cpt_dedup *dd,
+			   int lock)
+{
+	struct page *pg[MAX_PAGE_BATCH];
+	int i, j, n;
+
+	for (i = first; i < first + npages; i += n) {
+		int copy = first + npages - i;
+
+		if (copy > MAX_PAGE_BATCH)
+			copy = MAX_PAGE_BATCH;
+		if (lock)
+			down_read(&mm->mmap_sem);
+		n = get_user_pages(current, mm, addr + (i - first)*PAGE_SIZE,
+				   copy, 0, 1, pg, NULL);
+		if (lock)
+			up_read(&mm->mmap_sem);
+		if (n <= 0) {
+			/* Let dump_pages() report it */
+			for ( ; i < first + npages; i++)
+				dd->type[i] = DD_FAULT;
+			break;
+		}
+		for (j = 0; j < n; j++) {
+			char *maddr = kmap(pg[j]);
+
+			if (cpt_page_is_zero(maddr)) {
+				dd->type[i + j] = DD_ZERO;
+			} else {
+				dd->type[i + j] = DD_NEW;
+				dd->csum[i + j] = jhash(maddr, PAGE_SIZE, 0);
+			}
+			kunmap(pg[j]);
+			page_cache_release(pg[j]);
+		}
+		cond_resched();
+	}
+}
+
+/*
+ * Contents of large page blocks are copied by worker threads. The main
+ * thread lays out the objects and reserves space for the pages, workers
+ * fill the holes with pwrite(). VE is frozen, so that the pages do not
+ * change until the dump is complete. Workers are waited for
+ * in cpt_dump_tail() or when the dump file is closed on error.
+ */
+#define CPT_DUMP_MAX_WORKERS	8
+/* Smaller blocks are not worth of flushing of write buffer */
+#define CPT_DUMP_MIN_JOB	16
+
+struct cpt_page_job
+{
+	struct list_head	list;
+	struct mm_struct	*mm;
+	unsigned long		start;
+	unsigned long		end;
+	loff_t			pos;
+	/* checksum job, classifies pages from dd->type[first] */
+	struct cpt_dedup	*dd;
+	int			first;
+};
+
+struct cpt_page_workers
+{
+	spinlock_t		lock;
+	struct list_head	jobs;
+	wait_queue_head_t	wq;
+	int			error;
+	int			nr;
+	struct task_struct	*tsk[CPT_DUMP_MAX_WORKERS];
+	struct cpt_context	*ctx;
+};
+
+static int page_job_write(struct file *file, void *addr, loff_t pos)
+{
+	mm_segment_t oldfs;
+	ssize_t err;
+
+	oldfs = get_fs(); set_fs(KERNEL_DS);
+	err = file->f_op->write(file, addr, PAGE_SIZE, &pos);
+	set_fs(oldfs);
+	if (err != PAGE_SIZE)
+		return err < 0 ? err : -EIO;
+	return 0;
+}
+
+static int do_page_job(struct cpt_page_job *job, struct file *file)
+{
+	struct page *pg[MAX_PAGE_BATCH];
+	unsigned long addr = job->start;
+	loff_t pos = job->pos;
+	int err = 0;
+
+	while (addr < job->end && !err) {
+		int copy = (job->end - addr) / PAGE_SIZE;
+		int i, n;
+
+		if (copy > MAX_PAGE_BATCH)
+			copy = MAX_PAGE_BATCH;
+		down_read(&job->mm->mmap_sem);
+		n = get_user_pages(current, job->mm, addr, copy, 0, 1, pg, NULL);
+		up_read(&job->mm->mmap_sem);
+		if (n != copy)
+			err = -EFAULT;
+
+		for (i = 0; i < n; i++) {
+			if (!err) {
+				char *maddr = kmap(pg[i]);
+				err = page_job_write(file, maddr, pos);
+				kunmap(pg[i]);
+			}
+			page_cache_release(pg[i]);
+			pos += PAGE_SIZE;
+		}
+		addr += n * PAGE_SIZE;
+		cond_resched();
+	}
+	return err;
+}
+
+static int cpt_page_worker(void *data)
+{
+	struct cpt_page_workers *w = data;
+	struct cpt_page_job *job;
+	int err;
+
+	for (;;) {
+		wait_event(w->wq, !list_empty(&w->jobs) || kthread_should_stop());
+
+		spin_lock(&w->lock);
+		job = NULL;
+		if (!list_empty(&w->jobs)) {
+			job = list_entry(w->jobs.next, struct cpt_page_job, list);
+			list_del(&job->list);
+		}
+		err = w->error;
+		spin_unlock(&w->lock);
+
+		if (job == NULL) {
+			if (kthread_should_stop())
+				break;
+			continue;
+		}
+
+		if (job->dd) {
+			struct cpt_dedup *dd = job->dd;
+
+			/* The main thread waits for it, done even on error */
+			cpt_csum_pages(job->mm, job->start, job->first,
+				       (job->end - job->start) / PAGE_SIZE,
+				       dd, 1);
+			if (atomic_dec_and_test(&dd->pending))
+				wake_up(&dd->wait);
+			mmput(job->mm);
+			kfree(job);
+			continue;
+		}
+
+		/* After an error the rest is just dropped */
+		if (!err)
+			err = do_page_job(job, w->ctx->file);
+		if (err) {
+			spin_lock(&w->lock);
+			if (!w->error)
+				w->error = err;
+			spin_unlock(&w->lock);
+		}
+		mmput(job->mm);
+		kfree(job);
+	}
+	return 0;
+}
+
+static void cpt_start_page_workers(struct cpt_context *ctx)
+{
+	struct cpt_page_workers *w;
+	int i, nr;
+
+	nr = min_t(int, num_online_cpus(), CPT_DUMP_MAX_WORKERS);
+	if (nr < 2 || ctx->pgdump)
+		return;
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	/* Size of compressed data is not known in advance */
+	if (ctx->compress)
+		return;
+#endif
+
+	w = kzalloc(sizeof(*w), GFP_KERNEL);
+	if (w == NULL)
+		return;
+	spin_lock_init(&w->lock);
+	INIT_LIST_HEAD(&w->jobs);
+	init_waitqueue_head(&w->wq);
+	w->ctx = ctx;
+
+	for (i = 0; i < nr; i++) {
+		struct task_struct *tsk;
+
+		tsk = kthread_run(cpt_page_worker, w, "vzdump/%d/%d",
+				  ctx->ve_id, i);
+		if (IS_ERR(tsk))
+			break;
+		w->tsk[w->nr++] = tsk;
+	}
+	if (w->nr == 0) {
+		kfree(w);
+		return;
+	}
+	ctx->pgdump = w;
+}
+
+void cpt_stop_page_workers(struct cpt_context *ctx)
+{
+	struct cpt_page_workers *w = ctx->pgdump;
+	int i;
+
+	if (w == NULL)
+		return;
+
+	/* Workers exit only when the queue is drained */
+	for (i = 0; i < w->nr; i++)
+		kthread_stop(w->tsk[i]);
+
+	if (w->error && !ctx->write_error)
+		ctx->write_error = w->error;
+	kfree(w);
+	ctx->pgdump = NULL;
+}
+
+static int cpt_queue_pages(struct vm_area_struct *vma, unsigned long start,
+			   unsigned long end, struct cpt_context *ctx)
+{
+	struct cpt_page_workers *w = ctx->pgdump;
+	struct cpt_page_job *job;
+
+	if (w == NULL || (end - start) / PAGE_SIZE < CPT_DUMP_MIN_JOB)
+		return -EAGAIN;
+
+	job = kmalloc(sizeof(*job), GFP_KERNEL);
+	if (job == NULL)
+		return -ENOMEM;
+	atomic_inc(&vma->vm_mm->mm_users);
+	job->mm = vma->vm_mm;
+	job->start = start;
+	job->dd = NULL;
+	job->end = end;
+	job->pos = cpt_reserve_space(end - start, ctx);
+
+	spin_lock(&w->lock);
+	list_add_tail(&job->list, &w->jobs);
+	spin_unlock(&w->lock);
+	wake_up(&w->wq);
+	return 0;
+}
+
+static int __dump_page_block(struct vm_area_struct *vma,
+			     struct cpt_page_block *pgb, int copy,
+			     struct cpt_dedup_page **refs,
+			     struct cpt_context *ctx)
 {
 	loff_t saved_object;
 
@@ -497,15 +906,283 @@ int dump_page_block(struct vm_area_struct *vma, struct cpt_page_block *pgb,
 	pgb->cpt_object = (copy != PD_LAZY) ? CPT_OBJ_PAGES : CPT_OBJ_LAZYPAGES;
 	pgb->cpt_hdrlen = sizeof(*pgb);
 	pgb->cpt_content = (copy == PD_COPY || copy == PD_LAZY) ? CPT_CONTENT_DATA : CPT_CONTENT_VOID;
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	if (copy == PD_COPY && ctx->compress)
+		pgb->cpt_content = CPT_CONTENT_LZO;
+#endif
 
 	ctx->write(pgb, sizeof(*pgb), ctx);
-	if (copy == PD_COPY || copy == PD_LAZY)
-		dump_pages(vma, pgb->cpt_start, pgb->cpt_end, ctx);
+	if (copy == PD_COPY || copy == PD_LAZY) {
+		loff_t data = ctx->file->f_pos;
+
+		if (cpt_queue_pages(vma, pgb->cpt_start, pgb->cpt_end, ctx)) {
+			__dump_pages(vma, pgb->cpt_start, pgb->cpt_end, refs, ctx);
+		} else if (refs) {
+			/* Queued pages are never compressed */
+			int i;
+
+			for (i = 0; i < (pgb->cpt_end - pgb->cpt_start)/PAGE_SIZE; i++)
+				if (refs[i])
+					refs[i]->pos = data + i*PAGE_SIZE;
+		}
+	}
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	if (pgb->cpt_content == CPT_CONTENT_LZO)
+		ctx->align(ctx);
+#endif
+	cpt_close_object(ctx);
+	cpt_pop_object(&saved_object, ctx);
+	return 0;
+}
+
+int dump_page_block(struct vm_area_struct *vma, struct cpt_page_block *pgb,
+		    int copy,
+		    struct cpt_context *ctx)
+{
+	return __dump_page_block(vma, pgb, copy, NULL, ctx);
+}
+
+static void cpt_dedup_init(struct cpt_context *ctx)
+{
+	struct cpt_dedup *dd;
+	int i;
+
+	if (!ctx->dedup_pages)
+		return;
+	dd = vmalloc(sizeof(*dd));
+	if (dd == NULL)
+		return;
+	for (i = 0; i < (1 << CPT_DEDUP_HASH_BITS); i++)
+		INIT_HLIST_HEAD(&dd->hash[i]);
+	dd->nr = dd->zero = dd->dup = 0;
+	atomic_set(&dd->pending, 0);
+	init_waitqueue_head(&dd->wait);
+	ctx->dedup = dd;
+}
+
+static void cpt_dedup_fini(struct cpt_context *ctx)
+{
+	struct cpt_dedup *dd = ctx->dedup;
+	struct cpt_dedup_page *e;
+	struct hlist_node *n, *tmp;
+	int i;
+
+	if (dd == NULL)
+		return;
+	if (dd->zero || dd->dup)
+		dprintk_ctx("cpt_dump_vm: %lu zero and %lu duplicate pages\n",
+			    dd->zero, dd->dup);
+	for (i = 0; i < (1 << CPT_DEDUP_HASH_BITS); i++) {
+		hlist_for_each_entry_safe(e, n, tmp, &dd->hash[i], hash) {
+			put_page(e->page);
+			kfree(e);
+		}
+	}
+	vfree(dd);
+	ctx->dedup = NULL;
+}
+
+/* Looks up a page with known checksum, which is not a zero one */
+static int cpt_dedup_page(struct page *pg, u32 csum,
+			  struct cpt_dedup_page **ref, struct cpt_dedup *dd)
+{
+	struct cpt_dedup_page *e;
+	struct hlist_head *head;
+	struct hlist_node *n;
+	char *maddr;
+	int type = DD_NEW;
+
+	*ref = NULL;
+	maddr = kmap(pg);
+	head = &dd->hash[hash_32(csum, CPT_DEDUP_HASH_BITS)];
+	hlist_for_each_entry(e, n, head, hash) {
+		int same;
+
+		if (e->csum != csum)
+			continue;
+		same = (e->page == pg) || !memcmp(kmap(e->page), maddr, PAGE_SIZE);
+		if (e->page != pg)
+			kunmap(e->page);
+		if (same) {
+			*ref = e;
+			type = DD_DUP;
+			goto out;
+		}
+	}
+
+	if (dd->nr >= CPT_DEDUP_MAX)
+		goto out;
+	e = kmalloc(sizeof(*e), GFP_KERNEL);
+	if (e == NULL)
+		goto out;
+	get_page(pg);
+	e->page = pg;
+	e->csum = csum;
+	e->pos = CPT_NULL;
+	hlist_add_head(&e->hash, head);
+	dd->nr++;
+	*ref = e;
+out:
+	kunmap(pg);
+	return type;
+}
+
+static int dump_duppage_block(struct vm_area_struct *vma, unsigned long start,
+			      unsigned long end, struct cpt_dedup_page **refs,
+			      struct cpt_context *ctx)
+{
+	struct cpt_duppage_block pgb;
+	loff_t saved_object;
+	int i;
+
+	cpt_push_object(&saved_object, ctx);
+
+	pgb.cpt_object = CPT_OBJ_DUPPAGES;
+	pgb.cpt_hdrlen = sizeof(pgb);
+	pgb.cpt_content = CPT_CONTENT_DATA;
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	if (ctx->compress)
+		pgb.cpt_content = CPT_CONTENT_LZO;
+#endif
+	pgb.cpt_start = start;
+	pgb.cpt_end = end;
+	ctx->write(&pgb, sizeof(pgb), ctx);
+
+	for (i = 0; i < (end - start)/PAGE_SIZE; i++) {
+		__u64 pos = refs[i]->pos;
+
+		ctx->write(&pos, sizeof(pos), ctx);
+	}
+
 	cpt_close_object(ctx);
 	cpt_pop_object(&saved_object, ctx);
 	return 0;
 }
 
+/* Classifies the chunk by the page workers, if there are any */
+static void cpt_csum_chunk(struct vm_area_struct *vma, unsigned long start,
+			   int npages, struct cpt_context *ctx)
+{
+	struct cpt_page_workers *w = ctx->pgdump;
+	struct cpt_dedup *dd = ctx->dedup;
+	int i, n, per;
+
+	if (w == NULL || npages < 2*CPT_DUMP_MIN_JOB) {
+		cpt_csum_pages(vma->vm_mm, start, 0, npages, dd, 0);
+		return;
+	}
+
+	per = max_t(int, DIV_ROUND_UP(npages, w->nr), CPT_DUMP_MIN_JOB);
+	atomic_set(&dd->pending, 1);
+	for (i = 0; i < npages; i += n) {
+		struct cpt_page_job *job;
+
+		n = min(per, npages - i);
+		job = kmalloc(sizeof(*job), GFP_KERNEL);
+		if (job == NULL) {
+			cpt_csum_pages(vma->vm_mm, start + i*PAGE_SIZE, i, n,
+				       dd, 0);
+			continue;
+		}
+		atomic_inc(&vma->vm_mm->mm_users);
+		job->mm = vma->vm_mm;
+		job->start = start + i*PAGE_SIZE;
+		job->end = job->start + n*PAGE_SIZE;
+		job->dd = dd;
+		job->first = i;
+		atomic_inc(&dd->pending);
+
+		/* Ahead of the queued writes, we are waiting for it */
+		spin_lock(&w->lock);
+		list_add(&job->list, &w->jobs);
+		spin_unlock(&w->lock);
+		wake_up(&w->wq);
+	}
+
+	if (!atomic_dec_and_test(&dd->pending))
+		wait_event(dd->wait, atomic_read(&dd->pending) == 0);
+}
+
+static void dump_dedup_chunk(struct vm_area_struct *vma, unsigned long start,
+			     int npages, struct cpt_context *ctx)
+{
+	struct cpt_dedup *dd = ctx->dedup;
+	struct page *pg[MAX_PAGE_BATCH];
+	struct cpt_page_block pgb;
+	int i, j, n;
+
+	cpt_csum_chunk(vma, start, npages, ctx);
+
+	for (i = 0; i < npages; i += n) {
+		int copy = npages - i;
+
+		if (copy > MAX_PAGE_BATCH)
+			copy = MAX_PAGE_BATCH;
+		n = get_user_pages(current, vma->vm_mm, start + i*PAGE_SIZE,
+				   copy, 0, 1, pg, NULL);
+		if (n <= 0) {
+			/* Let dump_pages() report it */
+			for ( ; i < npages; i++) {
+				dd->type[i] = DD_NEW;
+				dd->ref[i] = NULL;
+			}
+			break;
+		}
+		for (j = 0; j < n; j++) {
+			dd->ref[i + j] = NULL;
+			if (dd->type[i + j] == DD_NEW)
+				dd->type[i + j] = cpt_dedup_page(pg[j],
+						dd->csum[i + j],
+						&dd->ref[i + j], dd);
+			else if (dd->type[i + j] == DD_FAULT)
+				dd->type[i + j] = DD_NEW;
+			page_cache_release(pg[j]);
+		}
+	}
+
+	for (i = 0; i < npages; i = j) {
+		int type = dd->type[i];
+
+		for (j = i + 1; j < npages && dd->type[j] == type; j++)
+			;
+
+		pgb.cpt_start = start + i*PAGE_SIZE;
+		pgb.cpt_end = start + j*PAGE_SIZE;
+		if (type == DD_ZERO) {
+			__dump_page_block(vma, &pgb, PD_ZERO, NULL, ctx);
+			dd->zero += j - i;
+		} else if (type == DD_DUP) {
+			dump_duppage_block(vma, pgb.cpt_start, pgb.cpt_end,
+					   dd->ref + i, ctx);
+			dd->dup += j - i;
+		} else {
+			__dump_page_block(vma, &pgb, PD_COPY, dd->ref + i, ctx);
+		}
+	}
+}
+
+static void dump_copy_area(struct vm_area_struct *vma, unsigned long start,
+			   unsigned long end, struct cpt_context *ctx)
+{
+	struct cpt_page_block pgb;
+
+	if (ctx->dedup == NULL) {
+		pgb.cpt_start = start;
+		pgb.cpt_end = end;
+		dump_page_block(vma, &pgb, PD_COPY, ctx);
+		return;
+	}
+
+	while (start < end) {
+		int npages = (end - start)/PAGE_SIZE;
+
+		if (npages > CPT_DEDUP_CHUNK)
+			npages = CPT_DEDUP_CHUNK;
+		dump_dedup_chunk(vma, start, npages, ctx);
+		start += npages*PAGE_SIZE;
+	}
+}
+
 int dump_remappage_block(struct vm_area_struct *vma, struct page_area *pa,
 			 struct cpt_context *ctx)
 {
@@ -700,8 +1377,9 @@ static int dump_one_vma(cpt_object_t *mmobj,
 #endif
 
 		if (!can_expand(&pa, &pd)) {
-			if (pa.type == PD_COPY ||
-			    pa.type == PD_ZERO) {
+			if (pa.type == PD_COPY) {
+				dump_copy_area(vma, pa.start, pa.end, ctx);
+			} else if (pa.type == PD_ZERO) {
 				pgb.cpt_start = pa.start;
 				pgb.cpt_end = pa.end;
 				dump_page_block(vma, &pgb, pa.type, ctx);
@@ -728,8 +1406,9 @@ static int dump_one_vma(cpt_object_t *mmobj,
 	}
 
 	if (pa.end > pa.start) {
-		if (pa.type == PD_COPY ||
-		    pa.type == PD_ZERO) {
+		if (pa.type == PD_COPY) {
+			dump_copy_area(vma, pa.start, pa.end, ctx);
+		} else if (pa.type == PD_ZERO) {
 			pgb.cpt_start = pa.start;
 			pgb.cpt_end = pa.end;
 			dump_page_block(vma, &pgb, pa.type, ctx);
@@ -903,15 +1582,20 @@ int cpt_dump_vm(struct cpt_context *ctx)
 	scnt = scnt0 = zcnt = 0;
 
 	cpt_open_section(ctx, CPT_SECT_MM);
+	cpt_start_page_workers(ctx);
+	cpt_dedup_init(ctx);
 
 	for_each_object(obj, CPT_OBJ_MM) {
 		int err;
 
-		if ((err = dump_one_mm(obj, ctx)) != 0)
+		if ((err = dump_one_mm(obj, ctx)) != 0) {
+			cpt_dedup_fini(ctx);
 			return err;
+		}
 	}
 
 	cpt_close_section(ctx);
+	cpt_dedup_fini(ctx);
 
 	if (scnt)
 		dprintk_ctx("cpt_dump_vm: %d shared private anon pages\n", scnt);
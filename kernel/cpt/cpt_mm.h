@@ -1,6 +1,7 @@
 int cpt_collect_mm(cpt_context_t *);
 
 int cpt_dump_vm(struct cpt_context *ctx);
+void cpt_stop_page_workers(struct cpt_context *ctx);
 
 __u32 rst_mm_flag(struct cpt_task_image *ti, struct cpt_context *ctx);
 int rst_mm_basic(cpt_object_t *obj, struct cpt_task_image *ti, struct cpt_context *ctx);
@@ -8,18 +9,28 @@ int rst_mm_complete(struct cpt_task_image *ti, struct cpt_context *ctx);
 
 int cpt_mm_prepare(unsigned long veid);
 
+struct cpt_ve_mm
+{
+	struct list_head	list;
+	struct mm_struct	*mm;
+};
+
+int cpt_collect_ve_mms(struct list_head *head);
+void cpt_release_ve_mms(struct list_head *head);
+
 int cpt_free_pgin_dir(struct cpt_context *);
 int cpt_start_pagein(struct cpt_context *);
 int rst_setup_pagein(struct cpt_context *);
 int rst_complete_pagein(struct cpt_context *, int);
 int rst_pageind(struct cpt_context *);
-int cpt_iteration(cpt_context_t *ctx);
+int cpt_iteration(cpt_context_t *ctx, int rounds);
 int rst_iteration(cpt_context_t *ctx);
 void rst_drop_iter_dir(cpt_context_t *ctx);
 int rst_iter(struct vm_area_struct *vma, u64 pfn,
 	     unsigned long addr, cpt_context_t * ctx);
 
 int rst_swapoff(struct cpt_context *);
+void rst_drop_pagein(struct cpt_context *);
 
 #ifdef ARCH_HAS_SETUP_ADDITIONAL_PAGES
 struct linux_binprm;
@@ -527,7 +527,7 @@ static int cpt_dump_iptables(struct cpt_context * ctx)
 		cpt_close_object(ctx);
 		cpt_close_section(ctx);
 		ctx->sections[CPT_SECT_NET_IPTABLES] = CPT_NULL;
-		ctx->file->f_pos = pos;
+		cpt_seek(pos, ctx);
 	}
 	return n ? : err;
 
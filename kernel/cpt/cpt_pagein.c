@@ -0,0 +1,275 @@
+/*
+ *
+ *  kernel/cpt/cpt_pagein.c
+ *
+ *  Copyright (C) 2000-2005  SWsoft
+ *  All rights reserved.
+ *
+ *  Licensing governed by "linux/COPYING.SWsoft" file.
+ *
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/errno.h>
+#include <linux/kthread.h>
+#include <linux/ve.h>
+#include <linux/ve_proto.h>
+#include <asm/tlbflush.h>
+#include <linux/cpt_image.h>
+
+#include "cpt_obj.h"
+#include "cpt_context.h"
+#include "cpt_mm.h"
+#include "cpt_pagein.h"
+
+static struct pagein_desc *cpt_pgin_desc(unsigned long index,
+					 cpt_context_t *ctx)
+{
+	if (index >= ctx->lazypages)
+		return NULL;
+	return ctx->pgin_dir[index / PGIN_DESC_PER_PAGE] +
+		index % PGIN_DESC_PER_PAGE;
+}
+
+static int cpt_grow_pgin_dir(cpt_context_t *ctx)
+{
+	int chunk = ctx->lazypages / PGIN_DESC_PER_PAGE;
+	struct pagein_desc **dir;
+
+	if (chunk >= ctx->pgin_dir_size) {
+		int size = ctx->pgin_dir_size ? : PAGE_SIZE/sizeof(void *);
+
+		while (size <= chunk)
+			size <<= 1;
+		dir = krealloc(ctx->pgin_dir, size * sizeof(void *), GFP_KERNEL);
+		if (dir == NULL)
+			return -ENOMEM;
+		ctx->pgin_dir = dir;
+		ctx->pgin_dir_size = size;
+	}
+	if (ctx->lazypages % PGIN_DESC_PER_PAGE == 0) {
+		ctx->pgin_dir[chunk] = (void *)get_zeroed_page(GFP_KERNEL);
+		if (ctx->pgin_dir[chunk] == NULL)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Allocates indices for @npages lazy pages starting from @addr and grabs
+ * the pages, so that they stay with the source until they are sent.
+ * Swapped out pages are read in here. A page, which cannot be found,
+ * will be reported to the destination as an error when it is requested.
+ */
+__u64 cpt_alloc_pgin_index(struct vm_area_struct *vma, unsigned long addr,
+			   int npages, cpt_context_t *ctx)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	__u64 index = ctx->lazypages;
+	int i;
+
+	down_read(&mm->mmap_sem);
+	for (i = 0; i < npages; i++, addr += PAGE_SIZE) {
+		struct pagein_desc *pd;
+		struct page *page;
+
+		if (cpt_grow_pgin_dir(ctx)) {
+			if (!ctx->write_error)
+				ctx->write_error = -ENOMEM;
+			break;
+		}
+		pd = ctx->pgin_dir[ctx->lazypages / PGIN_DESC_PER_PAGE] +
+			ctx->lazypages % PGIN_DESC_PER_PAGE;
+		ctx->lazypages++;
+
+		if (get_user_pages(current, mm, addr, 1, 0, 1, &page, NULL) != 1) {
+			wprintk_ctx("lazy page at %08lx is lost\n", addr);
+			continue;
+		}
+		pd->page = page;
+	}
+	up_read(&mm->mmap_sem);
+	return index;
+}
+
+int cpt_free_pgin_dir(cpt_context_t *ctx)
+{
+	unsigned long i;
+
+	for (i = 0; i < ctx->lazypages; i++) {
+		struct pagein_desc *pd = cpt_pgin_desc(i, ctx);
+
+		if (pd->page)
+			put_page(pd->page);
+		if ((i + 1) % PGIN_DESC_PER_PAGE == 0 ||
+		    i + 1 == ctx->lazypages)
+			free_page((unsigned long)ctx->pgin_dir[i / PGIN_DESC_PER_PAGE]);
+	}
+	kfree(ctx->pgin_dir);
+	ctx->pgin_dir = NULL;
+	ctx->pgin_dir_size = 0;
+	ctx->lazypages = 0;
+	return 0;
+}
+
+static int cpt_pagein_one(struct pgin_request *rq, cpt_context_t *ctx)
+{
+	struct pagein_desc *pd;
+	struct pgin_reply rp;
+	struct page *page = NULL;
+	char *maddr;
+	int err;
+
+	pd = cpt_pgin_desc(rq->rq_index, ctx);
+	if (pd)
+		page = pd->page;
+
+	rp.rp_index = rq->rq_index;
+	rp.rp_status = page ? 0 : -ESRCH;
+	rp.__cpt_pad1 = 0;
+	err = pgin_write(ctx->pagein_file_out, &rp, sizeof(rp));
+	if (err || page == NULL)
+		return err;
+
+	maddr = kmap(page);
+	err = pgin_write(ctx->pagein_file_out, maddr, PAGE_SIZE);
+	kunmap(page);
+	return err;
+}
+
+static int cpt_pagein_thread(void *data)
+{
+	cpt_context_t *ctx = data;
+	struct pgin_request rq;
+	int err;
+
+	allow_signal(SIGKILL);
+
+	for (;;) {
+		err = pgin_read(ctx->pagein_file_in, &rq, sizeof(rq));
+		if (err)
+			break;
+		if (rq.rq_index == CPT_NULL)
+			break;
+		err = cpt_pagein_one(&rq, ctx);
+		if (err)
+			break;
+		ctx->last_pagein = rq.rq_index;
+	}
+
+	if (err && err != -ENODATA)
+		eprintk_ctx("pagein failed: %d\n", err);
+	else
+		dprintk_ctx("pagein completed\n");
+	complete_and_exit(&ctx->pgin_notify, 0);
+}
+
+/*
+ * CPT_PAGEIND: serve lazy pages to the destination. VE must stay frozen
+ * until the destination closes the stream, so cpt_resume() and cpt_kill()
+ * wait for completion of the thread.
+ */
+int cpt_start_pagein(cpt_context_t *ctx)
+{
+	struct task_struct *tsk;
+
+	if (ctx->ctx_state != CPT_CTX_SUSPENDED)
+		return -ENOENT;
+	if (ctx->pgin_task)
+		return -EBUSY;
+	if (!ctx->pagein_file_in || !ctx->pagein_file_in->f_op ||
+	    !ctx->pagein_file_in->f_op->read ||
+	    !ctx->pagein_file_out || !ctx->pagein_file_out->f_op ||
+	    !ctx->pagein_file_out->f_op->write)
+		return -EBADF;
+
+	tsk = kthread_create(cpt_pagein_thread, ctx, "vzpagein/%d", ctx->ve_id);
+	if (IS_ERR(tsk))
+		return PTR_ERR(tsk);
+	get_task_struct(tsk);
+	ctx->pgin_task = tsk;
+	wake_up_process(tsk);
+	return 0;
+}
+
+static void cpt_mm_clear_young(struct vm_area_struct *vma)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr, next;
+
+	for (addr = vma->vm_start; addr < vma->vm_end; addr = next) {
+		pgd_t *pgd;
+		pud_t *pud;
+		pmd_t *pmd;
+		pte_t *pte;
+		spinlock_t *ptl;
+
+		next = pmd_addr_end(addr, vma->vm_end);
+
+		pgd = pgd_offset(mm, addr);
+		if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+			continue;
+		pud = pud_offset(pgd, addr);
+		if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+			continue;
+		pmd = pmd_offset(pud, addr);
+		if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd)))
+			continue;
+
+		pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+		for (; addr < next; addr += PAGE_SIZE, pte++) {
+			if (pte_present(*pte))
+				ptep_test_and_clear_young(vma, addr, pte);
+		}
+		pte_unmap_unlock(pte - 1, ptl);
+		cond_resched();
+	}
+	flush_tlb_range(vma, vma->vm_start, vma->vm_end);
+}
+
+/*
+ * CPT_VMPREP: starts sampling of VE working set. Accessed bits are cleared,
+ * so that only pages touched between this call and the dump are copied
+ * to the image and the rest is transferred lazily.
+ */
+int cpt_mm_prepare(unsigned long veid)
+{
+	struct ve_struct *env, *oldenv;
+	struct cpt_ve_mm *im;
+	LIST_HEAD(mms);
+	int err;
+
+	env = get_ve_by_id(veid);
+	if (!env)
+		return -ESRCH;
+
+	oldenv = set_exec_env(env);
+	err = cpt_collect_ve_mms(&mms);
+	set_exec_env(oldenv);
+
+	if (!err) {
+		list_for_each_entry(im, &mms, list) {
+			struct vm_area_struct *vma;
+
+			down_read(&im->mm->mmap_sem);
+			for (vma = im->mm->mmap; vma; vma = vma->vm_next) {
+				if (vma->vm_flags & (VM_IO|VM_PFNMAP|VM_HUGETLB))
+					continue;
+				cpt_mm_clear_young(vma);
+			}
+			up_read(&im->mm->mmap_sem);
+		}
+	}
+
+	cpt_release_ve_mms(&mms);
+	put_ve(env);
+	return err;
+}
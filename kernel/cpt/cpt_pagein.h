@@ -0,0 +1,80 @@
+/*
+ * Lazy migration of memory (post-copy).
+ *
+ * Pages, which were not accessed recently, are not put into the image.
+ * CPT_OBJ_LAZYPAGES blocks refer to them by index, the source keeps
+ * the pages and serves them over a pair of descriptors (a pipe or a socket
+ * forwarded to the destination) while VE is frozen. On restore lazy pages
+ * are mapped as entries of pseudo swap area, whose read is a request
+ * to the source. So, pages are transferred on the first access
+ * and by background swapoff, which pulls the rest after VE is resumed.
+ */
+
+/* One descriptor per lazy page on the source */
+struct pagein_desc
+{
+	struct page	*page;
+};
+
+#define PGIN_DESC_PER_PAGE	(PAGE_SIZE/sizeof(struct pagein_desc))
+
+/* Destination requests a page by index... */
+struct pgin_request
+{
+	__u64	rq_index;
+};
+
+/* ...and the source replies, the page follows the reply, if status is 0.
+ * Replies come in order of requests. rq_index == CPT_NULL ends the stream.
+ */
+struct pgin_reply
+{
+	__u64	rp_index;
+	__s32	rp_status;
+	__u32	__cpt_pad1;
+};
+
+__u64 cpt_alloc_pgin_index(struct vm_area_struct *vma, unsigned long addr,
+			   int npages, struct cpt_context *ctx);
+
+int rst_pagein(struct vm_area_struct *vma, u64 index,
+	       unsigned long addr, struct cpt_context *ctx);
+
+/* Pipes and sockets can return less than asked, loop until all is done */
+static inline int pgin_read(struct file *file, void *addr, size_t count)
+{
+	mm_segment_t oldfs;
+	ssize_t err = 0;
+
+	oldfs = get_fs(); set_fs(KERNEL_DS);
+	while (count) {
+		err = file->f_op->read(file, addr, count, &file->f_pos);
+		if (err <= 0)
+			break;
+		addr += err;
+		count -= err;
+	}
+	set_fs(oldfs);
+	if (count)
+		return err < 0 ? err : -ENODATA;
+	return 0;
+}
+
+static inline int pgin_write(struct file *file, const void *addr, size_t count)
+{
+	mm_segment_t oldfs;
+	ssize_t err = 0;
+
+	oldfs = get_fs(); set_fs(KERNEL_DS);
+	while (count) {
+		err = file->f_op->write(file, addr, count, &file->f_pos);
+		if (err <= 0)
+			break;
+		addr += err;
+		count -= err;
+	}
+	set_fs(oldfs);
+	if (count)
+		return err < 0 ? err : -EIO;
+	return 0;
+}
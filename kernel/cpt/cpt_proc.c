@@ -390,13 +390,37 @@ static int cpt_ioctl(struct inode * inode, struct file * file, unsigned int cmd,
 	case CPT_SET_LAZY:
 		ctx->lazy_vm = arg;
 		break;
-	case CPT_ITER:
-		err = cpt_iteration(ctx);
-		break;
 	case CPT_PAGEIND:
 		err = cpt_start_pagein(ctx);
 		break;
 #endif
+#ifdef CONFIG_VZ_CHECKPOINT_ITER
+	case CPT_ITER:
+		if (ctx->ctx_state > 0) {
+			err = -EBUSY;
+			break;
+		}
+		err = cpt_iteration(ctx, arg);
+		break;
+#endif
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	case CPT_SET_COMPRESS:
+		/* Compression buffers are set up when the dump file is opened */
+		if (ctx->ctx_state > CPT_CTX_SUSPENDED || ctx->tmpbuf) {
+			err = -EBUSY;
+			break;
+		}
+		ctx->compress = arg;
+		break;
+#endif
+	case CPT_SET_DEDUP:
+		/* The image needs a restore kernel aware of CPT_OBJ_DUPPAGES */
+		if (ctx->ctx_state > CPT_CTX_SUSPENDED) {
+			err = -EBUSY;
+			break;
+		}
+		ctx->dedup_pages = arg;
+		break;
 	case CPT_SET_VEID:
 		if (ctx->ctx_state > 0) {
 			err = -EBUSY;
@@ -237,6 +237,10 @@ void rst_close_dumpfile(struct cpt_context *ctx)
 		free_page((unsigned long)ctx->tmpbuf);
 		ctx->tmpbuf = NULL;
 	}
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+	kfree(ctx->lzo_buf);
+	ctx->lzo_buf = NULL;
+#endif
 }
 
 int _rst_get_object(int type, loff_t pos, void *tmp, int size, struct cpt_context *ctx)
@@ -0,0 +1,270 @@
+/*
+ *
+ *  kernel/cpt/rst_iterative.c
+ *
+ *  Copyright (C) 2000-2005  SWsoft
+ *  All rights reserved.
+ *
+ *  Licensing governed by "linux/COPYING.SWsoft" file.
+ *
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/errno.h>
+#include <linux/pagemap.h>
+#include <linux/radix-tree.h>
+#include <linux/cpt_image.h>
+
+#include <bc/beancounter.h>
+
+#include "cpt_obj.h"
+#include "cpt_context.h"
+#include "cpt_mm.h"
+
+/*
+ * Pages received by CPT_ITER before undump are kept in ctx->iter_dir,
+ * indexed by pfn on the source node. CPT_OBJ_ITERPAGES blocks of the
+ * image refer to them and rst_iter() maps them into restored mms
+ * without copying. The directory is dropped after restore, pages
+ * which were not mapped are freed then.
+ */
+
+/* Source pfns in order of arrival, to be able to destroy the tree */
+struct rst_iter_keys
+{
+	struct list_head	list;
+	int			nr;
+	unsigned long		pfn[0];
+};
+
+#define RST_ITER_KEYS	((PAGE_SIZE - sizeof(struct rst_iter_keys)) / \
+				sizeof(unsigned long))
+
+struct rst_iter_dir
+{
+	struct radix_tree_root	tree;
+	struct list_head	keys;
+	unsigned long		nr;
+};
+
+static struct rst_iter_dir *rst_iter_dir(cpt_context_t *ctx)
+{
+	struct rst_iter_dir *dir = ctx->iter_dir;
+
+	if (dir == NULL) {
+		dir = kmalloc(sizeof(*dir), GFP_KERNEL);
+		if (dir == NULL)
+			return NULL;
+		INIT_RADIX_TREE(&dir->tree, GFP_KERNEL);
+		INIT_LIST_HEAD(&dir->keys);
+		dir->nr = 0;
+		ctx->iter_dir = dir;
+	}
+	return dir;
+}
+
+static int rst_iter_add_key(struct rst_iter_dir *dir, unsigned long pfn)
+{
+	struct rst_iter_keys *k = NULL;
+
+	if (!list_empty(&dir->keys))
+		k = list_entry(dir->keys.prev, struct rst_iter_keys, list);
+	if (k == NULL || k->nr == RST_ITER_KEYS) {
+		k = (struct rst_iter_keys *)__get_free_page(GFP_KERNEL);
+		if (k == NULL)
+			return -ENOMEM;
+		k->nr = 0;
+		list_add_tail(&k->list, &dir->keys);
+	}
+	k->pfn[k->nr++] = pfn;
+	return 0;
+}
+
+#ifdef CONFIG_BEANCOUNTERS
+/* Do not let the stream pin more memory than VE is allowed to map */
+static int rst_iter_over_limit(unsigned long nr, cpt_context_t *ctx)
+{
+	struct user_beancounter *ub = ctx->iter_ub;
+
+	if (ub == NULL) {
+		ub = get_beancounter_byuid(ctx->ve_id, 0);
+		if (ub == NULL)
+			return 0;
+		ctx->iter_ub = ub;
+	}
+	return nr > ub->ub_parms[UB_PHYSPAGES].limit;
+}
+#else
+#define rst_iter_over_limit(nr, ctx)	0
+#endif
+
+static int rst_iter_add(struct rst_iter_dir *dir, unsigned long pfn,
+			struct page *page)
+{
+	struct page *old;
+	void **slot;
+	int err;
+
+	slot = radix_tree_lookup_slot(&dir->tree, pfn);
+	if (slot) {
+		/* Page was dirtied and sent again */
+		old = radix_tree_deref_slot(slot);
+		radix_tree_replace_slot(slot, page);
+		put_page(old);
+		return 0;
+	}
+
+	err = rst_iter_add_key(dir, pfn);
+	if (err)
+		return err;
+
+	err = radix_tree_preload(GFP_KERNEL);
+	if (err)
+		goto out_key;
+	err = radix_tree_insert(&dir->tree, pfn, page);
+	radix_tree_preload_end();
+	if (!err) {
+		dir->nr++;
+		return 0;
+	}
+
+out_key:
+	list_entry(dir->keys.prev, struct rst_iter_keys, list)->nr--;
+	return err;
+}
+
+int rst_iteration(cpt_context_t *ctx)
+{
+	struct rst_iter_dir *dir;
+	struct cpt_iterpage_hdr h;
+	int err;
+
+	if (ctx->ctx_state > 0)
+		return -EBUSY;
+
+	dir = rst_iter_dir(ctx);
+	if (dir == NULL)
+		return -ENOMEM;
+
+	for (;;) {
+		struct page *page;
+		char *maddr;
+
+		err = ctx->read(&h, sizeof(h), ctx);
+		if (err)
+			break;
+
+		if (h.cpt_pfn == CPT_NULL) {
+			if (h.cpt_flags & CPT_ITER_LAST)
+				break;
+			continue;
+		}
+
+		err = -ENOMEM;
+		if (rst_iter_over_limit(dir->nr + 1, ctx)) {
+			eprintk_ctx("iteration exceeds physpages limit\n");
+			break;
+		}
+		page = alloc_page(GFP_HIGHUSER);
+		if (page == NULL)
+			break;
+
+		maddr = kmap(page);
+		err = ctx->read(maddr, PAGE_SIZE, ctx);
+		kunmap(page);
+		if (err) {
+			put_page(page);
+			break;
+		}
+		__SetPageUptodate(page);
+
+		err = rst_iter_add(dir, (unsigned long)h.cpt_pfn, page);
+		if (err) {
+			put_page(page);
+			break;
+		}
+
+		if (signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+
+	if (err) {
+		eprintk_ctx("iteration failed: %d\n", err);
+		rst_drop_iter_dir(ctx);
+	}
+	return err;
+}
+
+int rst_iter(struct vm_area_struct *vma, u64 pfn,
+	     unsigned long addr, cpt_context_t * ctx)
+{
+	struct rst_iter_dir *dir = ctx->iter_dir;
+	struct page *page, *copy;
+	int err;
+
+	page = NULL;
+	if (dir)
+		page = radix_tree_lookup(&dir->tree, (unsigned long)pfn);
+	if (page == NULL) {
+		eprintk_ctx("iter page %Lu is not found\n", (unsigned long long)pfn);
+		return -ESRCH;
+	}
+
+	err = install_anon_page(vma, addr, page);
+	if (err != -EBUSY)
+		return err;
+
+	/* The page is already mapped to another anon_vma or at another
+	 * index, it cannot be shared. Make a private copy.
+	 */
+	copy = alloc_page(GFP_HIGHUSER_MOVABLE);
+	if (copy == NULL)
+		return -ENOMEM;
+	copy_highpage(copy, page);
+	__SetPageUptodate(copy);
+	err = install_anon_page(vma, addr, copy);
+	put_page(copy);
+	return err;
+}
+
+void rst_drop_iter_dir(cpt_context_t *ctx)
+{
+	struct rst_iter_dir *dir = ctx->iter_dir;
+	struct rst_iter_keys *k, *tmp;
+	int i;
+
+	if (dir) {
+		list_for_each_entry_safe(k, tmp, &dir->keys, list) {
+			for (i = 0; i < k->nr; i++) {
+				struct page *page;
+
+				page = radix_tree_delete(&dir->tree, k->pfn[i]);
+				if (page)
+					put_page(page);
+			}
+			list_del(&k->list);
+			free_page((unsigned long)k);
+			cond_resched();
+		}
+		kfree(dir);
+		ctx->iter_dir = NULL;
+	}
+#ifdef CONFIG_BEANCOUNTERS
+	if (ctx->iter_ub) {
+		put_beancounter(ctx->iter_ub);
+		ctx->iter_ub = NULL;
+	}
+#endif
+	ctx->iter_done = 0;
+}
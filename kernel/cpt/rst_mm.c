@@ -26,6 +26,7 @@
 #include <linux/vmalloc.h>
 #include <linux/rmap.h>
 #include <linux/hash.h>
+#include <linux/lzo.h>
 #include <asm/pgalloc.h>
 #include <asm/tlb.h>
 #include <asm/tlbflush.h>
@@ -59,6 +60,111 @@
 
 #define __PAGE_NX (1ULL<<63)
 
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+/*
+ * Reads one page of CPT_CONTENT_LZO block at *@pos and advances *@pos.
+ * ctx->lzo_buf holds a bounce page followed by space for compressed data,
+ * the page is unpacked there, if @dst is NULL.
+ */
+static int rst_read_lzo_page(void *dst, loff_t *pos, struct cpt_context *ctx)
+{
+	struct cpt_lzo_page lp;
+	size_t len;
+	int err;
+
+	if (ctx->lzo_buf == NULL) {
+		ctx->lzo_buf = kmalloc(PAGE_SIZE + lzo1x_worst_compress(PAGE_SIZE),
+				       GFP_KERNEL);
+		if (ctx->lzo_buf == NULL)
+			return -ENOMEM;
+	}
+	if (dst == NULL)
+		dst = ctx->lzo_buf;
+
+	err = ctx->pread(&lp, sizeof(lp), ctx, *pos);
+	if (err)
+		return err;
+	*pos += sizeof(lp);
+
+	if (lp.cpt_len == PAGE_SIZE) {
+		err = ctx->pread(dst, PAGE_SIZE, ctx, *pos);
+		if (!err)
+			*pos += PAGE_SIZE;
+		return err;
+	}
+	if (lp.cpt_len > PAGE_SIZE) {
+		eprintk_ctx("bad compressed page length %u\n", lp.cpt_len);
+		return -EINVAL;
+	}
+
+	err = ctx->pread(ctx->lzo_buf + PAGE_SIZE, lp.cpt_len, ctx, *pos);
+	if (err)
+		return err;
+	*pos += lp.cpt_len;
+
+	len = PAGE_SIZE;
+	if (lzo1x_decompress_safe(ctx->lzo_buf + PAGE_SIZE, lp.cpt_len,
+				  dst, &len) != LZO_E_OK || len != PAGE_SIZE) {
+		eprintk_ctx("corrupted compressed page at %Ld\n",
+			    (long long)*pos);
+		return -EINVAL;
+	}
+	return 0;
+}
+#endif
+
+/*
+ * CPT_OBJ_DUPPAGES: contents of each page are read from the position
+ * of the original page in the image.
+ */
+static int rst_dup_pages(struct cpt_duppage_block *pgb, loff_t offset,
+			 struct cpt_context *ctx)
+{
+	unsigned long addr;
+	loff_t pos = offset + pgb->cpt_hdrlen;
+	int err = 0;
+
+	for (addr = pgb->cpt_start; addr < pgb->cpt_end; addr += PAGE_SIZE) {
+		struct page *page;
+		void *maddr;
+		__u64 src;
+
+		err = ctx->pread(&src, sizeof(src), ctx, pos);
+		if (err)
+			break;
+		pos += sizeof(src);
+
+		err = get_user_pages(current, current->mm, addr, 1, 1, 1,
+				     &page, NULL);
+		if (err == 0)
+			err = -EFAULT;
+		if (err < 0) {
+			eprintk_ctx("get_user_pages: %d\n", err);
+			break;
+		}
+
+		maddr = kmap(page);
+		if (pgb->cpt_content == CPT_CONTENT_DATA) {
+			err = ctx->pread(maddr, PAGE_SIZE, ctx, src);
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+		} else if (pgb->cpt_content == CPT_CONTENT_LZO) {
+			loff_t lpos = src;
+
+			err = rst_read_lzo_page(maddr, &lpos, ctx);
+#endif
+		} else {
+			err = -EINVAL;
+		}
+		if (!err)
+			set_page_dirty_lock(page);
+		kunmap(page);
+		page_cache_release(page);
+		if (err)
+			break;
+	}
+	return err;
+}
+
 static unsigned long make_prot(struct cpt_vma_image *vmai)
 {
 	unsigned long prot = 0;
@@ -600,6 +706,7 @@ static int do_rst_vma(struct cpt_vma_image *vmai, loff_t vmapos, loff_t mmpos, s
 				struct cpt_copypage_block cpb;
 				struct cpt_lazypage_block lpb;
 				struct cpt_iterpage_block ipb;
+				struct cpt_duppage_block dpb;
 			} u;
 			loff_t pos;
 
@@ -768,6 +875,13 @@ static int do_rst_vma(struct cpt_vma_image *vmai, loff_t vmapos, loff_t mmpos, s
 				offset += u.cpb.cpt_next;
 				continue;
 			}
+			if (u.pb.cpt_object == CPT_OBJ_DUPPAGES) {
+				err = rst_dup_pages(&u.dpb, offset, ctx);
+				if (err)
+					goto out;
+				offset += u.dpb.cpt_next;
+				continue;
+			}
 			if (u.pb.cpt_object != CPT_OBJ_PAGES) {
 				eprintk_ctx("unknown vma fix object %d\n", u.pb.cpt_object);
 				err = -EINVAL;
@@ -802,6 +916,14 @@ static int do_rst_vma(struct cpt_vma_image *vmai, loff_t vmapos, loff_t mmpos, s
 							kunmap(page);
 							goto out;
 						}
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+					} else if (u.pb.cpt_content == CPT_CONTENT_LZO) {
+						err = rst_read_lzo_page(maddr, &pos, ctx);
+						if (err) {
+							kunmap(page);
+							goto out;
+						}
+#endif
 					} else {
 						err = -EINVAL;
 						kunmap(page);
@@ -833,6 +955,22 @@ static int do_rst_vma(struct cpt_vma_image *vmai, loff_t vmapos, loff_t mmpos, s
 							err = -EIO;
 						goto out;
 					}
+#ifdef CONFIG_VZ_CHECKPOINT_LZO
+				} else if (u.pb.cpt_content == CPT_CONTENT_LZO) {
+					unsigned long addr;
+
+					for (addr = u.pb.cpt_start; addr < u.pb.cpt_end;
+					     addr += PAGE_SIZE) {
+						err = rst_read_lzo_page(NULL, &pos, ctx);
+						if (err)
+							goto out;
+						if (copy_to_user((void __user *)addr,
+								 ctx->lzo_buf, PAGE_SIZE)) {
+							err = -EFAULT;
+							goto out;
+						}
+					}
+#endif
 				} else {
 					err = -EINVAL;
 					goto out;
@@ -0,0 +1,470 @@
+/*
+ *
+ *  kernel/cpt/rst_pagein.c
+ *
+ *  Copyright (C) 2000-2005  SWsoft
+ *  All rights reserved.
+ *
+ *  Licensing governed by "linux/COPYING.SWsoft" file.
+ *
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/errno.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/cpt_image.h>
+
+#include <bc/beancounter.h>
+
+#include "cpt_obj.h"
+#include "cpt_context.h"
+#include "cpt_mm.h"
+#include "cpt_pagein.h"
+
+/*
+ * Lazy page with index N is mapped as entry N+1 of pseudo swap area
+ * ctx->pgin_swp. Reading the entry queues a request to vzpageind thread,
+ * which sends it to the source and fills the page with the reply.
+ * After VE is resumed another thread pulls the rest of pages in and
+ * releases the area with swapoff.
+ */
+
+#define PGIN_ACTIVE	0
+#define PGIN_DONE	1	/* no more lazy pages */
+#define PGIN_DEAD	2	/* source is lost or VE is killed */
+
+/* Requests sent at once, replies to them must fit to socket buffers */
+#define PGIN_BATCH	16
+/* Background prefetch waits for every PGIN_PREFETCH-th page */
+#define PGIN_PREFETCH	64
+
+struct pgin_rq
+{
+	struct list_head	list;
+	struct page		*page;
+	unsigned long		index;
+};
+
+struct pgin_device
+{
+	atomic_t		count;
+	spinlock_t		lock;
+	struct list_head	queue;
+	wait_queue_head_t	wait;
+	int			state;
+	int			daemon;
+	struct swap_info_struct	*swp;
+	struct file		*in;
+	struct file		*out;
+	unsigned long		received;
+	unsigned long		failed;
+};
+
+static struct pgin_device *rst_pgin_dev(cpt_context_t *ctx)
+{
+	struct pgin_device *dev = ctx->pagein_dev;
+
+	if (dev == NULL) {
+		dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+		if (dev == NULL)
+			return NULL;
+		atomic_set(&dev->count, 1);
+		spin_lock_init(&dev->lock);
+		INIT_LIST_HEAD(&dev->queue);
+		init_waitqueue_head(&dev->wait);
+		dev->state = PGIN_ACTIVE;
+		ctx->pagein_dev = dev;
+	}
+	return dev;
+}
+
+static void pgin_dev_put(struct pgin_device *dev)
+{
+	if (!atomic_dec_and_test(&dev->count))
+		return;
+
+	BUG_ON(!list_empty(&dev->queue));
+	if (dev->in)
+		fput(dev->in);
+	if (dev->out)
+		fput(dev->out);
+	kfree(dev);
+}
+
+static void pgin_rq_done(struct pgin_rq *rq, int ok)
+{
+	if (ok)
+		SetPageUptodate(rq->page);
+	else
+		SetPageError(rq->page);
+	unlock_page(rq->page);
+	put_page(rq->page);
+	list_del(&rq->list);
+	kfree(rq);
+}
+
+static void pgin_fail_list(struct pgin_device *dev, struct list_head *list)
+{
+	while (!list_empty(list)) {
+		pgin_rq_done(list_entry(list->next, struct pgin_rq, list), 0);
+		dev->failed++;
+	}
+}
+
+static void pgin_set_state(struct pgin_device *dev, int state)
+{
+	LIST_HEAD(list);
+
+	spin_lock(&dev->lock);
+	if (dev->state < state)
+		dev->state = state;
+	if (dev->state == PGIN_DEAD)
+		list_splice_init(&dev->queue, &list);
+	spin_unlock(&dev->lock);
+
+	pgin_fail_list(dev, &list);
+	wake_up(&dev->wait);
+}
+
+/* ->readpage of pseudo swap area, called with locked page in swap cache */
+static int rst_pgin_readpage(struct swap_info_struct *si, struct page *page)
+{
+	struct pgin_device *dev = si->private;
+	swp_entry_t entry = { .val = page_private(page), };
+	struct pgin_rq *rq;
+
+	rq = kmalloc(sizeof(*rq), GFP_NOIO);
+	if (rq == NULL) {
+		unlock_page(page);
+		return -ENOMEM;
+	}
+	rq->page = page;
+	rq->index = swp_offset(entry) - 1;
+
+	spin_lock(&dev->lock);
+	/* The queue of a dead device is never flushed again */
+	if (dev->state == PGIN_DEAD) {
+		spin_unlock(&dev->lock);
+		kfree(rq);
+		SetPageError(page);
+		unlock_page(page);
+		return -EIO;
+	}
+	get_page(page);
+	list_add_tail(&rq->list, &dev->queue);
+	spin_unlock(&dev->lock);
+	wake_up(&dev->wait);
+	return 0;
+}
+
+static int pgin_get_batch(struct pgin_device *dev, struct list_head *batch)
+{
+	int n = 0;
+
+	spin_lock(&dev->lock);
+	while (!list_empty(&dev->queue) && n < PGIN_BATCH) {
+		list_move_tail(dev->queue.next, batch);
+		n++;
+	}
+	spin_unlock(&dev->lock);
+	return n;
+}
+
+static int pgin_do_batch(struct pgin_device *dev, struct list_head *batch)
+{
+	struct pgin_request rq[PGIN_BATCH];
+	struct pgin_rq *r, *tmp;
+	int n = 0, err;
+
+	list_for_each_entry(r, batch, list)
+		rq[n++].rq_index = r->index;
+	err = pgin_write(dev->out, rq, n * sizeof(rq[0]));
+	if (err)
+		return err;
+
+	list_for_each_entry_safe(r, tmp, batch, list) {
+		struct pgin_reply rp;
+		char *maddr;
+
+		err = pgin_read(dev->in, &rp, sizeof(rp));
+		if (err)
+			return err;
+		if (rp.rp_index != r->index)
+			return -EPROTO;
+		if (rp.rp_status) {
+			pgin_rq_done(r, 0);
+			dev->failed++;
+			continue;
+		}
+		maddr = kmap(r->page);
+		err = pgin_read(dev->in, maddr, PAGE_SIZE);
+		kunmap(r->page);
+		if (err)
+			return err;
+		flush_dcache_page(r->page);
+		pgin_rq_done(r, 1);
+		dev->received++;
+	}
+	return 0;
+}
+
+static int rst_pgin_daemon(void *data)
+{
+	struct pgin_device *dev = data;
+	struct pgin_request rq;
+	LIST_HEAD(batch);
+	int err = 0;
+
+	allow_signal(SIGKILL);
+
+	for (;;) {
+		wait_event_interruptible(dev->wait,
+				!list_empty(&dev->queue) ||
+				dev->state != PGIN_ACTIVE);
+		if (signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+		if (!pgin_get_batch(dev, &batch)) {
+			if (dev->state != PGIN_ACTIVE)
+				break;
+			continue;
+		}
+		err = pgin_do_batch(dev, &batch);
+		if (err)
+			break;
+		cond_resched();
+	}
+
+	if (err) {
+		printk(KERN_ERR "vzpageind: pagein failed %d, %lu pages lost\n",
+		       err, dev->swp ? dev->swp->inuse_pages : 0);
+		pgin_set_state(dev, PGIN_DEAD);
+		pgin_fail_list(dev, &batch);
+	}
+	/* Release the source */
+	rq.rq_index = CPT_NULL;
+	pgin_write(dev->out, &rq, sizeof(rq));
+
+	pgin_dev_put(dev);
+	module_put_and_exit(0);
+}
+
+/* CPT_PAGEIND: start the thread, which reads lazy pages from the source */
+int rst_pageind(cpt_context_t *ctx)
+{
+	struct pgin_device *dev;
+	struct task_struct *tsk;
+
+	if (!ctx->pagein_file_in || !ctx->pagein_file_in->f_op ||
+	    !ctx->pagein_file_in->f_op->read ||
+	    !ctx->pagein_file_out || !ctx->pagein_file_out->f_op ||
+	    !ctx->pagein_file_out->f_op->write)
+		return -EBADF;
+
+	dev = rst_pgin_dev(ctx);
+	if (dev == NULL)
+		return -ENOMEM;
+	if (dev->daemon)
+		return -EBUSY;
+	if (dev->state != PGIN_ACTIVE)
+		return -ENOENT;
+
+	get_file(ctx->pagein_file_in);
+	dev->in = ctx->pagein_file_in;
+	get_file(ctx->pagein_file_out);
+	dev->out = ctx->pagein_file_out;
+
+	atomic_inc(&dev->count);
+	__module_get(THIS_MODULE);
+	tsk = kthread_create(rst_pgin_daemon, dev, "vzpageind/%d", ctx->ve_id);
+	if (IS_ERR(tsk)) {
+		module_put(THIS_MODULE);
+		pgin_dev_put(dev);
+		return PTR_ERR(tsk);
+	}
+	dev->daemon = 1;
+	if (ctx->pgin_task)
+		put_task_struct(ctx->pgin_task);
+	get_task_struct(tsk);
+	ctx->pgin_task = tsk;
+	wake_up_process(tsk);
+	return 0;
+}
+
+/* Called twice during undump, the area is created on the first call */
+int rst_setup_pagein(cpt_context_t *ctx)
+{
+	struct pgin_device *dev;
+	struct swap_info_struct *si;
+
+	if (!ctx->lazypages || ctx->pgin_swp)
+		return 0;
+
+	dev = rst_pgin_dev(ctx);
+	if (dev == NULL)
+		return -ENOMEM;
+	if (dev->state != PGIN_ACTIVE)
+		return -ENOENT;
+
+	si = swapon_pseudo(ctx->lazypages, rst_pgin_readpage, dev);
+	if (IS_ERR(si)) {
+		eprintk_ctx("cannot create pagein area: %ld\n", PTR_ERR(si));
+		return PTR_ERR(si);
+	}
+	/* The reference is held by the area */
+	atomic_inc(&dev->count);
+	dev->swp = si;
+	ctx->pgin_swp = si;
+	return 0;
+}
+
+int rst_pagein(struct vm_area_struct *vma, u64 index,
+	       unsigned long addr, cpt_context_t *ctx)
+{
+	swp_entry_t entry;
+	int err;
+
+	if (!ctx->pgin_swp || index >= ctx->lazypages) {
+		eprintk_ctx("bad lazy page %Lu\n", (unsigned long long)index);
+		return -EINVAL;
+	}
+
+	entry = get_pseudo_swap_page(ctx->pgin_swp, index + 1,
+				     mm_ub(vma->vm_mm));
+	if (!entry.val) {
+		eprintk_ctx("lazy page %Lu is mapped twice\n",
+			    (unsigned long long)index);
+		return -EEXIST;
+	}
+	err = install_swap_pte(vma, addr, entry);
+	if (err)
+		swap_free(entry);
+	return err;
+}
+
+static void rst_pgin_prefetch(struct pgin_device *dev,
+			      struct swap_info_struct *si)
+{
+	unsigned long offset;
+
+	for (offset = 1; offset < si->max; offset++) {
+		struct page *page;
+
+		if (dev->state != PGIN_ACTIVE)
+			break;
+		page = read_swap_cache_async(swp_entry(si - swap_info, offset),
+					     GFP_HIGHUSER_MOVABLE, NULL, 0);
+		if (page == NULL)
+			continue;
+		/* Do not queue more than the daemon can handle */
+		if (offset % PGIN_PREFETCH == 0)
+			wait_on_page_locked(page);
+		page_cache_release(page);
+		cond_resched();
+	}
+}
+
+static int rst_pgin_swapoff(void *data)
+{
+	struct pgin_device *dev = data;
+	struct swap_info_struct *si = dev->swp;
+	int err, warned = 0;
+
+	rst_pgin_prefetch(dev, si);
+
+	/* Pages, which cannot be read, are released only when their
+	 * owners exit. Until then the area stays and we retry.
+	 */
+	while ((err = swapoff_pseudo(si)) != 0) {
+		if (!warned++)
+			printk(KERN_WARNING "vzpagein: swapoff failed %d, "
+			       "%u pages in use\n", err, si->inuse_pages);
+		msleep(1000);
+	}
+
+	spin_lock(&dev->lock);
+	dev->swp = NULL;
+	spin_unlock(&dev->lock);
+	pgin_set_state(dev, PGIN_DONE);
+
+	/* The reference of the area */
+	pgin_dev_put(dev);
+	module_put_and_exit(0);
+}
+
+/* Start background transfer of the rest of lazy pages */
+int rst_swapoff(cpt_context_t *ctx)
+{
+	struct pgin_device *dev = ctx->pagein_dev;
+	struct task_struct *tsk;
+
+	__module_get(THIS_MODULE);
+	tsk = kthread_run(rst_pgin_swapoff, dev, "vzpagein/%d", ctx->ve_id);
+	if (IS_ERR(tsk)) {
+		module_put(THIS_MODULE);
+		eprintk_ctx("cannot start pagein: %ld\n", PTR_ERR(tsk));
+		return PTR_ERR(tsk);
+	}
+	ctx->pgin_swp = NULL;
+	return 0;
+}
+
+/*
+ * VE is resumed (@kill == 0) or killed. In the last case lazy pages
+ * are not needed anymore, reads of them fail and the area is released
+ * as soon as VE tasks exit.
+ */
+int rst_complete_pagein(cpt_context_t *ctx, int kill)
+{
+	struct pgin_device *dev = ctx->pagein_dev;
+	int err = 0;
+
+	if (dev == NULL)
+		return 0;
+
+	if (kill)
+		pgin_set_state(dev, PGIN_DEAD);
+
+	if (ctx->pgin_swp)
+		err = rst_swapoff(ctx);
+	else if (dev->swp == NULL)
+		pgin_set_state(dev, PGIN_DONE);
+	return err;
+}
+
+void rst_drop_pagein(cpt_context_t *ctx)
+{
+	struct pgin_device *dev = ctx->pagein_dev;
+
+	if (dev == NULL)
+		return;
+
+	rst_complete_pagein(ctx, ctx->pgin_swp != NULL);
+	ctx->pagein_dev = NULL;
+	pgin_dev_put(dev);
+}
+
+int pagein_info_printf(char *buf, cpt_context_t *ctx)
+{
+	struct pgin_device *dev = ctx->pagein_dev;
+	static const char *states[] = { "active", "done", "dead" };
+
+	if (dev == NULL)
+		return 0;
+	return sprintf(buf, " pagein %s %lu/%d failed %lu",
+		       states[dev->state], dev->received, ctx->lazypages,
+		       dev->failed);
+}
@@ -118,6 +118,7 @@ void rst_context_release(cpt_context_t *ctx)
 	rst_drop_iter_dir(ctx);
 #endif
 #ifdef CONFIG_VZ_CHECKPOINT_LAZY
+	rst_drop_pagein(ctx);
 	if (ctx->pagein_file_out)
 		fput(ctx->pagein_file_out);
 	if (ctx->pagein_file_in)
@@ -200,9 +200,47 @@ asmlinkage int sys_fairsched_chwt(unsigned int id, unsigned weight)
 	return retval;
 }
 
+/******************************************************************************
+ * cfs bandwidth quota = FSCH_RATE_PERIOD * rate / (1 << FSCHRATE_SHIFT)
+ *
+ * rate is the fraction of one cpu scaled by 1 << FSCHRATE_SHIFT, as vzctl
+ * sets it from cpulimit: cpulimit = 50% --> rate = 512 --> quota = 50ms
+ *
+ * vcpus packs the node onto that many cpus and also caps the quota with
+ * vcpus * FSCH_RATE_PERIOD, the smaller of the two limits wins.
+ *****************************************************************************/
+
+#define FSCH_RATE_PERIOD	100000	/* usec */
+#define FSCH_RATE_MIN_QUOTA	1000	/* usec */
+
+#ifdef CONFIG_CFS_BANDWIDTH
+static int fairsched_set_quota(struct fairsched_node *node, unsigned rate,
+		unsigned vcpus)
+{
+	long quota = -1;
+
+	if (rate) {
+		quota = ((u64)rate * FSCH_RATE_PERIOD) >> FSCHRATE_SHIFT;
+		if (quota < FSCH_RATE_MIN_QUOTA)
+			quota = FSCH_RATE_MIN_QUOTA;
+	}
+	if (vcpus && vcpus < nr_cpu_ids &&
+	    (quota < 0 || quota > (long)vcpus * FSCH_RATE_PERIOD))
+		quota = (long)vcpus * FSCH_RATE_PERIOD;
+	return sched_group_set_cfs_quota(node->tg, quota);
+}
+#else
+static inline int fairsched_set_quota(struct fairsched_node *node,
+		unsigned rate, unsigned vcpus)
+{
+	return 0;
+}
+#endif
+
 static int do_fairsched_vcpus(unsigned int id, unsigned int vcpus)
 {
 	struct fairsched_node *node;
+	int retval;
 
 	if (id == 0)
 		return -EINVAL;
@@ -211,6 +249,15 @@ static int do_fairsched_vcpus(unsigned int id, unsigned int vcpus)
 	if (node == NULL)
 		return -ENOENT;
 
+	retval = fairsched_set_quota(node, node->rate, vcpus);
+	if (retval)
+		return retval;
+
+	retval = sched_group_set_vcpus(node->tg, vcpus);
+	if (retval)
+		return retval;
+
+	node->vcpus = vcpus;
 	return 0;
 }
 
@@ -246,11 +293,17 @@ static int do_fairsched_rate(unsigned int id, int op, unsigned rate)
 	retval = -EINVAL;
 	switch (op) {
 	case FAIRSCHED_SET_RATE:
+		retval = fairsched_set_quota(node, rate, node->vcpus);
+		if (retval)
+			break;
 		node->rate = rate;
 		node->rate_limited = 1;
 		retval = rate;
 		break;
 	case FAIRSCHED_DROP_RATE:
+		retval = fairsched_set_quota(node, 0, node->vcpus);
+		if (retval)
+			break;
 		node->rate = 0;
 		node->rate_limited = 0;
 		retval = 0;
@@ -342,13 +395,11 @@ int fairsched_new_node(int id, unsigned int vcpus)
 		printk(KERN_WARNING "Can't create fairsched node %d\n", id);
 		goto out;
 	}
-#if 0
 	err = do_fairsched_vcpus(id, vcpus);
 	if (err) {
 		printk(KERN_WARNING "Can't set sched vcpus on node %d\n", id);
 		goto cleanup;
 	}
-#endif
 	err = do_fairsched_mvpr(current->pid, id);
 	if (err) {
 		printk(KERN_WARNING "Can't switch to fairsched node %d\n", id);
@@ -435,7 +486,7 @@ static struct fairsched_dump *fairsched_do_dump(int compat)
 		p->weight = node->weight;
 		p->rate = node->rate;
 		p->rate_limited = node->rate_limited;
-		p->nr_pcpu = num_online_cpus();
+		p->nr_pcpu = node->vcpus ? : num_online_cpus();
 		p++;
 	}
 	dump->len = p - dump->nodes;
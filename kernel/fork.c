@@ -560,7 +560,7 @@ void mmput(struct mm_struct *mm)
 			module_put(mm->binfmt->module);
 		(void) virtinfo_gencall(VIRTINFO_EXITMMAP, mm);
 		if (mm->oom_killed)
-			ub_oom_task_dead(current);
+			ub_oom_task_dead(mm);
 		mmdrop(mm);
 	}
 }
@@ -243,6 +243,92 @@ struct cfs_rq;
 
 static LIST_HEAD(task_groups);
 
+#ifdef CONFIG_CFS_BANDWIDTH
+struct cfs_bandwidth {
+	/* nests inside the rq lock: */
+	spinlock_t		lock;
+	ktime_t			period;
+	u64			quota;
+	/* runtime left in the pool for the current period */
+	u64			runtime;
+	int			idle, timer_active;
+	struct hrtimer		period_timer;
+	struct list_head	throttled_cfs_rq;
+};
+
+static int do_sched_cfs_period_timer(struct cfs_bandwidth *cfs_b, int overrun);
+
+static enum hrtimer_restart sched_cfs_period_timer(struct hrtimer *timer)
+{
+	struct cfs_bandwidth *cfs_b =
+		container_of(timer, struct cfs_bandwidth, period_timer);
+	ktime_t now;
+	int overrun;
+	int idle = 0;
+
+	for (;;) {
+		now = hrtimer_cb_get_time(timer);
+		overrun = hrtimer_forward(timer, now, cfs_b->period);
+
+		if (!overrun)
+			break;
+
+		idle = do_sched_cfs_period_timer(cfs_b, overrun);
+		/*
+		 * Once timer_active is cleared, the timer may be restarted
+		 * by __start_cfs_bandwidth() and must not be touched here.
+		 */
+		if (idle)
+			break;
+	}
+
+	return idle ? HRTIMER_NORESTART : HRTIMER_RESTART;
+}
+
+/* 100ms, as the default rt period */
+static inline u64 default_cfs_period(void)
+{
+	return 100000000ULL;
+}
+
+static void init_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
+{
+	spin_lock_init(&cfs_b->lock);
+	cfs_b->runtime = 0;
+	cfs_b->quota = RUNTIME_INF;
+	cfs_b->period = ns_to_ktime(default_cfs_period());
+	INIT_LIST_HEAD(&cfs_b->throttled_cfs_rq);
+
+	hrtimer_init(&cfs_b->period_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	cfs_b->period_timer.function = sched_cfs_period_timer;
+}
+
+/* cfs_b->lock should be held, the timer should be inactive */
+static void __start_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
+{
+	unsigned long delta;
+	ktime_t now, soft, hard;
+
+	cfs_b->timer_active = 1;
+
+	now = hrtimer_cb_get_time(&cfs_b->period_timer);
+	hrtimer_forward(&cfs_b->period_timer, now, cfs_b->period);
+
+	soft = hrtimer_get_softexpires(&cfs_b->period_timer);
+	hard = hrtimer_get_expires(&cfs_b->period_timer);
+	delta = ktime_to_ns(ktime_sub(hard, soft));
+	/* no softirq wakeup, we may be under the rq lock */
+	__hrtimer_start_range_ns(&cfs_b->period_timer, soft, delta,
+			HRTIMER_MODE_ABS_PINNED, 0);
+}
+
+static void destroy_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
+{
+	hrtimer_cancel(&cfs_b->period_timer);
+}
+#endif
+
+
 /* task group related information */
 struct task_group {
 #ifdef CONFIG_CGROUP_SCHED
@@ -259,6 +345,13 @@ struct task_group {
 	/* runqueue "owned" by this group on each cpu */
 	struct cfs_rq **cfs_rq;
 	unsigned long shares;
+	/* max number of cpus to run the group on at once, 0 - no limit */
+	unsigned int vcpus;
+	/* number of cpus the group has runnable tasks on */
+	atomic_t nr_cpus_busy;
+#ifdef CONFIG_CFS_BANDWIDTH
+	struct cfs_bandwidth cfs_bandwidth;
+#endif
 #endif
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -392,7 +485,8 @@ static inline struct task_group *task_group(struct task_struct *p)
 /* CFS-related fields in a runqueue */
 struct cfs_rq {
 	struct load_weight load;
-	unsigned long nr_running;
+	/* h_nr_running counts the tasks of the whole hierarchy below */
+	unsigned long nr_running, h_nr_running;
 
 	u64 exec_clock;
 	u64 min_vruntime;
@@ -424,6 +518,8 @@ struct cfs_rq {
 	 */
 	struct list_head leaf_cfs_rq_list;
 	struct task_group *tg;	/* group that "owns" this runqueue */
+	/* the cfs_rq is counted in tg->nr_cpus_busy */
+	int vcpus_counted;
 
 #ifdef CONFIG_SMP
 	/*
@@ -449,6 +545,13 @@ struct cfs_rq {
 	 */
 	unsigned long rq_weight;
 #endif
+#ifdef CONFIG_CFS_BANDWIDTH
+	int runtime_enabled;
+	s64 runtime_remaining;
+
+	int throttled;
+	struct list_head throttled_list;
+#endif
 #endif
 };
 
@@ -2073,17 +2176,8 @@ static inline void __set_task_cpu(struct task_struct *p, unsigned int cpu)
 }
 
 #include "sched_stats.h"
-#include "sched_idletask.c"
-#include "sched_fair.c"
-#include "sched_rt.c"
-#ifdef CONFIG_SCHED_DEBUG
-# include "sched_debug.c"
-#endif
-
-#define sched_class_highest (&rt_sched_class)
-#define for_each_class(class) \
-   for (class = sched_class_highest; class; class = class->next)
 
+/* called by the classes, which know when the task is runnable */
 static void inc_nr_running(struct rq *rq)
 {
 	rq->nr_running++;
@@ -2094,6 +2188,17 @@ static void dec_nr_running(struct rq *rq)
 	rq->nr_running--;
 }
 
+#include "sched_idletask.c"
+#include "sched_fair.c"
+#include "sched_rt.c"
+#ifdef CONFIG_SCHED_DEBUG
+# include "sched_debug.c"
+#endif
+
+#define sched_class_highest (&rt_sched_class)
+#define for_each_class(class) \
+   for (class = sched_class_highest; class; class = class->next)
+
 static void set_load_weight(struct task_struct *p)
 {
 	if (task_has_rt_policy(p)) {
@@ -2214,7 +2319,6 @@ static void activate_task(struct rq *rq, struct task_struct *p, int wakeup)
 	}
 
 	enqueue_task(rq, p, wakeup, false);
-	inc_nr_running(rq);
 	ve_nr_running_inc(VE_TASK_INFO(p)->owner_env, task_cpu(p), cycles);
 }
 
@@ -2246,7 +2350,6 @@ static void deactivate_task(struct rq *rq, struct task_struct *p, int sleep)
 	}
 
 	dequeue_task(rq, p, sleep);
-	dec_nr_running(rq);
 	ve_nr_running_dec(VE_TASK_INFO(p)->owner_env, cpu, cycles);
 }
 
@@ -3659,6 +3762,9 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 		return 0;
 	}
 
+	if (!can_migrate_vcpu(p, cpu_of(rq), this_cpu))
+		return 0;
+
 	/*
 	 * Aggressive migration if:
 	 * 1) task is cache cold, or
@@ -9815,6 +9921,9 @@ static void init_cfs_rq(struct cfs_rq *cfs_rq, struct rq *rq)
 	INIT_LIST_HEAD(&cfs_rq->tasks);
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	cfs_rq->rq = rq;
+#endif
+#ifdef CONFIG_CFS_BANDWIDTH
+	INIT_LIST_HEAD(&cfs_rq->throttled_list);
 #endif
 	cfs_rq->min_vruntime = (u64)(-(1LL << 20));
 }
@@ -9992,6 +10101,13 @@ void __init sched_init(void)
 #endif /* CONFIG_USER_SCHED */
 #endif /* CONFIG_RT_GROUP_SCHED */
 
+#ifdef CONFIG_CFS_BANDWIDTH
+	init_cfs_bandwidth(&init_task_group.cfs_bandwidth);
+#ifdef CONFIG_USER_SCHED
+	init_cfs_bandwidth(&root_task_group.cfs_bandwidth);
+#endif /* CONFIG_USER_SCHED */
+#endif /* CONFIG_CFS_BANDWIDTH */
+
 #ifdef CONFIG_GROUP_SCHED
 	list_add(&init_task_group.list, &task_groups);
 	INIT_LIST_HEAD(&init_task_group.children);
@@ -10326,6 +10442,9 @@ int alloc_fair_sched_group(struct task_group *tg, struct task_group *parent)
 		goto err;
 
 	tg->shares = NICE_0_LOAD;
+#ifdef CONFIG_CFS_BANDWIDTH
+	init_cfs_bandwidth(&tg->cfs_bandwidth);
+#endif
 
 	for_each_possible_cpu(i) {
 		rq = cpu_rq(i);
@@ -10535,6 +10654,11 @@ void sched_destroy_group(struct task_group *tg)
 	list_del_rcu(&tg->siblings);
 	spin_unlock_irqrestore(&task_group_lock, flags);
 
+#ifdef CONFIG_CFS_BANDWIDTH
+	/* the group is empty, nobody can restart the timer */
+	destroy_cfs_bandwidth(&tg->cfs_bandwidth);
+#endif
+
 	/* wait for possible concurrent references to cfs_rqs complete */
 	call_rcu(&tg->rcu, free_sched_group_rcu);
 }
@@ -10668,8 +10792,151 @@ unsigned long sched_group_shares(struct task_group *tg)
 {
 	return tg->shares;
 }
+
+/*
+ * Limit the number of cpus the group runs on at once: the wakeup and
+ * load balancing paths pack the group onto the cpus it already occupies.
+ */
+int sched_group_set_vcpus(struct task_group *tg, unsigned int vcpus)
+{
+	unsigned long flags;
+	int i;
+
+	if (!tg->se[0])
+		return -EINVAL;
+
+	mutex_lock(&shares_mutex);
+	tg->vcpus = vcpus < nr_cpu_ids ? vcpus : 0;
+
+	/*
+	 * nr_cpus_busy is not maintained while the group is not limited,
+	 * bring it in sync with the cfs_rqs of the group.
+	 */
+	for_each_possible_cpu(i) {
+		struct rq *rq = cpu_rq(i);
+		struct cfs_rq *cfs_rq = tg->cfs_rq[i];
+
+		spin_lock_irqsave(&rq->lock, flags);
+		if (tg->vcpus && cfs_rq->nr_running && !cfs_rq->vcpus_counted) {
+			cfs_rq->vcpus_counted = 1;
+			atomic_inc(&tg->nr_cpus_busy);
+		} else if (!tg->vcpus && cfs_rq->vcpus_counted) {
+			cfs_rq->vcpus_counted = 0;
+			atomic_dec(&tg->nr_cpus_busy);
+		}
+		spin_unlock_irqrestore(&rq->lock, flags);
+	}
+	mutex_unlock(&shares_mutex);
+	return 0;
+}
+
+unsigned int sched_group_vcpus(struct task_group *tg)
+{
+	return tg->vcpus;
+}
 #endif
 
+#ifdef CONFIG_CFS_BANDWIDTH
+static DEFINE_MUTEX(cfs_constraints_mutex);
+
+static const u64 max_cfs_quota_period = 1 * NSEC_PER_SEC; /* 1s */
+static const u64 min_cfs_quota_period = 1 * NSEC_PER_MSEC; /* 1ms */
+
+static int tg_set_cfs_bandwidth(struct task_group *tg, u64 period, u64 quota)
+{
+	struct cfs_bandwidth *cfs_b = &tg->cfs_bandwidth;
+	int i, runtime_enabled;
+
+	/*
+	 * Tasks of the root group are queued to rq->cfs directly,
+	 * it can not be throttled.
+	 */
+	if (!tg->se[0])
+		return -EINVAL;
+
+	if (quota < min_cfs_quota_period || period < min_cfs_quota_period)
+		return -EINVAL;
+	if (period > max_cfs_quota_period)
+		return -EINVAL;
+
+	runtime_enabled = quota != RUNTIME_INF;
+
+	mutex_lock(&cfs_constraints_mutex);
+	spin_lock_irq(&cfs_b->lock);
+	cfs_b->period = ns_to_ktime(period);
+	cfs_b->quota = quota;
+	cfs_b->runtime = quota;
+	if (runtime_enabled && !cfs_b->timer_active)
+		__start_cfs_bandwidth(cfs_b);
+	spin_unlock_irq(&cfs_b->lock);
+
+	for_each_possible_cpu(i) {
+		struct cfs_rq *cfs_rq = tg->cfs_rq[i];
+		struct rq *rq = rq_of(cfs_rq);
+
+		spin_lock_irq(&rq->lock);
+		cfs_rq->runtime_enabled = runtime_enabled;
+		cfs_rq->runtime_remaining = 0;
+
+		if (cfs_rq_throttled(cfs_rq))
+			unthrottle_cfs_rq(cfs_rq);
+		spin_unlock_irq(&rq->lock);
+	}
+	mutex_unlock(&cfs_constraints_mutex);
+
+	return 0;
+}
+
+int sched_group_set_cfs_quota(struct task_group *tg, long cfs_quota_us)
+{
+	u64 quota, period;
+
+	period = ktime_to_ns(tg->cfs_bandwidth.period);
+	if (cfs_quota_us < 0)
+		quota = RUNTIME_INF;
+	else
+		quota = (u64)cfs_quota_us * NSEC_PER_USEC;
+
+	return tg_set_cfs_bandwidth(tg, period, quota);
+}
+
+long sched_group_cfs_quota(struct task_group *tg)
+{
+	u64 quota_us;
+
+	if (tg->cfs_bandwidth.quota == RUNTIME_INF)
+		return -1;
+
+	quota_us = tg->cfs_bandwidth.quota;
+	do_div(quota_us, NSEC_PER_USEC);
+
+	return quota_us;
+}
+
+int sched_group_set_cfs_period(struct task_group *tg, long cfs_period_us)
+{
+	u64 quota, period;
+
+	if (cfs_period_us <= 0)
+		return -EINVAL;
+
+	period = (u64)cfs_period_us * NSEC_PER_USEC;
+	quota = tg->cfs_bandwidth.quota;
+
+	return tg_set_cfs_bandwidth(tg, period, quota);
+}
+
+long sched_group_cfs_period(struct task_group *tg)
+{
+	u64 cfs_period_us;
+
+	cfs_period_us = ktime_to_ns(tg->cfs_bandwidth.period);
+	do_div(cfs_period_us, NSEC_PER_USEC);
+
+	return cfs_period_us;
+}
+#endif /* CONFIG_CFS_BANDWIDTH */
+
 #ifdef CONFIG_RT_GROUP_SCHED
 /*
  * Ensure that the real time constraints are schedulable.
@@ -254,6 +254,81 @@ find_matching_se(struct sched_entity **se, struct sched_entity **pse)
 
 #endif	/* CONFIG_FAIR_GROUP_SCHED */
 
+#ifdef CONFIG_CFS_BANDWIDTH
+static void account_cfs_rq_runtime(struct cfs_rq *cfs_rq,
+				   unsigned long delta_exec);
+static void check_cfs_rq_runtime(struct cfs_rq *cfs_rq);
+static void check_enqueue_throttle(struct cfs_rq *cfs_rq);
+static void unthrottle_offline_cfs_rqs(struct rq *rq);
+
+static inline int cfs_rq_throttled(struct cfs_rq *cfs_rq)
+{
+	return cfs_rq->throttled;
+}
+
+/* is cfs_rq or any of its parents throttled? */
+static inline int throttled_hierarchy(struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *se;
+
+	if (cfs_rq_throttled(cfs_rq))
+		return 1;
+
+	se = cfs_rq->tg->se[cpu_of(rq_of(cfs_rq))];
+	for_each_sched_entity(se)
+		if (cfs_rq_throttled(cfs_rq_of(se)))
+			return 1;
+	return 0;
+}
+#else
+static inline void account_cfs_rq_runtime(struct cfs_rq *cfs_rq,
+					  unsigned long delta_exec) {}
+static inline void check_cfs_rq_runtime(struct cfs_rq *cfs_rq) {}
+static inline void check_enqueue_throttle(struct cfs_rq *cfs_rq) {}
+static inline void unthrottle_offline_cfs_rqs(struct rq *rq) {}
+
+static inline int cfs_rq_throttled(struct cfs_rq *cfs_rq)
+{
+	return 0;
+}
+
+static inline int throttled_hierarchy(struct cfs_rq *cfs_rq)
+{
+	return 0;
+}
+#endif	/* CONFIG_CFS_BANDWIDTH */
+
+#ifdef CONFIG_FAIR_GROUP_SCHED
+/*
+ * tg->nr_cpus_busy counts the cpus where the group's cfs_rq is not empty,
+ * it is what the vcpus limit of the group is checked against. Only groups
+ * with the limit set are counted, cfs_rq->vcpus_counted tells whether the
+ * cfs_rq is in the count, see sched_group_set_vcpus().
+ */
+static inline void
+account_vcpus_enqueue(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	if (cfs_rq->tg->vcpus && cfs_rq->nr_running == 1) {
+		cfs_rq->vcpus_counted = 1;
+		atomic_inc(&cfs_rq->tg->nr_cpus_busy);
+	}
+}
+
+static inline void
+account_vcpus_dequeue(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	if (cfs_rq->vcpus_counted && cfs_rq->nr_running == 0) {
+		cfs_rq->vcpus_counted = 0;
+		atomic_dec(&cfs_rq->tg->nr_cpus_busy);
+	}
+}
+#else
+static inline void
+account_vcpus_enqueue(struct cfs_rq *cfs_rq, struct sched_entity *se) {}
+static inline void
+account_vcpus_dequeue(struct cfs_rq *cfs_rq, struct sched_entity *se) {}
+#endif	/* CONFIG_FAIR_GROUP_SCHED */
+
 
 /**************************************************************
  * Scheduling class tree data structure manipulation methods:
@@ -521,6 +596,8 @@ static void update_curr(struct cfs_rq *cfs_rq)
 		cpuacct_charge(curtask, delta_exec);
 		account_group_exec_runtime(curtask, delta_exec);
 	}
+
+	account_cfs_rq_runtime(cfs_rq, delta_exec);
 }
 
 static inline void
@@ -610,6 +687,7 @@ account_entity_enqueue(struct cfs_rq *cfs_rq, struct sched_entity *se)
 		list_add(&se->group_node, &cfs_rq->tasks);
 	}
 	cfs_rq->nr_running++;
+	account_vcpus_enqueue(cfs_rq, se);
 	se->on_rq = 1;
 }
 
@@ -624,6 +702,7 @@ account_entity_dequeue(struct cfs_rq *cfs_rq, struct sched_entity *se)
 		list_del_init(&se->group_node);
 	}
 	cfs_rq->nr_running--;
+	account_vcpus_dequeue(cfs_rq, se);
 	se->on_rq = 0;
 }
 
@@ -772,6 +851,9 @@ enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	check_spread(cfs_rq, se);
 	if (se != cfs_rq->curr)
 		__enqueue_entity(cfs_rq, se);
+
+	if (cfs_rq->nr_running == 1)
+		check_enqueue_throttle(cfs_rq);
 }
 
 static void __clear_buddies(struct cfs_rq *cfs_rq, struct sched_entity *se)
@@ -928,6 +1010,9 @@ static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
 	if (prev->on_rq)
 		update_curr(cfs_rq);
 
+	/* throttle cfs_rqs exceeding runtime */
+	check_cfs_rq_runtime(cfs_rq);
+
 	check_spread(cfs_rq, prev);
 	if (prev->on_rq) {
 		update_stats_wait_start(cfs_rq, prev);
@@ -966,6 +1051,286 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 		check_preempt_tick(cfs_rq, curr);
 }
 
+#ifdef CONFIG_CFS_BANDWIDTH
+/**************************************************
+ * CFS bandwidth control:
+ *
+ * A group may run for cfs_b->quota per cfs_b->period in total over all
+ * cpus. The period timer refills the global pool, and every cpu borrows
+ * runtime from it in slices of sysctl_sched_cfs_bandwidth_slice, so that
+ * cfs_b->lock is taken once per slice rather than on every update. A
+ * cfs_rq which has run out of runtime and cannot get more from the pool
+ * is throttled: its entity is dequeued until the timer hands out runtime
+ * of the next period.
+ */
+
+/* default slice is 5 msec */
+unsigned int sysctl_sched_cfs_bandwidth_slice = 5000UL;
+
+static inline u64 sched_cfs_bandwidth_slice(void)
+{
+	return (u64)sysctl_sched_cfs_bandwidth_slice * NSEC_PER_USEC;
+}
+
+/* returns 0 when no runtime is left in the pool */
+static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
+{
+	struct cfs_bandwidth *cfs_b = &cfs_rq->tg->cfs_bandwidth;
+	u64 amount = 0, min_amount;
+
+	/* runtime_remaining <= 0 here, so this is a positive sum */
+	min_amount = sched_cfs_bandwidth_slice() - cfs_rq->runtime_remaining;
+
+	spin_lock(&cfs_b->lock);
+	if (cfs_b->quota == RUNTIME_INF)
+		amount = min_amount;
+	else {
+		/* the timer has gone idle, restart it with a full pool */
+		if (!cfs_b->timer_active) {
+			cfs_b->runtime = cfs_b->quota;
+			__start_cfs_bandwidth(cfs_b);
+		}
+
+		if (cfs_b->runtime > 0) {
+			amount = min(cfs_b->runtime, min_amount);
+			cfs_b->runtime -= amount;
+			cfs_b->idle = 0;
+		}
+	}
+	spin_unlock(&cfs_b->lock);
+
+	cfs_rq->runtime_remaining += amount;
+
+	return cfs_rq->runtime_remaining > 0;
+}
+
+static void account_cfs_rq_runtime(struct cfs_rq *cfs_rq,
+				   unsigned long delta_exec)
+{
+	if (!cfs_rq->runtime_enabled)
+		return;
+
+	cfs_rq->runtime_remaining -= delta_exec;
+	if (likely(cfs_rq->runtime_remaining > 0))
+		return;
+
+	/*
+	 * If the runtime cannot be extended, reschedule, so that
+	 * put_prev_entity() throttles the running hierarchy.
+	 */
+	if (!assign_cfs_rq_runtime(cfs_rq) && likely(cfs_rq->curr))
+		resched_task(rq_of(cfs_rq)->curr);
+}
+
+static void throttle_cfs_rq(struct cfs_rq *cfs_rq)
+{
+	struct rq *rq = rq_of(cfs_rq);
+	struct cfs_bandwidth *cfs_b = &cfs_rq->tg->cfs_bandwidth;
+	struct sched_entity *se;
+	long task_delta, dequeue = 1;
+
+	se = cfs_rq->tg->se[cpu_of(rq)];
+	task_delta = cfs_rq->h_nr_running;
+	for_each_sched_entity(se) {
+		struct cfs_rq *qcfs_rq = cfs_rq_of(se);
+
+		/* the group entity may be off the tree already */
+		if (!se->on_rq)
+			break;
+
+		if (dequeue)
+			dequeue_entity(qcfs_rq, se, 1);
+		qcfs_rq->h_nr_running -= task_delta;
+
+		/* parent has other entities besides us */
+		if (qcfs_rq->load.weight)
+			dequeue = 0;
+	}
+
+	/* the throttled tasks are not runnable any longer */
+	if (!se)
+		rq->nr_running -= task_delta;
+
+	cfs_rq->throttled = 1;
+	spin_lock(&cfs_b->lock);
+	list_add_tail_rcu(&cfs_rq->throttled_list, &cfs_b->throttled_cfs_rq);
+	spin_unlock(&cfs_b->lock);
+}
+
+static void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
+{
+	struct rq *rq = rq_of(cfs_rq);
+	struct cfs_bandwidth *cfs_b = &cfs_rq->tg->cfs_bandwidth;
+	struct sched_entity *se;
+	long task_delta, enqueue = 1;
+
+	se = cfs_rq->tg->se[cpu_of(rq)];
+
+	cfs_rq->throttled = 0;
+	spin_lock(&cfs_b->lock);
+	list_del_rcu(&cfs_rq->throttled_list);
+	spin_unlock(&cfs_b->lock);
+
+	if (!cfs_rq->load.weight)
+		return;
+
+	update_rq_clock(rq);
+	task_delta = cfs_rq->h_nr_running;
+	for_each_sched_entity(se) {
+		if (se->on_rq)
+			enqueue = 0;
+
+		cfs_rq = cfs_rq_of(se);
+		if (enqueue)
+			enqueue_entity(cfs_rq, se, ENQUEUE_WAKEUP);
+		cfs_rq->h_nr_running += task_delta;
+
+		if (cfs_rq_throttled(cfs_rq))
+			break;
+	}
+
+	if (!se)
+		rq->nr_running += task_delta;
+
+	/* the cpu may have gone idle because of the throttling */
+	if (rq->curr == rq->idle && rq->cfs.nr_running)
+		resched_task(rq->curr);
+}
+
+/*
+ * Hands out up to @remaining runtime to throttled cfs_rqs, returns
+ * the amount actually given.
+ */
+static u64 distribute_cfs_runtime(struct cfs_bandwidth *cfs_b, u64 remaining)
+{
+	struct cfs_rq *cfs_rq;
+	u64 runtime, starting_runtime = remaining;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(cfs_rq, &cfs_b->throttled_cfs_rq,
+				throttled_list) {
+		struct rq *rq = rq_of(cfs_rq);
+
+		spin_lock(&rq->lock);
+		if (!cfs_rq_throttled(cfs_rq))
+			goto next;
+
+		runtime = -cfs_rq->runtime_remaining + 1;
+		if (runtime > remaining)
+			runtime = remaining;
+		remaining -= runtime;
+
+		cfs_rq->runtime_remaining += runtime;
+		if (cfs_rq->runtime_remaining > 0)
+			unthrottle_cfs_rq(cfs_rq);
+next:
+		spin_unlock(&rq->lock);
+
+		if (!remaining)
+			break;
+	}
+	rcu_read_unlock();
+
+	return starting_runtime - remaining;
+}
+
+/*
+ * Called by the period timer with interrupts disabled. Returns 1 when
+ * the group has been idle for a whole period and the timer can be stopped.
+ */
+static int do_sched_cfs_period_timer(struct cfs_bandwidth *cfs_b, int overrun)
+{
+	u64 runtime;
+	int idle = 1, throttled;
+
+	spin_lock(&cfs_b->lock);
+	/* no need to continue the timer with no bandwidth constraint */
+	if (cfs_b->quota == RUNTIME_INF)
+		goto out_unlock;
+
+	throttled = !list_empty(&cfs_b->throttled_cfs_rq);
+	idle = cfs_b->idle && !throttled;
+	if (idle)
+		goto out_unlock;
+
+	cfs_b->runtime = cfs_b->quota;
+	if (!throttled) {
+		/* mark as potentially idle for the upcoming period */
+		cfs_b->idle = 1;
+		goto out_unlock;
+	}
+
+	/*
+	 * cfs_b->lock nests inside rq->lock, so it is dropped while the
+	 * runtime is distributed; other cpus may consume the pool meanwhile.
+	 */
+	while (throttled && cfs_b->runtime > 0) {
+		runtime = cfs_b->runtime;
+		spin_unlock(&cfs_b->lock);
+		runtime = distribute_cfs_runtime(cfs_b, runtime);
+		spin_lock(&cfs_b->lock);
+
+		throttled = !list_empty(&cfs_b->throttled_cfs_rq);
+		cfs_b->runtime -= min(runtime, cfs_b->runtime);
+	}
+	cfs_b->idle = 0;
+
+out_unlock:
+	if (idle)
+		cfs_b->timer_active = 0;
+	spin_unlock(&cfs_b->lock);
+
+	return idle;
+}
+
+static void check_cfs_rq_runtime(struct cfs_rq *cfs_rq)
+{
+	if (!cfs_rq->runtime_enabled || cfs_rq->runtime_remaining > 0)
+		return;
+
+	if (cfs_rq_throttled(cfs_rq))
+		return;
+
+	throttle_cfs_rq(cfs_rq);
+}
+
+/*
+ * A group becoming runnable is checked here. A running group is handled
+ * by the update_curr() -> put_prev_entity() path.
+ */
+static void check_enqueue_throttle(struct cfs_rq *cfs_rq)
+{
+	if (!cfs_rq->runtime_enabled || cfs_rq->curr)
+		return;
+
+	if (cfs_rq_throttled(cfs_rq))
+		return;
+
+	/* refresh the runtime from the pool */
+	account_cfs_rq_runtime(cfs_rq, 0);
+	if (cfs_rq->runtime_remaining <= 0)
+		throttle_cfs_rq(cfs_rq);
+}
+
+/*
+ * The cpu is going down: throttled tasks must be able to run, so that
+ * they can be picked and migrated away.
+ */
+static void unthrottle_offline_cfs_rqs(struct rq *rq)
+{
+	struct cfs_rq *cfs_rq;
+
+	for_each_leaf_cfs_rq(rq, cfs_rq) {
+		if (!cfs_rq->runtime_enabled)
+			continue;
+
+		cfs_rq->runtime_remaining = 1;
+		if (cfs_rq_throttled(cfs_rq))
+			unthrottle_cfs_rq(cfs_rq);
+	}
+}
+#endif	/* CONFIG_CFS_BANDWIDTH */
+
 /**************************************************
  * CFS operations on tasks:
  */
@@ -1027,9 +1392,9 @@ static inline void hrtick_update(struct rq *rq)
 #endif
 
 /*
- * The enqueue_task method is called before nr_running is
- * increased. Here we update the fair scheduling stats and
- * then put the task into the rbtree:
+ * The enqueue_task method updates the fair scheduling stats,
+ * puts the task into the rbtree and increases rq->nr_running,
+ * unless the task's hierarchy is throttled:
  */
 static void
 enqueue_task_fair(struct rq *rq, struct task_struct *p, int wakeup, bool head)
@@ -1048,16 +1413,31 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int wakeup, bool head)
 			break;
 		cfs_rq = cfs_rq_of(se);
 		enqueue_entity(cfs_rq, se, flags);
+		/* a throttled group is enqueued when runtime is refilled */
+		if (cfs_rq_throttled(cfs_rq))
+			break;
+		cfs_rq->h_nr_running++;
 		flags = ENQUEUE_WAKEUP;
 	}
 
+	/* the rest of the hierarchy is queued already */
+	for_each_sched_entity(se) {
+		cfs_rq = cfs_rq_of(se);
+		cfs_rq->h_nr_running++;
+		if (cfs_rq_throttled(cfs_rq))
+			break;
+	}
+
+	if (!se)
+		inc_nr_running(rq);
+
 	hrtick_update(rq);
 }
 
 /*
- * The dequeue_task method is called before nr_running is
- * decreased. We remove the task from the rbtree and
- * update the fair scheduling stats:
+ * The dequeue_task method removes the task from the rbtree,
+ * updates the fair scheduling stats and decreases nr_running.
+ * A task of a throttled hierarchy is not counted there:
  */
 static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int sleep)
 {
@@ -1067,12 +1447,28 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int sleep)
 	for_each_sched_entity(se) {
 		cfs_rq = cfs_rq_of(se);
 		dequeue_entity(cfs_rq, se, sleep);
+		/* the entity of a throttled group is not queued */
+		if (cfs_rq_throttled(cfs_rq))
+			break;
+		cfs_rq->h_nr_running--;
 		/* Don't dequeue parent if it has other entities besides us */
-		if (cfs_rq->load.weight)
+		if (cfs_rq->load.weight) {
+			se = parent_entity(se);
 			break;
+		}
 		sleep = 1;
 	}
 
+	for_each_sched_entity(se) {
+		cfs_rq = cfs_rq_of(se);
+		cfs_rq->h_nr_running--;
+		if (cfs_rq_throttled(cfs_rq))
+			break;
+	}
+
+	if (!se)
+		dec_nr_running(rq);
+
 	hrtick_update(rq);
 }
 
@@ -1433,6 +1829,74 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	return target;
 }
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+/*
+ * Once a group limited to tg->vcpus cpus runs on that many of them, its
+ * tasks are woken up on one of those cpus only. The nearest one to prev_cpu
+ * in the domain hierarchy is taken, so that the task stays within the cache
+ * or at least the node it ran on, and among equally near ones the one with
+ * the fewest tasks of the group.
+ *
+ * Returns -1 if the group may take one more cpu.
+ */
+static int select_vcpu(struct task_struct *p, int prev_cpu)
+{
+	struct task_group *tg = task_group(p);
+	struct sched_domain *sd;
+	unsigned long nr, min_nr = ULONG_MAX;
+	int i, target = -1;
+
+	if (!tg->vcpus || atomic_read(&tg->nr_cpus_busy) < tg->vcpus)
+		return -1;
+
+	for_each_domain(prev_cpu, sd) {
+		for_each_cpu_and(i, sched_domain_span(sd), &p->cpus_allowed) {
+			nr = tg->cfs_rq[i]->nr_running;
+			if (!nr)
+				continue;
+			if (nr < min_nr || (nr == min_nr && i == prev_cpu)) {
+				min_nr = nr;
+				target = i;
+			}
+		}
+		if (target != -1)
+			break;
+	}
+
+	return target;
+}
+
+/*
+ * can_migrate_task() helper: the balancer must not spread a vcpus limited
+ * group to one more cpu, unless the source cpu is left free of it.
+ */
+static int can_migrate_vcpu(struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	struct task_group *tg;
+
+	if (p->sched_class != &fair_sched_class)
+		return 1;
+
+	tg = task_group(p);
+	if (!tg->vcpus || tg->cfs_rq[dst_cpu]->nr_running ||
+	    tg->cfs_rq[src_cpu]->nr_running <= 1)
+		return 1;
+
+	return atomic_read(&tg->nr_cpus_busy) < tg->vcpus;
+}
+#else
+static inline int select_vcpu(struct task_struct *p, int prev_cpu)
+{
+	return -1;
+}
+
+static inline int
+can_migrate_vcpu(struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	return 1;
+}
+#endif	/* CONFIG_FAIR_GROUP_SCHED */
+
 /*
  * sched_balance_self: balance the current task (running on cpu) in domains
  * that have the 'flag' flag set. In practice, this is SD_BALANCE_FORK and
@@ -1455,6 +1919,11 @@ select_task_rq_fair(struct rq *rq, struct task_struct *p, int sd_flag, int wake_
 	int want_sd = 1;
 	int sync = wake_flags & WF_SYNC;
 
+	new_cpu = select_vcpu(p, prev_cpu);
+	if (new_cpu != -1)
+		return new_cpu;
+	new_cpu = cpu;
+
 	if (sd_flag & SD_BALANCE_WAKE) {
 		if (sched_feat(AFFINE_WAKEUPS) &&
 		    cpumask_test_cpu(cpu, &p->cpus_allowed))
@@ -1707,6 +2176,13 @@ static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_
 	if (unlikely(se == pse))
 		return;
 
+	/*
+	 * The task has been enqueued to a throttled group, it can not run
+	 * and must not be nominated as a buddy.
+	 */
+	if (unlikely(throttled_hierarchy(cfs_rq_of(pse))))
+		return;
+
 	if (sched_feat(NEXT_BUDDY) && scale && !(wake_flags & WF_FORK))
 		set_next_buddy(pse);
 
@@ -1891,6 +2367,10 @@ load_balance_fair(struct rq *this_rq, int this_cpu, struct rq *busiest,
 		if (!busiest_cfs_rq->task_weight)
 			continue;
 
+		/* the quota is shared by all cpus, moving does not help */
+		if (cfs_rq_throttled(busiest_cfs_rq))
+			continue;
+
 		rem_load = (u64)rem_load_move * busiest_weight;
 		rem_load = div_u64(rem_load, busiest_h_load + 1);
 
@@ -1957,6 +2437,7 @@ static void rq_online_fair(struct rq *rq)
 static void rq_offline_fair(struct rq *rq)
 {
 	update_sysctl();
+	unthrottle_offline_cfs_rqs(rq);
 }
 
 #endif /* CONFIG_SMP */
@@ -893,6 +893,8 @@ enqueue_task_rt(struct rq *rq, struct task_struct *p, int wakeup, bool head)
 
 	if (!task_current(rq, p) && p->rt.nr_cpus_allowed > 1)
 		enqueue_pushable_task(rq, p);
+
+	inc_nr_running(rq);
 }
 
 static void dequeue_task_rt(struct rq *rq, struct task_struct *p, int sleep)
@@ -903,6 +905,8 @@ static void dequeue_task_rt(struct rq *rq, struct task_struct *p, int sleep)
 	dequeue_rt_entity(rt_se);
 
 	dequeue_pushable_task(rq, p);
+
+	dec_nr_running(rq);
 }
 
 /*
@@ -1735,6 +1739,8 @@ static void set_curr_task_rt(struct rq *rq)
 
 	/* The running task is never eligible for pushing */
 	dequeue_pushable_task(rq, p);
+
+	dec_nr_running(rq);
 }
 
 unsigned int get_rr_interval_rt(struct rq *rq, struct task_struct *task)
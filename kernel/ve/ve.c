@@ -38,6 +38,8 @@
 
 #include <linux/vzcalluser.h>
 
+#include <bc/beancounter.h>
+
 unsigned long vz_rstamp = 0x37e0f59d;
 
 #ifdef CONFIG_MODULES
@@ -127,8 +129,63 @@ void ve_cleanup_schedule(struct ve_struct *ve)
 	wake_up_process(ve_cleanup_thread);
 }
 
+/*
+ * ve_cgroup is cleared under ve_list_lock before the cgroup is destroyed
+ * (see fini_ve_cgroups), so the result is valid while the lock is held.
+ */
+struct cgroup *__ve_cgroup_by_id(envid_t veid)
+{
+	struct ve_struct *ve;
+
+	for_each_ve(ve)
+		if (ve->veid == veid)
+			return ve->ve_cgroup;
+
+	return NULL;
+}
+EXPORT_SYMBOL(__ve_cgroup_by_id);
+
+#ifdef CONFIG_BC_IO_SCHED
+/*
+ * The IO scheduler needs the container cgroup of the IO beancounter on
+ * every request, so the lookup result, including a miss, is cached in
+ * the beancounter. ve_set_cgroup() resets the cache. Called with
+ * ve_list_lock held.
+ */
+struct cgroup *__ub_cgroup(struct user_beancounter *ub)
+{
+	struct cgroup *cgroup;
+
+	cgroup = ub->ub_cgroup;
+	if (cgroup == NULL) {
+		cgroup = __ve_cgroup_by_id(ub->ub_uid);
+		ub->ub_cgroup = cgroup ? : ERR_PTR(-ESRCH);
+	}
+	return IS_ERR(cgroup) ? NULL : cgroup;
+}
+EXPORT_SYMBOL(__ub_cgroup);
+#endif
+
+void ve_set_cgroup(struct ve_struct *ve, struct cgroup *cgroup)
+{
+	struct user_beancounter *ub = NULL;
+
+#ifdef CONFIG_BC_IO_SCHED
+	ub = get_beancounter_byuid(ve->veid, 0);
+#endif
+	write_lock_irq(&ve_list_lock);
+	ve->ve_cgroup = cgroup;
+#ifdef CONFIG_BC_IO_SCHED
+	if (ub != NULL)
+		ub->ub_cgroup = NULL;
+#endif
+	write_unlock_irq(&ve_list_lock);
+	put_beancounter(ub);
+}
+
 #ifdef CONFIG_BLK_CGROUP
 extern int blkiocg_set_weight(struct cgroup *cgroup, u64 val);
+extern int blkiocg_set_limit(struct cgroup *cgroup, unsigned int iops, u64 bps);
 
 static u64 ioprio_weight[VE_IOPRIO_MAX] = {200, 275, 350, 425, 500, 575, 650, 725};
 
@@ -145,16 +202,39 @@ int ve_set_ioprio(int veid, int ioprio)
 	for_each_ve(ve) {
 		if (ve->veid != veid)
 			continue;
-		ret = blkiocg_set_weight(ve->ve_cgroup, ioprio_weight[ioprio]);
+		if (ve->ve_cgroup != NULL)
+			ret = blkiocg_set_weight(ve->ve_cgroup,
+					ioprio_weight[ioprio]);
 		break;
 	}
 	read_unlock(&ve_list_lock);
 
 	return ret;
 }
+
+int ve_set_iolimit(int veid, unsigned int iops, u64 bps)
+{
+	struct cgroup *cgroup;
+	int ret;
+
+	ret = -ESRCH;
+	read_lock(&ve_list_lock);
+	cgroup = __ve_cgroup_by_id(veid);
+	if (cgroup != NULL)
+		ret = blkiocg_set_limit(cgroup, iops, bps);
+	read_unlock(&ve_list_lock);
+
+	return ret;
+}
 #else
 int ve_set_ioprio(int veid, int ioprio)
 {
 	return -EINVAL;
 }
+
+int ve_set_iolimit(int veid, unsigned int iops, u64 bps)
+{
+	return -EINVAL;
+}
 #endif /* CONFIG_BLK_CGROUP */
+EXPORT_SYMBOL(ve_set_iolimit);
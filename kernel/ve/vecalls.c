@@ -736,6 +736,43 @@ static int ve_set_meminfo(envid_t veid, unsigned long val)
 #endif
 }
 
+static int ve_set_ksm(envid_t veid, int priority)
+{
+#ifdef CONFIG_BEANCOUNTERS
+	struct user_beancounter *ub;
+
+	ub = get_beancounter_byuid(veid, 0);
+	if (!ub)
+		return -ESRCH;
+
+	ub->ub_ksm_priority = priority;
+	put_beancounter(ub);
+	return 0;
+#else
+	return -ENOTTY;
+#endif
+}
+
+static int ve_set_dirty(envid_t veid, int ratio)
+{
+#ifdef CONFIG_BC_IO_ACCOUNTING
+	struct user_beancounter *ub;
+
+	if (ratio < 0 || ratio > 100)
+		return -EINVAL;
+
+	ub = get_beancounter_byuid(veid, 0);
+	if (!ub)
+		return -ESRCH;
+
+	ub->ub_dirty_ratio = ratio;
+	put_beancounter(ub);
+	return 0;
+#else
+	return -ENOTTY;
+#endif
+}
+
 static int init_ve_meminfo(struct ve_struct *ve)
 {
 	ve->meminfo_val = VE_MEMINFO_DEFAULT;
@@ -2143,6 +2180,30 @@ free_data:
 			err = ve_set_meminfo(s.veid, s.val);
 		}
 		break;
+	    case VZCTL_VE_IOLIMIT: {
+			struct vzctl_ve_iolimit s;
+			err = -EFAULT;
+			if (copy_from_user(&s, (void __user *)arg, sizeof(s)))
+				break;
+			err = ve_set_iolimit(s.veid, s.iops, s.bps);
+		}
+		break;
+	    case VZCTL_VE_KSM: {
+			struct vzctl_ve_ksm s;
+			err = -EFAULT;
+			if (copy_from_user(&s, (void __user *)arg, sizeof(s)))
+				break;
+			err = ve_set_ksm(s.veid, s.priority);
+		}
+		break;
+	    case VZCTL_VE_DIRTY: {
+			struct vzctl_ve_dirty s;
+			err = -EFAULT;
+			if (copy_from_user(&s, (void __user *)arg, sizeof(s)))
+				break;
+			err = ve_set_dirty(s.veid, s.ratio);
+		}
+		break;
 	}
 	return err;
 }
@@ -43,6 +43,7 @@
 
 #include <asm/mman.h>
 #include <bc/io_acct.h>
+#include <bc/vmpages.h>
 
 /*
  * Shared mappings implemented 30.11.1994. It's not fully working yet,
@@ -442,6 +443,7 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 			if (PageSwapBacked(page))
 				__inc_zone_page_state(page, NR_SHMEM);
 			spin_unlock_irq(&mapping->tree_lock);
+			ub_mapping_set_owner(mapping);
 		} else {
 			page->mapping = NULL;
 			spin_unlock_irq(&mapping->tree_lock);
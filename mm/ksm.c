@@ -33,6 +33,8 @@
 #include <linux/swap.h>
 #include <linux/ksm.h>
 
+#include <bc/beancounter.h>
+
 #include <asm/tlbflush.h>
 #include "internal.h"
 
@@ -82,12 +84,14 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's list of rmap_items
  * @mm: the mm that this information is valid for
+ * @priority: container's KSM priority as of the current full scan
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct list_head rmap_list;
 	struct mm_struct *mm;
+	int priority;
 };
 
 /**
@@ -180,6 +184,11 @@ static unsigned int ksm_run = KSM_RUN_STOP;
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
 static DEFINE_MUTEX(ksm_thread_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
+/* ksmd is sorting the mm_slots off the list, see sort_mm_slots() */
+static bool ksm_mm_sorting;
+
+/* Checksum a sample of the page only, see calc_checksum() */
+static unsigned int ksm_sampled_checksum = 1;
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
 		sizeof(struct __struct), __alignof__(struct __struct),\
@@ -583,11 +592,27 @@ error:
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * The checksum only tells whether the page has changed since the previous
+ * scan, the contents are compared in full before merging anyway. So by
+ * default hash one cacheline out of every KSM_SAMPLE_STRIDE words.
+ */
+#define KSM_SAMPLE_WORDS	(64 / sizeof(u32))
+#define KSM_SAMPLE_STRIDE	(256 / sizeof(u32))
+
 static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
-	void *addr = kmap_atomic(page, KM_USER0);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	u32 *addr = kmap_atomic(page, KM_USER0);
+
+	if (ksm_sampled_checksum) {
+		int i;
+
+		checksum = 17;
+		for (i = 0; i < PAGE_SIZE / sizeof(u32); i += KSM_SAMPLE_STRIDE)
+			checksum = jhash2(addr + i, KSM_SAMPLE_WORDS, checksum);
+	} else
+		checksum = jhash2(addr, PAGE_SIZE / 4, 17);
 	kunmap_atomic(addr, KM_USER0);
 	return checksum;
 }
@@ -1197,6 +1222,134 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+static inline int ksm_mm_priority(struct mm_struct *mm)
+{
+#ifdef CONFIG_BEANCOUNTERS
+	struct user_beancounter *ub;
+
+	ub = mm_ub(mm);
+	if (ub != NULL)
+		return top_beancounter(ub)->ub_ksm_priority;
+#endif
+	return 0;
+}
+
+static inline int mm_slot_priority(struct list_head *l)
+{
+	return list_entry(l, struct mm_slot, mm_list)->priority;
+}
+
+/* Merges two NULL terminated lists, higher priority first, stable */
+static struct list_head *merge_mm_slots(struct list_head *a,
+					struct list_head *b)
+{
+	struct list_head head, *tail = &head;
+
+	while (a && b) {
+		if (mm_slot_priority(a) >= mm_slot_priority(b)) {
+			tail->next = a;
+			a = a->next;
+		} else {
+			tail->next = b;
+			b = b->next;
+		}
+		tail = tail->next;
+	}
+	tail->next = a ? a : b;
+	return head.next;
+}
+
+/*
+ * Bottom-up merge sort: part[n] holds a sorted run of 2^n slots,
+ * older runs at the higher levels.
+ */
+static void merge_sort_mm_slots(struct list_head *head)
+{
+	struct list_head *part[32];
+	struct list_head *list, *cur, *prev;
+	int lev, max_lev = 0;
+
+	if (list_empty(head))
+		return;
+
+	memset(part, 0, sizeof(part));
+	head->prev->next = NULL;
+	list = head->next;
+	while (list) {
+		cur = list;
+		list = list->next;
+		cur->next = NULL;
+
+		for (lev = 0; lev < ARRAY_SIZE(part) - 1 && part[lev]; lev++) {
+			cur = merge_mm_slots(part[lev], cur);
+			part[lev] = NULL;
+		}
+		if (part[lev])
+			cur = merge_mm_slots(part[lev], cur);
+		part[lev] = cur;
+		if (lev > max_lev)
+			max_lev = lev;
+	}
+
+	list = NULL;
+	for (lev = 0; lev <= max_lev; lev++)
+		if (part[lev])
+			list = merge_mm_slots(part[lev], list);
+
+	/* Restore the back links */
+	prev = head;
+	for (cur = list; cur != NULL; cur = cur->next) {
+		cur->prev = prev;
+		prev->next = cur;
+		prev = cur;
+	}
+	prev->next = head;
+	head->prev = prev;
+}
+
+/*
+ * Called at the start of a full scan: order the mm_slots by their
+ * containers' priorities, so that the preferred ones (e.g. created from
+ * the same OS template) get merged first. The slots are sorted off the
+ * list, not to hold ksm_mmlist_lock for long: meanwhile __ksm_exit()
+ * leaves them to ksmd, as it does for the slot at the cursor.
+ */
+static void sort_mm_slots(void)
+{
+	struct mm_slot *slot;
+	LIST_HEAD(slots);
+
+	spin_lock(&ksm_mmlist_lock);
+	list_splice_init(&ksm_mm_head.mm_list, &slots);
+	ksm_mm_sorting = true;
+	spin_unlock(&ksm_mmlist_lock);
+
+	list_for_each_entry(slot, &slots, mm_list)
+		slot->priority = ksm_mm_priority(slot->mm);
+	merge_sort_mm_slots(&slots);
+
+	spin_lock(&ksm_mmlist_lock);
+	/* slots added by __ksm_enter() meanwhile go after the sorted ones */
+	list_splice(&slots, &ksm_mm_head.mm_list);
+	ksm_mm_sorting = false;
+	spin_unlock(&ksm_mmlist_lock);
+}
+
+/*
+ * The container opted out of KSM: its unstable tree nodes were inserted
+ * by an earlier scan and would get stale, drop them. The stable ones
+ * stay, the pages remain merged.
+ */
+static void remove_unstable_rmap_items(struct mm_slot *mm_slot)
+{
+	struct rmap_item *rmap_item;
+
+	list_for_each_entry(rmap_item, &mm_slot->rmap_list, link)
+		if ((rmap_item->address & (NODE_FLAG | STABLE_FLAG)) ==
+				NODE_FLAG)
+			remove_rmap_item_from_tree(rmap_item);
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
@@ -1211,10 +1364,14 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	if (slot == &ksm_mm_head) {
 		root_unstable_tree = RB_ROOT;
 
+		sort_mm_slots();
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
 		ksm_scan.mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
+		/* the last slots may have gone while we were sorting */
+		if (slot == &ksm_mm_head)
+			return NULL;
 next_mm:
 		ksm_scan.address = 0;
 		ksm_scan.rmap_item = list_entry(&slot->rmap_list,
@@ -1222,6 +1379,16 @@ next_mm:
 	}
 
 	mm = slot->mm;
+	if (slot->priority < 0 && !ksm_test_exit(mm)) {
+		/* The container opted out: don't scan it */
+		remove_unstable_rmap_items(slot);
+		spin_lock(&ksm_mmlist_lock);
+		ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+						struct mm_slot, mm_list);
+		spin_unlock(&ksm_mmlist_lock);
+		goto next_slot;
+	}
+
 	down_read(&mm->mmap_sem);
 	if (ksm_test_exit(mm))
 		vma = NULL;
@@ -1298,6 +1465,7 @@ next_mm:
 		up_read(&mm->mmap_sem);
 	}
 
+next_slot:
 	/* Repeat until we've completed scanning the whole list */
 	slot = ksm_scan.mm_slot;
 	if (slot != &ksm_mm_head)
@@ -1416,6 +1584,8 @@ int __ksm_enter(struct mm_struct *mm)
 	/* Check ksm_run too?  Would need tighter locking */
 	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
 
+	mm_slot->priority = ksm_mm_priority(mm);
+
 	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
@@ -1451,7 +1621,7 @@ void __ksm_exit(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && ksm_scan.mm_slot != mm_slot && !ksm_mm_sorting) {
 		if (list_empty(&mm_slot->rmap_list)) {
 			hlist_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
@@ -1530,6 +1700,29 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t sampled_checksum_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_sampled_checksum);
+}
+
+static ssize_t sampled_checksum_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	int err;
+	unsigned long val;
+
+	err = strict_strtoul(buf, 10, &val);
+	if (err || val > 1)
+		return -EINVAL;
+
+	ksm_sampled_checksum = val;
+
+	return count;
+}
+KSM_ATTR(sampled_checksum);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -1648,6 +1841,7 @@ KSM_ATTR_RO(full_scans);
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&sampled_checksum_attr.attr,
 	&run_attr.attr,
 	&max_kernel_pages_attr.attr,
 	&pages_shared_attr.attr,
@@ -2607,11 +2607,11 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		goto out;
 	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
-	page = lookup_swap_cache(entry);
+	page = lookup_swap_cache(entry, vma, address);
 	if (!page) {
 		grab_swap_token(mm); /* Contend for token _before_ read-in */
-		page = swapin_readahead(entry,
-					GFP_HIGHUSER_MOVABLE, vma, address);
+		page = swapin_vma_readahead(entry,
+					GFP_HIGHUSER_MOVABLE, vma, address, pmd);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -2828,6 +2828,143 @@ oom_nopb:
 	return VM_FAULT_OOM;
 }
 
+/*
+ * Map an uptodate anonymous page, which was filled outside of any
+ * page fault (f.e. received by checkpoint/restore before the restore
+ * itself), at @address of @vma. The pte is installed without write
+ * permission, so that several mms may share one page and the first
+ * write goes through the normal COW/reuse path of do_wp_page().
+ *
+ * A page which is already mapped can be mapped once more only into
+ * the same anon_vma at the same linear index; -EBUSY is returned
+ * otherwise, and the caller should install a private copy.
+ *
+ * Called with mmap_sem held.
+ */
+int install_anon_page(struct vm_area_struct *vma, unsigned long address,
+		      struct page *page)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page_beancounter *pbc = NULL;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+	spinlock_t *ptl;
+	pte_t entry;
+	int new, err;
+
+	err = -ENOMEM;
+	if (unlikely(pb_alloc(&pbc)))
+		goto out_nopb;
+	if (unlikely(anon_vma_prepare(vma)))
+		goto out;
+
+	pgd = pgd_offset(mm, address);
+	pud = pud_alloc(mm, pgd, address);
+	if (!pud)
+		goto out;
+	pmd = pmd_alloc(mm, pud, address);
+	if (!pmd)
+		goto out;
+
+	lock_page(page);
+	new = !page_mapped(page);
+	if (new) {
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL))
+			goto out_unlock_page;
+	} else if (!PageAnon(page) || PageKsm(page) ||
+		   page->mapping != (void *)vma->anon_vma + PAGE_MAPPING_ANON ||
+		   page->index != linear_page_index(vma, address)) {
+		err = -EBUSY;
+		goto out_unlock_page;
+	}
+
+	pte = pte_alloc_map_lock(mm, pmd, address, &ptl);
+	if (!pte)
+		goto out_uncharge;
+	err = -EEXIST;
+	if (!pte_none(*pte))
+		goto out_unlock_pte;
+
+	entry = pte_mkdirty(mk_pte(page, vma->vm_page_prot));
+	entry = pte_wrprotect(entry);
+
+	get_page(page);
+	inc_mm_counter(mm, anon_rss);
+	if (new)
+		page_add_new_anon_rmap(page, vma, address);
+	else
+		page_add_anon_rmap(page, vma, address);
+	pb_add_ref(page, mm, &pbc);
+	ub_unused_privvm_dec(mm, vma);
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, entry);
+	err = 0;
+
+out_unlock_pte:
+	pte_unmap_unlock(pte, ptl);
+out_uncharge:
+	if (err && new)
+		mem_cgroup_uncharge_page(page);
+out_unlock_page:
+	unlock_page(page);
+out:
+	pb_free(&pbc);
+out_nopb:
+	return err;
+}
+EXPORT_SYMBOL_GPL(install_anon_page);
+
+#ifdef CONFIG_SWAP
+/*
+ * Map a swap entry, which caller has just allocated for the page,
+ * at empty @address of @vma. The page is read in on the first access
+ * or by swapoff.
+ *
+ * Called with mmap_sem held.
+ */
+int install_swap_pte(struct vm_area_struct *vma, unsigned long address,
+		     swp_entry_t entry)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+	spinlock_t *ptl;
+
+	pgd = pgd_offset(mm, address);
+	pud = pud_alloc(mm, pgd, address);
+	if (!pud)
+		return -ENOMEM;
+	pmd = pmd_alloc(mm, pud, address);
+	if (!pmd)
+		return -ENOMEM;
+	pte = pte_alloc_map_lock(mm, pmd, address, &ptl);
+	if (!pte)
+		return -ENOMEM;
+	if (!pte_none(*pte)) {
+		pte_unmap_unlock(pte, ptl);
+		return -EEXIST;
+	}
+
+	/* make sure mm is on swapoff's mmlist. */
+	if (list_empty(&mm->mmlist)) {
+		spin_lock(&mmlist_lock);
+		if (list_empty(&mm->mmlist))
+			list_add(&mm->mmlist, &init_mm.mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+	set_pte_at(mm, address, pte, swp_entry_to_pte(entry));
+	pte_unmap_unlock(pte, ptl);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(install_swap_pte);
+#endif
+
 /*
  * __do_fault() tries to create a new page mapping. It aggressively
  * tries to share with existing pages, but makes a separate copy if
@@ -3211,6 +3348,7 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
+EXPORT_SYMBOL_GPL(handle_mm_fault);
 
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
@@ -602,6 +602,10 @@ void pagefault_out_of_memory(void)
 	if (mem_cgroup_oom_called(current))
 		goto rest_and_return;
 
+	/* container OOM is handled in its scope, concurrently with others */
+	if (ub_pagefault_out_of_memory())
+		goto rest_and_return;
+
 	if (sysctl_panic_on_oom)
 		panic("out of memory from page fault. panic_on_oom is selected.\n");
 
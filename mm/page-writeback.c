@@ -492,6 +492,8 @@ static void balance_dirty_pages(struct address_space *mapping,
 	unsigned long bdi_thresh;
 	unsigned long pages_written = 0;
 	unsigned long pause = 1;
+	struct user_beancounter *dirty_ub;
+	int ub_kicked = 0;
 
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
 
@@ -514,7 +516,14 @@ static void balance_dirty_pages(struct address_space *mapping,
 		bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
 		bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
 
-		if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh)
+		/*
+		 * A container over its share of dirty memory is throttled
+		 * regardless of the bdi state.
+		 */
+		dirty_ub = ub_dirty_exceeded(dirty_thresh);
+
+		if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh &&
+				dirty_ub == NULL)
 			break;
 
 		/*
@@ -523,7 +532,8 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * when the bdi limits are ramping up.
 		 */
 		if (nr_reclaimable + nr_writeback <
-				(background_thresh + dirty_thresh) / 2)
+				(background_thresh + dirty_thresh) / 2 &&
+				dirty_ub == NULL)
 			break;
 
 		if (!bdi->dirty_exceeded)
@@ -538,9 +548,25 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * threshold otherwise wait until the disk writes catch
 		 * up.
 		 */
-		if (bdi_nr_reclaimable > bdi_thresh) {
+		if (bdi_nr_reclaimable > bdi_thresh || dirty_ub != NULL) {
+			/*
+			 * The bdi over its threshold is written out for all,
+			 * otherwise only the container's inodes are.
+			 */
+			if (bdi_nr_reclaimable <= bdi_thresh)
+				wbc.wb_ub = dirty_ub;
 			writeback_inodes_wbc(&wbc);
 			pages_written += write_chunk - wbc.nr_to_write;
+			/*
+			 * Dirty pages of the container may be on other
+			 * bdis, let the flusher threads write them out.
+			 */
+			if (dirty_ub != NULL && wbc.nr_to_write > 0 &&
+					!ub_kicked) {
+				wakeup_flusher_threads_ub(wbc.nr_to_write,
+							  dirty_ub);
+				ub_kicked = 1;
+			}
 			get_dirty_limits(&background_thresh, &dirty_thresh,
 				       &bdi_thresh, bdi);
 		}
@@ -563,7 +589,8 @@ static void balance_dirty_pages(struct address_space *mapping,
 			bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
 		}
 
-		if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh)
+		if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh &&
+				dirty_ub == NULL)
 			break;
 		if (pages_written >= write_chunk)
 			break;		/* We've done our duty */
@@ -835,6 +862,7 @@ int write_cache_pages(struct address_space *mapping,
 	int cycled;
 	int range_whole = 0;
 	long nr_to_write = wbc->nr_to_write;
+	struct user_beancounter *io_ub;
 
 	if (wbc->nonblocking && bdi_write_congested(bdi)) {
 		wbc->encountered_congestion = 1;
@@ -918,10 +946,14 @@ continue_unlock:
 			}
 
 			BUG_ON(PageWriteback(page));
-			if (!clear_page_dirty_for_io(page))
+			io_ub = ub_io_writeback_begin(page);
+			if (!clear_page_dirty_for_io(page)) {
+				ub_io_writeback_end(io_ub);
 				goto continue_unlock;
+			}
 
 			ret = (*writepage)(page, wbc, data);
+			ub_io_writeback_end(io_ub);
 			if (unlikely(ret)) {
 				if (ret == AOP_WRITEPAGE_ACTIVATE) {
 					unlock_page(page);
@@ -1025,14 +1057,17 @@ EXPORT_SYMBOL(generic_writepages);
 
 int do_writepages(struct address_space *mapping, struct writeback_control *wbc)
 {
+	struct user_beancounter *io_ub;
 	int ret;
 
 	if (wbc->nr_to_write <= 0)
 		return 0;
+	io_ub = ub_io_mapping_writeback_begin(mapping);
 	if (mapping->a_ops->writepages)
 		ret = mapping->a_ops->writepages(mapping, wbc);
 	else
 		ret = generic_writepages(mapping, wbc);
+	ub_io_writeback_end(io_ub);
 	return ret;
 }
 
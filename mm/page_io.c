@@ -17,6 +17,7 @@
 #include <linux/bio.h>
 #include <linux/swapops.h>
 #include <linux/writeback.h>
+#include <linux/zswap.h>
 #include <asm/pgtable.h>
 
 static struct bio *get_swap_bio(gfp_t gfp_flags, pgoff_t index,
@@ -94,11 +95,32 @@ void end_swap_bio_read(struct bio *bio, int err)
  * them here and get rid of the unnecessary final write.
  */
 int swap_writepage(struct page *page, struct writeback_control *wbc)
+{
+	if (try_to_free_swap(page)) {
+		unlock_page(page);
+		return 0;
+	}
+	if (zswap_store(page) == 0) {
+		set_page_writeback(page);
+		unlock_page(page);
+		end_page_writeback(page);
+		return 0;
+	}
+	return __swap_writepage(page, wbc);
+}
+
+/*
+ * Writes the page to the swap device, bypassing zswap.
+ */
+int __swap_writepage(struct page *page, struct writeback_control *wbc)
 {
 	struct bio *bio;
 	int ret = 0, rw = WRITE;
+	swp_entry_t entry = { .val = page_private(page), };
 
-	if (try_to_free_swap(page)) {
+	if (get_swap_info_struct(swp_type(entry))->readpage) {
+		/* Pseudo swap area cannot be written, keep the page */
+		set_page_dirty(page);
 		unlock_page(page);
 		goto out;
 	}
@@ -122,11 +144,23 @@ out:
 
 int swap_readpage(struct page *page)
 {
+	struct swap_info_struct *sis;
 	struct bio *bio;
 	int ret = 0;
+	swp_entry_t entry = { .val = page_private(page), };
 
 	VM_BUG_ON(!PageLocked(page));
 	VM_BUG_ON(PageUptodate(page));
+	sis = get_swap_info_struct(swp_type(entry));
+	if (sis->readpage) {
+		count_vm_event(PSWPIN);
+		return sis->readpage(sis, page);
+	}
+	if (zswap_load(page) == 0) {
+		SetPageUptodate(page);
+		unlock_page(page);
+		goto out;
+	}
 	bio = get_swap_bio(GFP_KERNEL, page_private(page), page,
 				end_swap_bio_read);
 	if (bio == NULL) {
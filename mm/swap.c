@@ -35,6 +35,7 @@
 
 /* How many pages do we try to swap or page in/out together? */
 int page_cluster;
+int sysctl_swap_vma_readahead __read_mostly = 1;
 
 static DEFINE_PER_CPU(struct pagevec[NR_LRU_LISTS], lru_add_pvecs);
 static DEFINE_PER_CPU(struct pagevec, lru_rotate_pvecs);
@@ -141,6 +141,8 @@ void __delete_from_swap_cache(struct page *page)
 	total_swapcache_pages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
 	INC_CACHE_INFO(del_total);
+	if (TestClearPageReadahead(page))
+		count_vm_event(SWAP_RA_MISS);
 }
 
 /**
@@ -263,20 +265,59 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
 	}
 }
 
+/*
+ * VMA based swap readahead state, kept in vma->swap_readahead_info:
+ * the address of the last swap fault, the readahead window used for
+ * it and the number of readahead hits in the vma since then.
+ */
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)					\
+	(((addr) & PAGE_MASK) |						\
+	 (((unsigned long)(win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) | \
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+/* The ptes are copied on stack before reading, this bounds the window */
+#define SWAP_RA_PTES_MAX	32
+
 /*
  * Lookup a swap entry in the swap cache. A found page will be returned
  * unlocked and with its refcount incremented - we rely on the kernel
  * lock getting page table operations atomic even if we drop the page
  * lock before returning.
+ *
+ * Hits on the pages read ahead are accounted to @vma, if given.
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page * lookup_swap_cache(swp_entry_t entry,
+		struct vm_area_struct *vma, unsigned long addr)
 {
 	struct page *page;
+	unsigned long ra_val;
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
+		if (!PageWriteback(page) && TestClearPageReadahead(page)) {
+			count_vm_event(SWAP_RA_HIT);
+			if (vma != NULL) {
+				/* racy, but it is only a hint */
+				ra_val = atomic_long_read(
+						&vma->swap_readahead_info);
+				if (SWAP_RA_HITS(ra_val) < SWAP_RA_HITS_MAX)
+					atomic_long_set(
+						&vma->swap_readahead_info,
+						ra_val + 1);
+			}
+		}
+	}
 
 	INC_CACHE_INFO(find_total);
 	return page;
@@ -363,6 +404,27 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 
 EXPORT_SYMBOL(read_swap_cache_async);
 
+/*
+ * Starts reading in a page we have not faulted on (yet). The page is
+ * marked, so that lookup_swap_cache() can tell whether it was of use.
+ */
+static int swap_readahead_page(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	struct page *page;
+
+	page = find_get_page(&swapper_space, entry.val);
+	if (page == NULL) {
+		page = read_swap_cache_async(entry, gfp_mask, vma, addr);
+		if (page == NULL)
+			return -ENOMEM;
+		SetPageReadahead(page);
+		count_vm_event(SWAP_RA);
+	}
+	page_cache_release(page);
+	return 0;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -386,7 +448,6 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 			struct vm_area_struct *vma, unsigned long addr)
 {
 	int nr_pages;
-	struct page *page;
 	unsigned long offset;
 	unsigned long end_offset;
 
@@ -399,13 +460,122 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	 */
 	nr_pages = valid_swaphandles(entry, &offset);
 	for (end_offset = offset + nr_pages; offset < end_offset; offset++) {
+		if (offset == swp_offset(entry))
+			continue;
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
-		if (!page)
+		if (swap_readahead_page(swp_entry(swp_type(entry), offset),
+					gfp_mask, vma, addr))
 			break;
-		page_cache_release(page);
 	}
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
+
+/*
+ * Readahead window for a fault at @faddr, given the vma readahead state.
+ * Without hits we only read ahead when the faults go sequentially, the
+ * window then grows with the hits, and shrinks by half at most per fault.
+ */
+static unsigned int swap_ra_window(unsigned long faddr, unsigned long ra_val)
+{
+	unsigned long prev = SWAP_RA_ADDR(ra_val);
+	unsigned int pages, max_pages, last_win;
+
+	if (page_cluster <= 0)
+		return 1;
+	max_pages = SWAP_RA_PTES_MAX;
+	if (page_cluster < ilog2(SWAP_RA_PTES_MAX))
+		max_pages = 1 << page_cluster;
+
+	pages = SWAP_RA_HITS(ra_val) + 2;
+	if (pages == 2) {
+		if (faddr != prev + PAGE_SIZE && faddr + PAGE_SIZE != prev)
+			pages = 1;
+	} else
+		pages = roundup_pow_of_two(pages);
+	if (pages > max_pages)
+		pages = max_pages;
+
+	last_win = SWAP_RA_WIN(ra_val) / 2;
+	if (pages < last_win)
+		pages = last_win;
+	return pages;
+}
+
+/**
+ * swapin_vma_readahead - swap in pages around the faulting address
+ * @entry: swap entry of this memory
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma this address belongs to
+ * @addr: faulting address
+ * @pmd: pmd mapping @addr
+ *
+ * Returns the struct page for entry and addr, after queueing swapin.
+ *
+ * Unlike swapin_readahead(), which reads the neighbouring slots of the
+ * swap area, this follows the virtual address locality: it reads in the
+ * swap entries found in the ptes around @addr, within @vma and the page
+ * table of @addr. Neighbouring slots often belong to other processes, or
+ * to other containers, when many of them swap to the same device. The
+ * window is sized by the readahead hits in @vma since its previous swap
+ * fault, see swap_ra_window().
+ *
+ * Caller must hold down_read on the vma->vm_mm.
+ */
+struct page *swapin_vma_readahead(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd)
+{
+	pte_t ptes[SWAP_RA_PTES_MAX], *pte;
+	unsigned long ra_val, faddr, prev, start, lo, hi;
+	unsigned int win, back, nr, i;
+	swp_entry_t swp;
+
+	if (!sysctl_swap_vma_readahead)
+		return swapin_readahead(entry, gfp_mask, vma, addr);
+
+	faddr = addr & PAGE_MASK;
+	ra_val = atomic_long_read(&vma->swap_readahead_info);
+	win = swap_ra_window(faddr, ra_val);
+	atomic_long_set(&vma->swap_readahead_info,
+			SWAP_RA_VAL(faddr, win, 0));
+	if (win == 1)
+		goto out;
+
+	/* Read ahead the way the faults go, or around the fault */
+	prev = SWAP_RA_ADDR(ra_val);
+	if (faddr == prev + PAGE_SIZE)
+		back = 0;
+	else if (faddr + PAGE_SIZE == prev)
+		back = win - 1;
+	else
+		back = (win - 1) / 2;
+
+	lo = max(vma->vm_start, faddr & PMD_MASK);
+	hi = min(vma->vm_end, (faddr & PMD_MASK) + PMD_SIZE);
+	back = min_t(unsigned long, back, (faddr - lo) >> PAGE_SHIFT);
+	start = faddr - (back << PAGE_SHIFT);
+	nr = min_t(unsigned long, win, (hi - start) >> PAGE_SHIFT);
+
+	/* The reads may sleep, don't keep the page table mapped */
+	pte = pte_offset_map(pmd, start);
+	for (i = 0; i < nr; i++)
+		ptes[i] = pte[i];
+	pte_unmap(pte);
+
+	for (i = 0, addr = start; i < nr; i++, addr += PAGE_SIZE) {
+		if (addr == faddr)
+			continue;
+		if (pte_none(ptes[i]) || pte_present(ptes[i]) ||
+				pte_file(ptes[i]))
+			continue;
+		swp = pte_to_swp_entry(ptes[i]);
+		if (unlikely(non_swap_entry(swp)))
+			continue;
+		if (swap_readahead_page(swp, gfp_mask, vma, addr))
+			break;
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+out:
+	return read_swap_cache_async(entry, gfp_mask, vma, faddr);
+}
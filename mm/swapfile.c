@@ -29,6 +29,7 @@
 #include <linux/capability.h>
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
+#include <linux/zswap.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -125,7 +126,7 @@ void swap_unplug_io_fn(struct backing_dev_info *unused_bdi, struct page *page)
 
 	down_read(&swap_unplug_sem);
 	entry.val = page_private(page);
-	if (PageSwapCache(page)) {
+	if (PageSwapCache(page) && swap_info[swp_type(entry)].bdev) {
 		struct block_device *bdev = swap_info[swp_type(entry)].bdev;
 		struct backing_dev_info *bdi;
 
@@ -591,11 +592,13 @@ static int swap_entry_free(struct swap_info_struct *p,
 	/* free if no reference */
 	if (!count) {
 		ub_swapentry_dec(p, offset);
+		zswap_invalidate(p - swap_info, offset);
 		if (offset < p->lowest_bit)
 			p->lowest_bit = offset;
 		if (offset > p->highest_bit)
 			p->highest_bit = offset;
-		if (p->prio > swap_info[swap_list.next].prio)
+		if (swap_list.next >= 0 &&
+		    p->prio > swap_info[swap_list.next].prio)
 			swap_list.next = p - swap_info;
 		nr_swap_pages++;
 		p->inuse_pages--;
@@ -1678,6 +1681,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	down_write(&swap_unplug_sem);
 	up_write(&swap_unplug_sem);
 
+	zswap_invalidate_area(type);
 	destroy_swap_extents(p);
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
@@ -1739,7 +1743,8 @@ static void *swap_start(struct seq_file *swap, loff_t *pos)
 		return SEQ_START_TOKEN;
 
 	for (i = 0; i < nr_swapfiles; i++, ptr++) {
-		if (!(ptr->flags & SWP_USED) || !ptr->swap_map)
+		if (!(ptr->flags & SWP_USED) || !ptr->swap_map ||
+		    !ptr->swap_file)
 			continue;
 		if (!--l)
 			return ptr;
@@ -1761,7 +1766,8 @@ static void *swap_next(struct seq_file *swap, void *v, loff_t *pos)
 	}
 
 	for (; ptr < endptr; ptr++) {
-		if (!(ptr->flags & SWP_USED) || !ptr->swap_map)
+		if (!(ptr->flags & SWP_USED) || !ptr->swap_map ||
+		    !ptr->swap_file)
 			continue;
 		++*pos;
 		return ptr;
@@ -2168,6 +2174,149 @@ out:
 
 EXPORT_SYMBOL(sys_swapon);
 
+/*
+ * Pseudo swap area is not backed by a file. Its entries are allocated
+ * at given offsets by get_pseudo_swap_page() and pages are read with
+ * ->readpage, which must unlock the page when it is read. The area
+ * is never used for swapout and is not in swap_list, neither it is
+ * accounted in nr_swap_pages until its entries are allocated.
+ */
+struct swap_info_struct *swapon_pseudo(unsigned int pages,
+		int (*readpage)(struct swap_info_struct *, struct page *),
+		void *private)
+{
+	struct swap_info_struct *p;
+	unsigned short *swap_map;
+	unsigned long maxpages;
+	unsigned int type;
+	int error;
+
+	/* offset 0 is never used, as if it were swap header */
+	maxpages = swp_offset(pte_to_swp_entry(
+			swp_entry_to_pte(swp_entry(0, ~0UL)))) + 1;
+	if (!pages || pages >= maxpages)
+		return ERR_PTR(-EINVAL);
+	maxpages = pages + 1;
+
+	swap_map = vmalloc(maxpages * sizeof(short));
+	if (!swap_map)
+		return ERR_PTR(-ENOMEM);
+	memset(swap_map, 0, maxpages * sizeof(short));
+	swap_map[0] = SWAP_MAP_BAD;
+
+	spin_lock(&swap_lock);
+	p = swap_info;
+	for (type = 0 ; type < nr_swapfiles ; type++,p++)
+		if (!(p->flags & SWP_USED))
+			break;
+	error = -EPERM;
+	if (type >= MAX_SWAPFILES) {
+		spin_unlock(&swap_lock);
+		goto out;
+	}
+	if (type >= nr_swapfiles)
+		nr_swapfiles = type+1;
+	memset(p, 0, sizeof(*p));
+	INIT_LIST_HEAD(&p->extent_list);
+	p->flags = SWP_USED;
+	p->next = -1;
+	spin_unlock(&swap_lock);
+
+	error = -ENOMEM;
+	if (ub_swap_init(p, maxpages))
+		goto bad_swap;
+	error = swap_cgroup_swapon(type, maxpages);
+	if (error)
+		goto bad_swap;
+
+	mutex_lock(&swapon_mutex);
+	spin_lock(&swap_lock);
+	p->prio = INT_MIN;
+	p->pages = pages;
+	p->max = maxpages;
+	p->lowest_bit = 1;
+	p->highest_bit = 0;
+	p->readpage = readpage;
+	p->private = private;
+	p->swap_map = swap_map;
+	p->flags |= SWP_READONLY;
+	spin_unlock(&swap_lock);
+	mutex_unlock(&swapon_mutex);
+	return p;
+
+bad_swap:
+	ub_swap_fini(p);
+	spin_lock(&swap_lock);
+	p->flags = 0;
+	spin_unlock(&swap_lock);
+out:
+	vfree(swap_map);
+	return ERR_PTR(error);
+}
+EXPORT_SYMBOL(swapon_pseudo);
+
+/*
+ * Reads all the entries of pseudo swap area in and releases it.
+ * Failure leaves the area intact, it can be retried later.
+ */
+int swapoff_pseudo(struct swap_info_struct *p)
+{
+	unsigned short *swap_map;
+	int type = p - swap_info;
+	int err;
+
+	current->flags |= PF_OOM_ORIGIN;
+	err = try_to_unuse(type);
+	current->flags &= ~PF_OOM_ORIGIN;
+	if (err)
+		return err;
+
+	/* wait for any unplug function to finish */
+	down_write(&swap_unplug_sem);
+	up_write(&swap_unplug_sem);
+
+	mutex_lock(&swapon_mutex);
+	spin_lock(&swap_lock);
+	drain_mmlist();
+	p->max = 0;
+	swap_map = p->swap_map;
+	p->swap_map = NULL;
+	p->readpage = NULL;
+	p->private = NULL;
+	p->flags = 0;
+	spin_unlock(&swap_lock);
+	mutex_unlock(&swapon_mutex);
+	vfree(swap_map);
+	ub_swap_fini(p);
+	swap_cgroup_swapoff(type);
+	return 0;
+}
+EXPORT_SYMBOL(swapoff_pseudo);
+
+/*
+ * Allocates the entry at @offset of pseudo swap area with one reference,
+ * which is to be installed in a pte by caller.
+ */
+swp_entry_t get_pseudo_swap_page(struct swap_info_struct *si, pgoff_t offset,
+		struct user_beancounter *ub)
+{
+	spin_lock(&swap_lock);
+	if (!si->readpage || !offset || offset >= si->max ||
+	    si->swap_map[offset])
+		goto fail;
+	si->swap_map[offset] = encode_swapmap(1, false);
+	si->inuse_pages++;
+	nr_swap_pages--;
+	spin_unlock(&swap_lock);
+	ub_swapentry_inc(si, offset, ub);
+	return swp_entry(si - swap_info, offset);
+
+fail:
+	spin_unlock(&swap_lock);
+	return (swp_entry_t) {0};
+}
+EXPORT_SYMBOL(get_pseudo_swap_page);
+
 void si_swapinfo(struct sysinfo *val)
 {
 	unsigned int i;
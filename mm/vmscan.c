@@ -43,6 +43,7 @@
 
 #include <bc/oom_kill.h>
 #include <bc/io_acct.h>
+#include <bc/vmpages.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -85,6 +86,11 @@ struct scan_control {
 	/* Which cgroup do we reclaim from */
 	struct mem_cgroup *mem_cgroup;
 
+#ifdef CONFIG_BC_RSS_ACCOUNTING
+	/* Reclaim only the pages of this beancounter from the global lru */
+	struct user_beancounter *ub;
+#endif
+
 	/*
 	 * Nodemask of nodes allowed by the caller. If NULL, all nodes
 	 * are scanned.
@@ -100,6 +106,34 @@ struct scan_control {
 
 #define lru_to_page(_head) (list_entry((_head)->prev, struct page, lru))
 
+#ifdef CONFIG_BC_RSS_ACCOUNTING
+/* Called with the page locked, see ub_page_cache_owned() */
+static inline int page_in_reclaim_scope(struct page *page,
+		struct scan_control *sc)
+{
+	return sc->ub == NULL || pb_page_owned(page, sc->ub) ||
+		ub_page_cache_owned(page, sc->ub);
+}
+
+/* A page which cannot be locked now is taken as foreign */
+static int page_in_reclaim_scope_unlocked(struct page *page,
+		struct scan_control *sc)
+{
+	int ret;
+
+	if (sc->ub == NULL)
+		return 1;
+	if (!trylock_page(page))
+		return 0;
+	ret = page_in_reclaim_scope(page, sc);
+	unlock_page(page);
+	return ret;
+}
+#else
+#define page_in_reclaim_scope(page, sc)	(1)
+#define page_in_reclaim_scope_unlocked(page, sc)	(1)
+#endif
+
 #ifdef ARCH_HAS_PREFETCH
 #define prefetch_prev_lru_page(_page, _base, _field)			\
 	do {								\
@@ -362,6 +396,8 @@ typedef enum {
 static pageout_t pageout(struct page *page, struct address_space *mapping,
 						enum pageout_io sync_writeback)
 {
+	struct user_beancounter *io_ub;
+
 	/*
 	 * If the page is dirty, only perform writeback if that write
 	 * will be non-blocking.  To prevent this allocation from being
@@ -400,6 +436,7 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 	if (!may_write_to_queue(mapping->backing_dev_info))
 		return PAGE_KEEP;
 
+	io_ub = ub_io_writeback_begin(page);
 	if (clear_page_dirty_for_io(page)) {
 		int res;
 		struct writeback_control wbc = {
@@ -413,6 +450,7 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 
 		SetPageReclaim(page);
 		res = mapping->a_ops->writepage(page, &wbc);
+		ub_io_writeback_end(io_ub);
 		if (res < 0)
 			handle_write_error(mapping, page, res);
 		if (res == AOP_WRITEPAGE_ACTIVATE) {
@@ -435,6 +473,7 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 		inc_zone_page_state(page, NR_VMSCAN_WRITE);
 		return PAGE_SUCCESS;
 	}
+	ub_io_writeback_end(io_ub);
 
 	return PAGE_CLEAN;
 }
@@ -622,6 +661,9 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		if (!trylock_page(page))
 			goto keep;
 
+		if (!page_in_reclaim_scope(page, sc))
+			goto keep_locked;
+
 		VM_BUG_ON(PageActive(page));
 
 		sc->nr_scanned++;
@@ -1403,6 +1445,11 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 			continue;
 		}
 
+		if (!page_in_reclaim_scope_unlocked(page, sc)) {
+			list_add(&page->lru, &l_active);
+			continue;
+		}
+
 		/* page_referenced clears PageReferenced */
 		if (page_mapping_inuse(page) &&
 		    page_referenced(page, 0, sc->mem_cgroup, &vm_flags)) {
@@ -1773,6 +1820,165 @@ static void shrink_zones(int priority, struct zonelist *zonelist,
 	}
 }
 
+#ifdef CONFIG_BC_RSS_ACCOUNTING
+/*
+ * Never look at more than this part of the lrus in one call: the foreign
+ * pages are skipped, so the work does not depend on the target size only.
+ */
+#define UB_SCAN_MAX_SHIFT	6
+
+/*
+ * Scan the zone's lrus in proportion to their sizes, @budget pages out of
+ * @lru_pages in all the zones. Active lists are aged regardless of the
+ * global inactive ratio, the beancounter's active pages must be reached.
+ */
+static void shrink_ub_zone(struct zone *zone, struct scan_control *sc,
+		unsigned long budget, unsigned long lru_pages,
+		unsigned long nr_pages)
+{
+	unsigned long nr[NR_LRU_LISTS];
+	unsigned long nr_to_scan;
+	enum lru_list l;
+
+	for_each_evictable_lru(l) {
+		nr[l] = 0;
+		if (sc->may_swap || is_file_lru(l))
+			nr[l] = div64_u64((u64)zone_nr_lru_pages(zone, sc, l) *
+					budget, lru_pages);
+	}
+
+	while (nr[LRU_INACTIVE_ANON] || nr[LRU_ACTIVE_ANON] ||
+			nr[LRU_INACTIVE_FILE] || nr[LRU_ACTIVE_FILE]) {
+		for_each_evictable_lru(l) {
+			if (!nr[l])
+				continue;
+			nr_to_scan = min(nr[l], sc->swap_cluster_max);
+			nr[l] -= nr_to_scan;
+
+			if (is_active_lru(l))
+				shrink_active_list(nr_to_scan, zone, sc,
+						DEF_PRIORITY, is_file_lru(l));
+			else
+				sc->nr_reclaimed += shrink_inactive_list(
+						nr_to_scan, zone, sc,
+						DEF_PRIORITY, is_file_lru(l));
+		}
+		if (sc->nr_reclaimed >= nr_pages)
+			break;
+		if (fatal_signal_pending(current) ||
+		    unlikely(test_tsk_thread_flag(current, TIF_MEMDIE)))
+			break;
+	}
+}
+
+/*
+ * Reclaim the pages mapped, dirtied or cached by the beancounter. There
+ * are no per-beancounter lrus, the global ones are scanned and the
+ * foreign pages are rotated back after isolation, so that the pb lists
+ * are not walked under lru_lock. Slab is not shrunk, these are not ub's
+ * pages.
+ *
+ * The scan is not a full priority loop: it gets a budget of pages, about
+ * what is needed to meet @nr_pages given the beancounter's share of the
+ * lrus, bounded by 1/2^UB_SCAN_MAX_SHIFT of them. The zones' scanning
+ * priority is not touched, this is not a global memory shortage.
+ */
+static unsigned long shrink_ub_zonelist(struct user_beancounter *ub,
+		struct zonelist *zonelist, nodemask_t *nodemask,
+		gfp_t gfp_mask, unsigned long nr_pages, int may_swap)
+{
+	struct scan_control sc = {
+		.gfp_mask = gfp_mask,
+		.may_writepage = !laptop_mode,
+		.swap_cluster_max = SWAP_CLUSTER_MAX,
+		.may_unmap = 1,
+		.may_swap = may_swap,
+		.swappiness = vm_swappiness,
+		.order = 0,
+		.mem_cgroup = NULL,
+		.isolate_pages = isolate_pages_global,
+		.nodemask = nodemask,
+		.ub = ub,
+	};
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	unsigned long lru_pages, held, ratio, budget, max_scan;
+	struct zoneref *z;
+	struct zone *zone;
+	enum lru_list l;
+
+	lru_pages = 0;
+	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
+					nodemask) {
+		if (!populated_zone(zone) ||
+		    !cpuset_zone_allowed_hardwall(zone, GFP_KERNEL))
+			continue;
+		for_each_evictable_lru(l)
+			if (may_swap || is_file_lru(l))
+				lru_pages += zone_nr_lru_pages(zone, &sc, l);
+	}
+	if (lru_pages == 0)
+		return 0;
+
+	held = ub->ub_parms[UB_PHYSPAGES].held;
+	ratio = lru_pages / (held + 1) + 1;
+	max_scan = max_t(unsigned long, lru_pages >> UB_SCAN_MAX_SHIFT,
+			SWAP_CLUSTER_MAX);
+	budget = max_scan;
+	if (nr_pages <= max_scan / ratio / 2)
+		budget = max_t(unsigned long, nr_pages * ratio * 2,
+				SWAP_CLUSTER_MAX);
+
+	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
+					nodemask) {
+		if (!populated_zone(zone) ||
+		    !cpuset_zone_allowed_hardwall(zone, GFP_KERNEL))
+			continue;
+
+		shrink_ub_zone(zone, &sc, budget, lru_pages, nr_pages);
+		if (sc.nr_reclaimed >= nr_pages)
+			break;
+		if (fatal_signal_pending(current))
+			break;
+	}
+
+	ub_percpu_add(ub, reclaimed, sc.nr_reclaimed);
+	return sc.nr_reclaimed;
+}
+
+unsigned long try_to_free_ub_pages(struct user_beancounter *ub,
+		gfp_t gfp_mask, unsigned long nr_pages, bool noswap)
+{
+	return shrink_ub_zonelist(ub, node_zonelist(numa_node_id(), gfp_mask),
+			NULL, gfp_mask, nr_pages, !noswap);
+}
+
+/*
+ * Direct reclaim of a task from a container above its physpages barrier
+ * starts with this container's file and anon pages, the others' pages
+ * are only touched if this was not enough.
+ */
+static unsigned long try_to_free_ub_pages_first(struct zonelist *zonelist,
+		int order, gfp_t gfp_mask, nodemask_t *nodemask)
+{
+	struct user_beancounter *ub;
+
+	if (order != 0 || current->mm == NULL)
+		return 0;
+	ub = mm_ub(current->mm);
+	if (ub == NULL)
+		return 0;
+
+	ub = top_beancounter(ub);
+	if (ub == get_ub0() || !ub_physpages_over_barrier(ub))
+		return 0;
+
+	return shrink_ub_zonelist(ub, zonelist, nodemask, gfp_mask,
+			SWAP_CLUSTER_MAX, 1);
+}
+#else
+#define try_to_free_ub_pages_first(zonelist, order, gfp_mask, nodemask) (0)
+#endif
+
 /*
  * This is the main entry point to direct page reclaim.
  *
@@ -1911,6 +2117,12 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 		.isolate_pages = isolate_pages_global,
 		.nodemask = nodemask,
 	};
+	unsigned long nr_reclaimed;
+
+	nr_reclaimed = try_to_free_ub_pages_first(zonelist, order,
+			gfp_mask, nodemask);
+	if (nr_reclaimed >= SWAP_CLUSTER_MAX)
+		return nr_reclaimed;
 
 	return do_try_to_free_pages(zonelist, &sc);
 }
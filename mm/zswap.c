@@ -0,0 +1,539 @@
+/*
+ * Compressed in-memory cache for swap pages.
+ *
+ * Pages handed to swap_writepage() are compressed with LZO and kept in
+ * a RAM pool instead of being written to the swap device. They are
+ * decompressed on swap_readpage() and dropped together with their swap
+ * entry. The swap entry is allocated as usual, so the slot on the device
+ * stays reserved: when the pool grows over its limit, the oldest pages
+ * are written back to their slots in the background.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/writeback.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/percpu.h>
+#include <linux/err.h>
+#include <linux/lzo.h>
+#include <linux/zswap.h>
+
+#include <bc/beancounter.h>
+#include <bc/vmpages.h>
+
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;		/* oldest at the tail */
+	pgoff_t offset;
+	unsigned int type;
+	unsigned int length;		/* of the compressed data */
+	struct user_beancounter *ub;
+	unsigned char data[0];
+};
+
+/*
+ * Pages not compressing to half a page are not worth caching,
+ * the slab object would be as large as the page itself.
+ */
+#define ZSWAP_MAX_COMPRESSED	(PAGE_SIZE / 2 - sizeof(struct zswap_entry))
+
+static struct rb_root zswap_trees[MAX_SWAPFILES];
+static LIST_HEAD(zswap_lru);
+/* protects the trees and the lru */
+static DEFINE_SPINLOCK(zswap_lock);
+/* serializes writeback with swapoff */
+static DEFINE_MUTEX(zswap_wb_mutex);
+
+static DEFINE_PER_CPU(unsigned char *, zswap_wrkmem);
+static DEFINE_PER_CPU(unsigned char *, zswap_dstmem);
+
+static struct workqueue_struct *zswap_wq;
+static void zswap_writeback_work(struct work_struct *work);
+static DECLARE_WORK(zswap_wb_work, zswap_writeback_work);
+
+/* Tunables */
+static unsigned int zswap_enabled __read_mostly = 1;
+static unsigned int zswap_max_pool_percent __read_mostly = 20;
+
+/* Statistics */
+static atomic_long_t zswap_pool_bytes = ATOMIC_LONG_INIT(0);
+static atomic_long_t zswap_stored_pages = ATOMIC_LONG_INIT(0);
+static unsigned long zswap_written_back_pages;
+static unsigned long zswap_reject_pool_full;
+static unsigned long zswap_reject_compress;
+static unsigned long zswap_reject_alloc;
+static unsigned long zswap_reject_ub;
+
+static inline unsigned long zswap_pool_pages(void)
+{
+	return DIV_ROUND_UP(atomic_long_read(&zswap_pool_bytes), PAGE_SIZE);
+}
+
+static inline unsigned long zswap_max_pool_pages(void)
+{
+	return totalram_pages * zswap_max_pool_percent / 100;
+}
+
+/* Writeback stops once the pool is back below 7/8 of its limit */
+static inline unsigned long zswap_low_pool_pages(void)
+{
+	unsigned long max = zswap_max_pool_pages();
+
+	return max - max / 8;
+}
+
+/*
+ * Tree operations, called with zswap_lock held
+ */
+static struct zswap_entry *zswap_search(unsigned type, pgoff_t offset)
+{
+	struct rb_node *node = zswap_trees[type].rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (offset < entry->offset)
+			node = node->rb_left;
+		else if (offset > entry->offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/* Returns the entry replaced by the new one, if any */
+static struct zswap_entry *zswap_insert(struct zswap_entry *entry)
+{
+	struct rb_root *root = &zswap_trees[entry->type];
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *old;
+
+	while (*link) {
+		parent = *link;
+		old = rb_entry(parent, struct zswap_entry, rbnode);
+		if (entry->offset < old->offset)
+			link = &parent->rb_left;
+		else if (entry->offset > old->offset)
+			link = &parent->rb_right;
+		else {
+			rb_replace_node(&old->rbnode, &entry->rbnode, root);
+			list_del(&old->lru);
+			list_add(&entry->lru, &zswap_lru);
+			return old;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	list_add(&entry->lru, &zswap_lru);
+	return NULL;
+}
+
+static void zswap_erase(struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, &zswap_trees[entry->type]);
+	list_del(&entry->lru);
+}
+
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	atomic_long_sub(ksize(entry), &zswap_pool_bytes);
+	atomic_long_dec(&zswap_stored_pages);
+	ub_swapcache_uncharge(entry->ub, ksize(entry));
+	kfree(entry);
+}
+
+/*
+ * Called from swap_writepage() with the page locked in the swap cache.
+ * On failure any older copy of the page is dropped, the caller writes
+ * the page to the device then.
+ */
+int zswap_store(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page), };
+	unsigned type = swp_type(swp);
+	pgoff_t offset = swp_offset(swp);
+	struct zswap_entry *entry, *old;
+	struct user_beancounter *ub;
+	unsigned char *src, *dst;
+	size_t dlen;
+	int cpu, err;
+
+	err = -EPERM;
+	if (!zswap_enabled || get_swap_info_struct(type)->readpage)
+		goto out;
+
+	err = -ENOSPC;
+	if (zswap_pool_pages() >= zswap_max_pool_pages()) {
+		zswap_reject_pool_full++;
+		queue_work(zswap_wq, &zswap_wb_work);
+		goto out;
+	}
+
+	cpu = get_cpu();
+	dst = per_cpu(zswap_dstmem, cpu);
+	src = kmap_atomic(page, KM_USER0);
+	err = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			per_cpu(zswap_wrkmem, cpu));
+	kunmap_atomic(src, KM_USER0);
+	if (err != LZO_E_OK || dlen > ZSWAP_MAX_COMPRESSED) {
+		put_cpu();
+		zswap_reject_compress++;
+		err = -E2BIG;
+		goto out;
+	}
+
+	/* We are called from reclaim, don't dip into the reserves */
+	entry = kmalloc(sizeof(*entry) + dlen, GFP_NOWAIT |
+			__GFP_NORETRY | __GFP_NOMEMALLOC | __GFP_NOWARN);
+	if (entry == NULL) {
+		put_cpu();
+		zswap_reject_alloc++;
+		err = -ENOMEM;
+		goto out;
+	}
+	memcpy(entry->data, dst, dlen);
+	put_cpu();
+
+	ub = ub_swapcache_charge(get_swap_info_struct(type), offset,
+			ksize(entry));
+	if (IS_ERR(ub)) {
+		zswap_reject_ub++;
+		err = PTR_ERR(ub);
+		kfree(entry);
+		goto out;
+	}
+
+	entry->offset = offset;
+	entry->type = type;
+	entry->length = dlen;
+	entry->ub = ub;
+	atomic_long_add(ksize(entry), &zswap_pool_bytes);
+	atomic_long_inc(&zswap_stored_pages);
+
+	spin_lock(&zswap_lock);
+	old = zswap_insert(entry);
+	spin_unlock(&zswap_lock);
+	if (old != NULL)
+		zswap_free_entry(old);
+	return 0;
+
+out:
+	zswap_invalidate(type, offset);
+	return err;
+}
+
+/*
+ * Called from swap_readpage() with the page locked in the swap cache.
+ * The entry is kept: the page may be dropped from the swap cache clean
+ * and read again later.
+ */
+int zswap_load(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page), };
+	struct zswap_entry *entry;
+	unsigned char *dst;
+	size_t dlen;
+	int err;
+
+	if (RB_EMPTY_ROOT(&zswap_trees[swp_type(swp)]))
+		return -ENOENT;
+
+	/*
+	 * The swap cache page pins the swap entry, so the zswap entry
+	 * cannot be invalidated under us, and a concurrent store to it
+	 * would need this very page locked.
+	 */
+	spin_lock(&zswap_lock);
+	entry = zswap_search(swp_type(swp), swp_offset(swp));
+	spin_unlock(&zswap_lock);
+	if (entry == NULL)
+		return -ENOENT;
+
+	dlen = PAGE_SIZE;
+	dst = kmap_atomic(page, KM_USER0);
+	err = lzo1x_decompress_safe(entry->data, entry->length, dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	BUG_ON(err != LZO_E_OK || dlen != PAGE_SIZE);
+	return 0;
+}
+
+/*
+ * Called when the swap entry is freed, under swap_lock.
+ */
+void zswap_invalidate(unsigned type, pgoff_t offset)
+{
+	struct zswap_entry *entry;
+
+	if (RB_EMPTY_ROOT(&zswap_trees[type]))
+		return;
+
+	spin_lock(&zswap_lock);
+	entry = zswap_search(type, offset);
+	if (entry != NULL)
+		zswap_erase(entry);
+	spin_unlock(&zswap_lock);
+
+	if (entry != NULL)
+		zswap_free_entry(entry);
+}
+
+/*
+ * Called on swapoff, once all the entries of the area were read in.
+ */
+void zswap_invalidate_area(unsigned type)
+{
+	struct zswap_entry *entry;
+	struct rb_node *node;
+
+	mutex_lock(&zswap_wb_mutex);
+	spin_lock(&zswap_lock);
+	while ((node = rb_first(&zswap_trees[type])) != NULL) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		zswap_erase(entry);
+		zswap_free_entry(entry);
+	}
+	spin_unlock(&zswap_lock);
+	mutex_unlock(&zswap_wb_mutex);
+}
+
+/*
+ * Brings the page back into the swap cache, decompressing it from the
+ * pool, and starts writing it to its slot on the device. The page is
+ * then reclaimed as any other clean swap cache page.
+ */
+static int zswap_writeback_entry(swp_entry_t swp)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct zswap_entry *entry;
+	struct page *page;
+
+	page = read_swap_cache_async(swp, GFP_KERNEL, NULL, 0);
+	if (page == NULL)
+		return -ENOMEM;
+
+	lock_page(page);
+	if (!PageSwapCache(page) || page_private(page) != swp.val ||
+			!PageUptodate(page) || PageWriteback(page))
+		goto out_unlock;
+
+	spin_lock(&zswap_lock);
+	entry = zswap_search(swp_type(swp), swp_offset(swp));
+	if (entry != NULL)
+		zswap_erase(entry);
+	spin_unlock(&zswap_lock);
+	if (entry == NULL)
+		goto out_unlock;
+	zswap_free_entry(entry);
+
+	clear_page_dirty_for_io(page);
+	SetPageReclaim(page);
+	__swap_writepage(page, &wbc);
+	zswap_written_back_pages++;
+	page_cache_release(page);
+	return 0;
+
+out_unlock:
+	unlock_page(page);
+	page_cache_release(page);
+	return -EAGAIN;
+}
+
+static void zswap_writeback_work(struct work_struct *work)
+{
+	struct zswap_entry *entry;
+	swp_entry_t swp;
+	long nr;
+
+	mutex_lock(&zswap_wb_mutex);
+	nr = atomic_long_read(&zswap_stored_pages);
+	while (nr-- > 0 && zswap_pool_pages() > zswap_low_pool_pages()) {
+		spin_lock(&zswap_lock);
+		if (list_empty(&zswap_lru)) {
+			spin_unlock(&zswap_lock);
+			break;
+		}
+		entry = list_entry(zswap_lru.prev, struct zswap_entry, lru);
+		/* rotate, not to get stuck on an entry we fail to write */
+		list_move(&entry->lru, &zswap_lru);
+		swp = swp_entry(entry->type, entry->offset);
+		spin_unlock(&zswap_lock);
+
+		zswap_writeback_entry(swp);
+		cond_resched();
+	}
+	mutex_unlock(&zswap_wb_mutex);
+}
+
+#ifdef CONFIG_SYSFS
+#define ZSWAP_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+#define ZSWAP_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", zswap_enabled);
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long val;
+	int err;
+
+	err = strict_strtoul(buf, 10, &val);
+	if (err || val > 1)
+		return -EINVAL;
+
+	zswap_enabled = val;
+
+	return count;
+}
+ZSWAP_ATTR(enabled);
+
+static ssize_t max_pool_percent_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", zswap_max_pool_percent);
+}
+
+static ssize_t max_pool_percent_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	unsigned long val;
+	int err;
+
+	err = strict_strtoul(buf, 10, &val);
+	if (err || val > 100)
+		return -EINVAL;
+
+	zswap_max_pool_percent = val;
+	if (zswap_pool_pages() > zswap_low_pool_pages())
+		queue_work(zswap_wq, &zswap_wb_work);
+
+	return count;
+}
+ZSWAP_ATTR(max_pool_percent);
+
+static ssize_t pool_pages_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", zswap_pool_pages());
+}
+ZSWAP_ATTR_RO(pool_pages);
+
+static ssize_t stored_pages_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%ld\n", atomic_long_read(&zswap_stored_pages));
+}
+ZSWAP_ATTR_RO(stored_pages);
+
+static ssize_t written_back_pages_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", zswap_written_back_pages);
+}
+ZSWAP_ATTR_RO(written_back_pages);
+
+static ssize_t reject_pool_full_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", zswap_reject_pool_full);
+}
+ZSWAP_ATTR_RO(reject_pool_full);
+
+static ssize_t reject_compress_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", zswap_reject_compress);
+}
+ZSWAP_ATTR_RO(reject_compress);
+
+static ssize_t reject_alloc_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", zswap_reject_alloc);
+}
+ZSWAP_ATTR_RO(reject_alloc);
+
+static ssize_t reject_ub_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", zswap_reject_ub);
+}
+ZSWAP_ATTR_RO(reject_ub);
+
+static struct attribute *zswap_attrs[] = {
+	&enabled_attr.attr,
+	&max_pool_percent_attr.attr,
+	&pool_pages_attr.attr,
+	&stored_pages_attr.attr,
+	&written_back_pages_attr.attr,
+	&reject_pool_full_attr.attr,
+	&reject_compress_attr.attr,
+	&reject_alloc_attr.attr,
+	&reject_ub_attr.attr,
+	NULL,
+};
+
+static struct attribute_group zswap_attr_group = {
+	.attrs = zswap_attrs,
+	.name = "zswap",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init zswap_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		per_cpu(zswap_wrkmem, cpu) = vmalloc(LZO1X_1_MEM_COMPRESS);
+		per_cpu(zswap_dstmem, cpu) =
+			kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+		if (per_cpu(zswap_wrkmem, cpu) == NULL ||
+				per_cpu(zswap_dstmem, cpu) == NULL)
+			goto out_free;
+	}
+
+	zswap_wq = create_singlethread_workqueue("zswap");
+	if (zswap_wq == NULL)
+		goto out_free;
+
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &zswap_attr_group))
+		printk(KERN_ERR "zswap: register sysfs failed\n");
+#endif
+	return 0;
+
+out_free:
+	for_each_possible_cpu(cpu) {
+		vfree(per_cpu(zswap_wrkmem, cpu));
+		kfree(per_cpu(zswap_dstmem, cpu));
+		per_cpu(zswap_wrkmem, cpu) = NULL;
+		per_cpu(zswap_dstmem, cpu) = NULL;
+	}
+	zswap_enabled = 0;
+	printk(KERN_ERR "zswap: cannot allocate compression buffers\n");
+	return -ENOMEM;
+}
+module_init(zswap_init)